@@ -11,27 +11,45 @@
 #include <optional>
 #include <any>
 #include <chrono> // for timing
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
 
 #include <util/model.h>
+#include <util/threadpool.h>
 
 bool powerOf2(int n)
 {
     return (n & (n - 1)) == 0; // see http://www.graphics.stanford.edu/~seander/bithacks.html or https://stackoverflow.com/questions/108318/whats-the-simplest-way-to-test-whether-a-number-is-a-power-of-2-in-c
 }
 
-// utility function for loading a 2D texture from file
+// decoded image, the pixels are freed by the upload functions
+struct Image
+{
+    int width = 0, height = 0, components = 0;
+    unsigned char *data = nullptr;
+};
+
+// decodes an image file (flipped if stbi_set_flip_vertically_on_load is set for the calling thread)
+Image loadImage(const char *path)
+{
+    Image image;
+    image.data = stbi_load(path, &image.width, &image.height, &image.components, 0);
+    return image;
+}
+
+// creates a 2D texture of a decoded image
 // ---------------------------------------------------
-unsigned int loadTexture(const char *path)
+unsigned int uploadTexture(const char *path, Image &image)
 {
     unsigned int textureID;
     glGenTextures(1, &textureID);
 
-    int width, height, nrComponents;
-
-    // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
-    // stbi_set_flip_vertically_on_load(flipVertically);
-
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
+    int width = image.width, height = image.height, nrComponents = image.components;
+    unsigned char *data = image.data;
     if (data)
     {
         try
@@ -76,38 +94,44 @@ unsigned int loadTexture(const char *path)
         std::cout << "Failed to load texture at path: " << path << std::endl;
         stbi_image_free(data);
     }
+    image.data = nullptr;
 
     return textureID;
 }
 
-typedef std::map<const std::string, std::string> CubeMapPaths;
-// utility function for loading a cube map texture from file
+// utility function for loading a 2D texture from file
 // ---------------------------------------------------
-unsigned int loadCubemap(CubeMapPaths cubemap)
+unsigned int loadTexture(const char *path)
 {
+    // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
+    // stbi_set_flip_vertically_on_load(flipVertically);
+
+    Image image = loadImage(path);
+    return uploadTexture(path, image);
+}
+
+typedef std::map<const std::string, std::string> CubeMapPaths;
+const std::string CUBEMAP_FACES[6] = {"right", "left", "top", "bottom", "front", "back"};
 
+// creates a cube map texture of six decoded images (in the order of CUBEMAP_FACES)
+// ---------------------------------------------------
+unsigned int uploadCubemap(Image faces[6])
+{
     unsigned int cubeTextureID;
     glGenTextures(1, &cubeTextureID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, cubeTextureID);
 
-    std::string faces[6] = {"right", "left", "top", "bottom", "front", "back"};
-
-    // stbi_set_flip_vertically_on_load(true);
-
-    int width, height, nrComponents;
     for (unsigned int i = 0; i < 6; i++)
     {
-        auto imgpath = cubemap[faces[i]];
-        unsigned char *image = stbi_load(imgpath.c_str(), &width, &height, &nrComponents, 0);
-
-        if (image)
+        if (faces[i].data)
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-            stbi_image_free(image);
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, faces[i].width, faces[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, faces[i].data);
+            stbi_image_free(faces[i].data);
+            faces[i].data = nullptr;
         }
         else
         {
-            std::cout << "Cubemap texture failed to load for: " << faces[i] << std::endl;
+            std::cout << "Cubemap texture failed to load for: " << CUBEMAP_FACES[i] << std::endl;
         }
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -119,6 +143,18 @@ unsigned int loadCubemap(CubeMapPaths cubemap)
     return cubeTextureID;
 }
 
+// utility function for loading a cube map texture from file
+// ---------------------------------------------------
+unsigned int loadCubemap(CubeMapPaths cubemap)
+{
+    // stbi_set_flip_vertically_on_load(true);
+
+    Image faces[6];
+    for (unsigned int i = 0; i < 6; i++)
+        faces[i] = loadImage(cubemap[CUBEMAP_FACES[i]].c_str());
+    return uploadCubemap(faces);
+}
+
 // forward declarations
 class Model; // defined in model.h
 
@@ -130,6 +166,8 @@ typedef std::map<const std::string, AssetItemMap> Assets;
 
 // if textures should be flipped upside down use { TEX_FLIP, true }
 const std::string TEX_FLIP = "setting-flip-texture";
+// what the models of a group keep on the CPU after the upload, e.g. { MESH_RETENTION, RETAIN_POSITIONS } (see Mesh_Retention)
+const std::string MESH_RETENTION = "setting-mesh-retention";
 
 // a std::map (global variable) that stores all the assets that need to be loaded (i.e., textures and models). Also makes sure that assets are only loaded once!
 std::map<const std::string, std::any> loadedAssets;
@@ -144,6 +182,170 @@ public:
     operator unsigned int() { return m_id; } // cast operator
 };
 
+// resident memory of a loaded asset, see AssetManager::GetMemoryReport
+struct AssetMemory
+{
+    std::string name;
+    size_t cpuBytes = 0;
+    size_t gpuBytes = 0;
+};
+
+// state of an asset that is loaded in the background, shared by its handles
+struct AssetLoadState
+{
+    bool ready = false;  // set on the OpenGL thread once the asset is uploaded
+    bool failed = false; // set on the OpenGL thread if decoding or uploading threw, the asset is never ready
+    std::any value;
+};
+
+// assets requested asynchronously that are not uploaded yet, makes sure they are only loaded once
+std::map<const std::string, std::shared_ptr<AssetLoadState>> loadingAssets;
+
+// Handle of an asynchronously loaded asset (see AssetManager::GetAssetAsync), the asset is available once it is ready
+template <class T>
+class AssetHandle
+{
+public:
+    AssetHandle() = default;
+    AssetHandle(std::shared_ptr<AssetLoadState> state) : m_state{state} {}
+
+    bool Valid() const { return m_state != nullptr; }
+    bool Ready() const { return m_state && m_state->ready; }
+    bool Failed() const { return m_state && m_state->failed; }
+    T Get() const { return std::any_cast<T>(m_state->value); }
+    // the asset once it is ready, the placeholder until then
+    T Get(const T &placeholder) const { return Ready() ? Get() : placeholder; }
+    void Reset() { m_state.reset(); }
+
+private:
+    std::shared_ptr<AssetLoadState> m_state;
+};
+
+// Background loader of the AssetManagers: decoding (stb_image) and mesh processing (Assimp) run on a small
+// thread pool, the OpenGL uploads are queued back to the OpenGL thread and run by Update within a time budget.
+// ---------------------------------------------------
+class AssetLoader
+{
+public:
+    // upload step on the OpenGL thread, returns true once the asset is complete (and stored in asset),
+    // large assets are uploaded in several steps (e.g. one mesh per step)
+    typedef std::function<bool(std::any &asset)> Upload;
+
+    static AssetLoader &Instance()
+    {
+        static AssetLoader loader;
+        return loader;
+    }
+
+    // runs decode on a worker, the upload step it returns is queued for the OpenGL thread
+    std::shared_ptr<AssetLoadState> Load(const std::string &key, std::function<Upload()> decode)
+    {
+        auto found = loadingAssets.find(key);
+        if (found != loadingAssets.end()) // already loading
+            return found->second;
+        auto state = std::make_shared<AssetLoadState>();
+        loadingAssets.insert(std::make_pair(key, state));
+        auto requested = std::chrono::high_resolution_clock::now();
+        m_pool.Submit([this, key, state, requested, decode]()
+                      {
+                          Job job{key, state, requested, Upload(), std::any()};
+                          try
+                          {
+                              job.upload = decode();
+                          }
+                          catch (const std::exception &e)
+                          {
+                              job.error = e.what();
+                          }
+                          catch (...)
+                          {
+                              job.error = "unknown exception";
+                          }
+                          // a failed job is still queued, Update reports it on the OpenGL thread
+                          std::lock_guard<std::mutex> lock(m_mutex);
+                          m_jobs.push_back(std::move(job)); });
+        return state;
+    }
+
+    // runs queued upload steps on the OpenGL thread until the budget (in milliseconds) is used up, at least one
+    // ------------------------------------------------------------------------
+    void Update(double budget)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        while (true)
+        {
+            Job job;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_jobs.empty())
+                    return;
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+            bool complete = false;
+            if (job.error.empty())
+            {
+                try
+                {
+                    complete = job.upload(job.asset);
+                }
+                catch (const std::exception &e)
+                {
+                    job.error = e.what();
+                }
+                catch (...)
+                {
+                    job.error = "unknown exception";
+                }
+            }
+            if (!job.error.empty())
+            {
+                // not stored in loadedAssets, a later request loads it again
+                job.state->failed = true;
+                loadingAssets.erase(job.key);
+                std::cout << "ERROR::ASSETLOADER : Failed to load " << job.key << " : " << job.error << std::endl;
+            }
+            else if (complete)
+            {
+                loadedAssets.insert(std::pair<const std::string, std::any>(job.key, job.asset));
+                job.state->value = job.asset;
+                job.state->ready = true;
+                loadingAssets.erase(job.key);
+                auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - job.requested).count();
+                std::cout << "Loaded " << job.key << " in the background (in " << (duration / 1000) << " milliseconds)." << std::endl;
+            }
+            else
+            {
+                // not complete yet, continue with it first
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_jobs.push_front(std::move(job));
+            }
+            auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            if (elapsed >= budget)
+                return;
+        }
+    }
+
+    // number of assets requested but not uploaded yet
+    size_t Loading() const { return loadingAssets.size(); }
+
+private:
+    struct Job
+    {
+        std::string key;
+        std::shared_ptr<AssetLoadState> state;
+        std::chrono::high_resolution_clock::time_point requested;
+        Upload upload;
+        std::any asset;
+        std::string error; // what decode or upload threw
+    };
+    std::mutex m_mutex;
+    std::deque<Job> m_jobs; // decoded, waiting for their upload
+    ThreadPool m_pool;      // declared last: joined before the queue is destroyed
+
+    AssetLoader() : m_pool(std::max(1u, std::thread::hardware_concurrency() / 2)) {}
+};
+
 class AssetManager
 {
 private:
@@ -160,6 +362,23 @@ private:
             return false; // if key is not set we assume no flipping!
     }
 
+    // checks if there is a MESH_RETENTION="setting-mesh-retention" key in the group
+    Mesh_Retention retentionForGroup(const std::string &group)
+    {
+        const auto &g = m_assets.at(group);
+        if (g.find(MESH_RETENTION) != g.end()) // key found
+            return GetAsset<Mesh_Retention>(group, MESH_RETENTION);
+        else
+            return RETAIN_NONE; // if key is not set the meshes keep nothing on the CPU
+    }
+
+    // key of a model in loadedAssets: a file loaded with another retention is a model of its own
+    static std::string modelKey(const std::string &path, Mesh_Retention retention)
+    {
+        const char *suffix[] = {"", " (positions)", " (all)"};
+        return path + suffix[retention];
+    }
+
     bool GroupExists(const std::string &group)
     {
         if (m_assets.find(group) != m_assets.end()) // key found
@@ -184,26 +403,26 @@ private:
         }
     }
 
-    template <>
-    Model Convert(std::any &r)
+    // models are converted with the retention of the group requesting them
+    ModelPtr convertModel(std::any &r, Mesh_Retention retention)
     {
         try
         {
             auto path = std::any_cast<const char *>(r);
+            std::string key = modelKey(path, retention);
 
-            if (loadedAssets.count(path) <= 0) // not loaded yet (lazy init)
+            if (loadedAssets.count(key) <= 0) // not loaded yet (lazy init)
             {
-                std::cout << "Loading Model " << path << " ... ";
+                std::cout << "Loading Model " << key << " ... ";
                 auto t1 = std::chrono::high_resolution_clock::now();
-                Model *m = new Model(path);
-                loadedAssets.insert(std::pair<const std::string, std::any>(path, *m));
+                ModelPtr m = std::make_shared<Model>(path, false, false, retention);
+                loadedAssets.insert(std::pair<const std::string, std::any>(key, m)); // the model is shared, never copied
                 auto t2 = std::chrono::high_resolution_clock::now();
                 auto duration = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
 
                 std::cout << "done (in " << (duration / 1000) << " milliseconds)." << std::endl;
             }
-            auto m = std::any_cast<Model &>(loadedAssets.at(path));
-            return m;
+            return std::any_cast<ModelPtr>(loadedAssets.at(key));
         }
         catch (const std::bad_any_cast &e)
         {
@@ -263,6 +482,127 @@ private:
 public:
     AssetManager(const Assets assets) : m_assets{assets} { m_active = m_assets.begin()->first; }
 
+    // Requests an asset without blocking: models and textures are decoded in the background and uploaded by
+    // Update, everything else (and assets that are loaded already) is ready right away.
+    // Show a placeholder (e.g. the previous asset) until the handle is ready.
+    // ------------------------------------------------------------------------
+    template <class T>
+    AssetHandle<T> GetAssetAsync(const std::string &group, const std::string &name)
+    {
+        std::any &r = m_assets.at(group).at(name);
+        std::string key;
+        std::function<AssetLoader::Upload()> decode;
+        if constexpr (std::is_same_v<T, ModelPtr>)
+        {
+            std::string path = std::any_cast<const char *>(r);
+            Mesh_Retention retention = retentionForGroup(group);
+            key = modelKey(path, retention);
+            decode = [path, retention]()
+            {
+                auto data = std::make_shared<ModelData>(Model::Import(path));
+                auto model = std::make_shared<Model>(*data, false, false, retention);
+                size_t next = 0;
+                return AssetLoader::Upload([data, model, next](std::any &asset) mutable
+                                           {
+                                               // one mesh per step
+                                               if (next < data->meshes.size())
+                                                   model->AddMesh(data->meshes[next++]);
+                                               if (next < data->meshes.size())
+                                                   return false;
+                                               asset = model;
+                                               return true; });
+            };
+        }
+        else if constexpr (std::is_same_v<T, Tex>)
+        {
+            // stb_image flips per thread, the workers must not depend on the setting of the OpenGL thread
+            int flip = flipImagesForGroup(group);
+            if (r.type() == typeid(CubeMapPaths))
+            {
+                auto cubemap = std::any_cast<CubeMapPaths>(r);
+                key = "cubemap_" + cubemap["front"];
+                decode = [cubemap, flip]() mutable
+                {
+                    stbi_set_flip_vertically_on_load_thread(flip);
+                    auto faces = std::make_shared<std::vector<Image>>(6);
+                    for (unsigned int i = 0; i < 6; i++)
+                        (*faces)[i] = loadImage(cubemap[CUBEMAP_FACES[i]].c_str());
+                    return AssetLoader::Upload([faces](std::any &asset)
+                                               {
+                                                   asset = Tex(uploadCubemap(faces->data()));
+                                                   return true; });
+                };
+            }
+            else
+            {
+                std::string path = std::any_cast<const char *>(r);
+                key = path;
+                decode = [path, flip]()
+                {
+                    stbi_set_flip_vertically_on_load_thread(flip);
+                    auto image = std::make_shared<Image>(loadImage(path.c_str()));
+                    return AssetLoader::Upload([path, image](std::any &asset)
+                                               {
+                                                   asset = Tex(uploadTexture(path.c_str(), *image));
+                                                   return true; });
+                };
+            }
+        }
+
+        auto state = std::make_shared<AssetLoadState>();
+        if (!decode) // nothing to load
+        {
+            state->value = GetAsset<T>(group, name);
+            state->ready = true;
+        }
+        else if (loadedAssets.count(key) > 0)
+        {
+            state->value = loadedAssets.at(key);
+            state->ready = true;
+        }
+        else
+            state = AssetLoader::Instance().Load(key, decode);
+        return AssetHandle<T>(state);
+    }
+
+    template <class T>
+    AssetHandle<T> GetActiveAssetAsync(const std::string &name)
+    {
+        return GetAssetAsync<T>(m_active, name);
+    }
+
+    // uploads the assets decoded in the background, call once per frame on the OpenGL thread;
+    // the budget (in milliseconds) limits the time spent uploading per frame
+    void Update(double budget = 2.0) { AssetLoader::Instance().Update(budget); }
+    // number of assets (of all managers) still loading in the background
+    size_t Loading() const { return AssetLoader::Instance().Loading(); }
+
+    // resident CPU and GPU memory of every loaded asset (of all managers), queries OpenGL
+    // ------------------------------------------------------------------------
+    std::vector<AssetMemory> GetMemoryReport() const
+    {
+        std::vector<AssetMemory> report;
+        for (auto &asset : loadedAssets)
+        {
+            AssetMemory memory;
+            memory.name = asset.first;
+            if (asset.second.type() == typeid(ModelPtr))
+            {
+                ModelPtr model = std::any_cast<ModelPtr>(asset.second);
+                memory.cpuBytes = model->CpuBytes();
+                memory.gpuBytes = model->GpuBytes();
+            }
+            else if (asset.second.type() == typeid(Tex))
+            {
+                Tex texture = std::any_cast<Tex>(asset.second);
+                bool cubemap = asset.first.rfind("cubemap_", 0) == 0;
+                memory.gpuBytes = TextureBytes(texture, cubemap ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D);
+            }
+            report.push_back(memory);
+        }
+        return report;
+    }
+
     template <class T>
     T GetAsset(const std::string &group, const std::string &name)
     {
@@ -279,6 +619,14 @@ public:
         return Convert<Tex>(m_assets.at(group).at(name));
     }
 
+    // Models need a specialized function, due to the retention of their meshes set per group
+    // (a model is loaded once per retention, groups with the same retention share it)
+    template <>
+    ModelPtr GetAsset(const std::string &group, const std::string &name)
+    {
+        return convertModel(m_assets.at(group).at(name), retentionForGroup(group));
+    }
+
     template <class T>
     T GetActiveAsset(const std::string &name)
     {
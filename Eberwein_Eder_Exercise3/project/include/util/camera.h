@@ -112,6 +112,14 @@ public:
             Zoom = 90.0f; 
     }
 
+    // sets the euler angles directly, e.g. from a scripted or recorded camera path
+    void SetOrientation(float yaw, float pitch)
+    {
+        Yaw = yaw;
+        Pitch = pitch;
+        updateCameraVectors();
+    }
+
 private:
     // calculates the front vector from the Camera's (updated) Euler Angles
     void updateCameraVectors()
@@ -0,0 +1,334 @@
+#pragma once
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#ifdef _WIN32
+#ifdef APIENTRY
+#undef APIENTRY // redefined by windows.h, glad only needs it while its header is included
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <util/mesh.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// read-only memory mapping of a whole file
+// ---------------------------------------------------
+class MappedFile
+{
+public:
+    MappedFile(const std::string &path)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER size;
+        HANDLE mapping = NULL;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+            mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);
+        if (!mapping)
+            return;
+        // the view keeps the file mapped after the handles are closed
+        m_data = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (m_data)
+            m_size = (size_t)size.QuadPart;
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                m_data = (const unsigned char *)data;
+                m_size = (size_t)st.st_size;
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    ~MappedFile()
+    {
+        if (!m_data)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+#else
+        munmap((void *)m_data, m_size);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool IsOpen() const { return m_data != nullptr; }
+    const unsigned char *Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+
+private:
+    const unsigned char *m_data = nullptr;
+    size_t m_size = 0;
+};
+
+// CPU side data of a mesh as it is stored in the cache, the textures are references (type and path) without ids
+struct MeshData
+{
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    vector<Texture> textures;
+};
+
+// Binary cache of the meshes of a model file, stored next to it (<model>.meshcache), so the model is
+// mapped into memory instead of being parsed and post-processed by Assimp on every start.
+// Layout: header, mesh table, texture table, strings, then the vertex and index arrays of all meshes
+// (4 byte aligned, ready to be passed to glBufferData). The cache is invalid when the version, the
+// Vertex layout or the size and modification time of the source file differ.
+// ---------------------------------------------------
+class MeshCache
+{
+public:
+    // increase when the layout or the import of the meshes (e.g. the Assimp post-processing) changes
+    static const uint32_t VERSION = 2;
+
+    static std::string CachePath(const std::string &sourcePath) { return sourcePath + ".meshcache"; }
+
+    // maps the cache of the source file, false if there is none or it is out of date
+    // ------------------------------------------------------------------------
+    bool Open(const std::string &sourcePath)
+    {
+        m_file.reset(new MappedFile(CachePath(sourcePath)));
+        if (!m_file->IsOpen() || m_file->Size() < sizeof(Header))
+            return fail();
+        const Header *header = (const Header *)m_file->Data();
+        Header expected = makeHeader(sourcePath, header->meshCount, header->textureCount);
+        if (std::memcmp(header, &expected, sizeof(Header)) != 0)
+            return fail();
+
+        // check all offsets, a truncated or corrupt cache is rebuilt
+        size_t size = m_file->Size();
+        size_t tables = sizeof(Header) + header->meshCount * sizeof(MeshEntry) + header->textureCount * sizeof(TextureEntry);
+        if (tables > size)
+            return fail();
+        m_meshes = (const MeshEntry *)(m_file->Data() + sizeof(Header));
+        m_textures = (const TextureEntry *)(m_meshes + header->meshCount);
+        m_meshCount = header->meshCount;
+        for (uint32_t i = 0; i < m_meshCount; i++)
+        {
+            const MeshEntry &mesh = m_meshes[i];
+            if (mesh.vertexOffset + (uint64_t)mesh.vertexCount * sizeof(Vertex) > size ||
+                mesh.indexOffset + (uint64_t)mesh.indexCount * sizeof(unsigned int) > size ||
+                (uint64_t)mesh.firstTexture + mesh.textureCount > header->textureCount)
+                return fail();
+        }
+        for (uint32_t i = 0; i < header->textureCount; i++)
+            if ((uint64_t)m_textures[i].typeOffset + m_textures[i].typeLength > size ||
+                (uint64_t)m_textures[i].pathOffset + m_textures[i].pathLength > size)
+                return fail();
+        return true;
+    }
+
+    // unmaps the cache, the pointers of the meshes become invalid
+    void Close() { fail(); }
+
+    size_t MeshCount() const { return m_meshCount; }
+    const Vertex *Vertices(size_t mesh) const { return (const Vertex *)(m_file->Data() + m_meshes[mesh].vertexOffset); }
+    size_t VertexCount(size_t mesh) const { return m_meshes[mesh].vertexCount; }
+    const unsigned int *Indices(size_t mesh) const { return (const unsigned int *)(m_file->Data() + m_meshes[mesh].indexOffset); }
+    size_t IndexCount(size_t mesh) const { return m_meshes[mesh].indexCount; }
+    // texture references of the material of a mesh, without ids
+    vector<Texture> Textures(size_t mesh) const
+    {
+        vector<Texture> textures;
+        const char *data = (const char *)m_file->Data();
+        for (uint32_t i = 0; i < m_meshes[mesh].textureCount; i++)
+        {
+            const TextureEntry &entry = m_textures[m_meshes[mesh].firstTexture + i];
+            Texture texture;
+            texture.id = 0;
+            texture.type.assign(data + entry.typeOffset, entry.typeLength);
+            texture.path.assign(data + entry.pathOffset, entry.pathLength);
+            textures.push_back(texture);
+        }
+        return textures;
+    }
+
+    // writes the cache of the source file, into a temporary file that replaces the cache when complete
+    // ------------------------------------------------------------------------
+    static bool Write(const std::string &sourcePath, const vector<MeshData> &meshes)
+    {
+        std::vector<MeshEntry> meshTable(meshes.size());
+        std::vector<TextureEntry> textureTable;
+        std::string strings;
+        for (const MeshData &mesh : meshes)
+            for (const Texture &texture : mesh.textures)
+            {
+                TextureEntry entry;
+                entry.typeOffset = (uint32_t)strings.size();
+                entry.typeLength = (uint32_t)texture.type.size();
+                strings += texture.type;
+                entry.pathOffset = (uint32_t)strings.size();
+                entry.pathLength = (uint32_t)texture.path.size();
+                strings += texture.path;
+                textureTable.push_back(entry);
+            }
+        strings.resize((strings.size() + 3) & ~size_t(3), '\0');
+
+        Header header = makeHeader(sourcePath, (uint32_t)meshes.size(), (uint32_t)textureTable.size());
+        uint64_t stringsOffset = sizeof(Header) + meshTable.size() * sizeof(MeshEntry) + textureTable.size() * sizeof(TextureEntry);
+        for (TextureEntry &entry : textureTable)
+        {
+            entry.typeOffset += (uint32_t)stringsOffset;
+            entry.pathOffset += (uint32_t)stringsOffset;
+        }
+        uint64_t offset = stringsOffset + strings.size();
+        uint32_t firstTexture = 0;
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            meshTable[i].vertexOffset = offset;
+            meshTable[i].vertexCount = (uint32_t)meshes[i].vertices.size();
+            offset += meshes[i].vertices.size() * sizeof(Vertex);
+            meshTable[i].indexOffset = offset;
+            meshTable[i].indexCount = (uint32_t)meshes[i].indices.size();
+            offset += meshes[i].indices.size() * sizeof(unsigned int);
+            meshTable[i].firstTexture = firstTexture;
+            meshTable[i].textureCount = (uint32_t)meshes[i].textures.size();
+            firstTexture += meshTable[i].textureCount;
+        }
+
+        std::string cachePath = CachePath(sourcePath);
+        std::string tempPath = makeTempPath(cachePath);
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            if (!file)
+            {
+                std::cout << "ERROR::MESHCACHE : could not write " << cachePath << std::endl;
+                return false;
+            }
+            file.write((const char *)&header, sizeof(Header));
+            file.write((const char *)meshTable.data(), meshTable.size() * sizeof(MeshEntry));
+            file.write((const char *)textureTable.data(), textureTable.size() * sizeof(TextureEntry));
+            file.write(strings.data(), strings.size());
+            for (const MeshData &mesh : meshes)
+            {
+                file.write((const char *)mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+                file.write((const char *)mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+            }
+            if (!file)
+            {
+                std::cout << "ERROR::MESHCACHE : could not write " << cachePath << std::endl;
+                file.close();
+                std::error_code error;
+                std::filesystem::remove(tempPath, error);
+                return false;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(tempPath, cachePath, error);
+        if (error)
+        {
+            std::cout << "ERROR::MESHCACHE : could not write " << cachePath << " : " << error.message() << std::endl;
+            std::filesystem::remove(tempPath, error);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t vertexSize; // sizeof(Vertex), the layout of the vertex arrays
+        uint32_t meshCount;
+        uint32_t textureCount;
+        uint32_t padding;
+        uint64_t sourceSize;
+        int64_t sourceTime; // modification time of the source file
+    };
+    struct MeshEntry
+    {
+        uint64_t vertexOffset;
+        uint64_t indexOffset;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t firstTexture;
+        uint32_t textureCount;
+    };
+    struct TextureEntry
+    {
+        uint32_t typeOffset, typeLength;
+        uint32_t pathOffset, pathLength;
+    };
+
+    std::unique_ptr<MappedFile> m_file;
+    const MeshEntry *m_meshes = nullptr;
+    const TextureEntry *m_textures = nullptr;
+    uint32_t m_meshCount = 0;
+
+    bool fail()
+    {
+        m_file.reset();
+        m_meshes = nullptr;
+        m_textures = nullptr;
+        m_meshCount = 0;
+        return false;
+    }
+
+    // the cache is written to a file of its own and renamed, so processes and threads that convert the same
+    // model at the same time never write into each other's file, and a reader only ever sees a complete cache
+    static std::string makeTempPath(const std::string &cachePath)
+    {
+        static std::atomic<unsigned int> counter{0};
+#ifdef _WIN32
+        unsigned long pid = GetCurrentProcessId();
+#else
+        unsigned long pid = (unsigned long)getpid();
+#endif
+        size_t thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+        return cachePath + "." + std::to_string(pid) + "." + std::to_string(thread) + "." + std::to_string(counter++) + ".tmp";
+    }
+
+    static Header makeHeader(const std::string &sourcePath, uint32_t meshCount, uint32_t textureCount)
+    {
+        Header header;
+        std::memset(&header, 0, sizeof(Header));
+        std::memcpy(header.magic, "MSHC", 4);
+        header.version = VERSION;
+        header.vertexSize = sizeof(Vertex);
+        header.meshCount = meshCount;
+        header.textureCount = textureCount;
+        std::error_code error;
+        header.sourceSize = (uint64_t)std::filesystem::file_size(sourcePath, error);
+        header.sourceTime = (int64_t)std::filesystem::last_write_time(sourcePath, error).time_since_epoch().count();
+        return header;
+    }
+};
+
+#endif
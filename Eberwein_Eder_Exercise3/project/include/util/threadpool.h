@@ -0,0 +1,183 @@
+#pragma once
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small work-stealing thread pool.
+// Every worker owns a task queue. Workers pop their own queue from the back (LIFO, cache friendly)
+// and steal from the front of the other queues (FIFO) once their own queue runs dry.
+// Tasks submitted from the outside (including the workers of other pools) are distributed round-robin;
+// tasks submitted from within a worker go to that worker's own queue.
+// A task that throws is reported and dropped, the pool keeps running.
+class ThreadPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    // create a pool with numThreads workers (0 = one worker per hardware thread)
+    // ------------------------------------------------------------------------
+    explicit ThreadPool(unsigned int numThreads = 0)
+    {
+        if (numThreads == 0)
+            numThreads = std::thread::hardware_concurrency();
+        if (numThreads == 0)
+            numThreads = 1;
+
+        for (unsigned int i = 0; i < numThreads; i++)
+            m_queues.push_back(std::make_unique<WorkQueue>());
+        for (unsigned int i = 0; i < numThreads; i++)
+            m_workers.emplace_back([this, i]()
+                                   { workerLoop(i); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto &worker : m_workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // number of worker threads
+    // ------------------------------------------------------------------------
+    unsigned int Size() const { return (unsigned int)m_workers.size(); }
+
+    // queue a task for execution
+    // ------------------------------------------------------------------------
+    void Submit(Task task)
+    {
+        m_pending++;
+        int local = localWorker();
+        unsigned int q = (local >= 0) ? (unsigned int)local : (m_next++ % Size());
+        {
+            std::lock_guard<std::mutex> lock(m_queues[q]->mutex);
+            m_queues[q]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_queued++;
+        }
+        m_wake.notify_one();
+    }
+
+    // block until all submitted tasks have finished (must not be called from a worker)
+    // ------------------------------------------------------------------------
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(m_doneMutex);
+        m_done.wait(lock, [this]()
+                    { return m_pending == 0; });
+    }
+
+private:
+    struct WorkQueue
+    {
+        std::deque<Task> tasks;
+        std::mutex mutex;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::vector<std::thread> m_workers;
+    std::atomic<unsigned int> m_next{0};
+    std::atomic<size_t> m_queued{0};  // tasks sitting in a queue
+    std::atomic<size_t> m_pending{0}; // tasks submitted but not finished yet
+    bool m_stop = false;
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wake;
+    std::mutex m_doneMutex;
+    std::condition_variable m_done;
+
+    // pool and index of the worker running on the calling thread, nullptr and -1 for foreign threads
+    struct Worker
+    {
+        const ThreadPool *pool = nullptr;
+        int index = -1;
+    };
+    static Worker &currentWorker()
+    {
+        static thread_local Worker worker;
+        return worker;
+    }
+    // index of the calling worker in this pool, -1 for foreign threads and the workers of other pools
+    int localWorker() const { return currentWorker().pool == this ? currentWorker().index : -1; }
+
+    bool popLocal(unsigned int q, Task &task)
+    {
+        std::lock_guard<std::mutex> lock(m_queues[q]->mutex);
+        if (m_queues[q]->tasks.empty())
+            return false;
+        task = std::move(m_queues[q]->tasks.back());
+        m_queues[q]->tasks.pop_back();
+        return true;
+    }
+
+    bool steal(unsigned int thief, Task &task)
+    {
+        for (unsigned int i = 1; i < Size(); i++)
+        {
+            unsigned int victim = (thief + i) % Size();
+            std::lock_guard<std::mutex> lock(m_queues[victim]->mutex);
+            if (m_queues[victim]->tasks.empty())
+                continue;
+            task = std::move(m_queues[victim]->tasks.front());
+            m_queues[victim]->tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void workerLoop(unsigned int index)
+    {
+        currentWorker() = Worker{this, (int)index};
+        while (true)
+        {
+            Task task;
+            if (popLocal(index, task) || steal(index, task))
+            {
+                m_queued--;
+                try
+                {
+                    task();
+                }
+                catch (const std::exception &e)
+                {
+                    std::cout << "ERROR::THREADPOOL : task threw " << e.what() << std::endl;
+                }
+                catch (...)
+                {
+                    std::cout << "ERROR::THREADPOOL : task threw an unknown exception" << std::endl;
+                }
+                if (m_pending.fetch_sub(1) == 1)
+                {
+                    std::lock_guard<std::mutex> lock(m_doneMutex);
+                    m_done.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_wake.wait(lock, [this]()
+                        { return m_stop || m_queued > 0; });
+            if (m_stop && m_queued == 0)
+                return;
+        }
+    }
+};
+
+#endif
@@ -3,11 +3,19 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
+// lights of the texture buffer of LightClusters (util/clustered.h): position and color texel per light
+uniform samplerBuffer lightData;
+
 uniform mat4 projection;
 uniform mat4 view;
-uniform mat4 model;
+uniform float boxSize;
+
+flat out vec3 lightColor;
 
+// one instance per light
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-}
\ No newline at end of file
+    lightColor = texelFetch(lightData, 2 * gl_InstanceID + 1).rgb;
+    vec3 worldPos = texelFetch(lightData, 2 * gl_InstanceID).xyz + aPos * boxSize;
+    gl_Position = projection * view * vec4(worldPos, 1.0);
+}
@@ -0,0 +1,22 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D lightAccumulation; // sum of the light volumes
+uniform float gamma;
+
+void main()
+{             
+    vec3 Diffuse = texture(gAlbedoSpec, TexCoords).rgb;
+    vec3 lighting = Diffuse * 0.1 + texture(lightAccumulation, TexCoords).rgb; // hard-coded ambient component
+
+    vec3 color = lighting;
+    // map to [0,1)
+    color = color / (color + vec3(1.0));
+    // gamma correct
+    color = pow(color, vec3(1.0/gamma)); 
+
+    FragColor = vec4(color, 1.0);
+}
@@ -0,0 +1,68 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D gDepth;      // depth of the geometry pass, the position is reconstructed
+uniform sampler2D gNormal;     // octahedral encoded normal
+uniform sampler2D gAlbedoSpec;
+uniform mat4 invViewProjection;
+
+uniform samplerBuffer lightData;
+uniform int lightIndex;
+
+uniform vec3 viewPos;
+uniform vec2 screenSize;
+
+// ----------------------------------------------------------------------------
+// must match g_buffer.fs
+vec2 signNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+vec3 decodeNormal(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    return normalize(n);
+}
+// world space position from the depth buffer
+vec3 reconstructPosition(vec2 uv, float depth)
+{
+    vec4 p = invViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    return p.xyz / p.w;
+}
+// ----------------------------------------------------------------------------
+
+// lighting of a single light for the pixels covered by its volume, added up in a floating point buffer;
+// ambient, tonemapping and gamma are applied afterwards by deferred_light_resolve.fs
+void main()
+{             
+    // retrieve data from gbuffer
+    vec2 TexCoords = gl_FragCoord.xy / screenSize;
+    float depth = texture(gDepth, TexCoords).r;
+    if (depth == 1.0)
+        discard; // background, nothing to light
+    vec3 FragPos = reconstructPosition(TexCoords, depth);
+    vec3 Normal = decodeNormal(texture(gNormal, TexCoords).rg);
+    vec3 Diffuse = texture(gAlbedoSpec, TexCoords).rgb;
+    float Specular = texture(gAlbedoSpec, TexCoords).a;
+
+    vec4 lightPos = texelFetch(lightData, 2 * lightIndex);
+    vec3 lightColor = texelFetch(lightData, 2 * lightIndex + 1).rgb;
+    vec3 viewDir  = normalize(viewPos - FragPos);
+    // diffuse
+    vec3 lightDir = normalize(lightPos.xyz - FragPos);
+    vec3 diffuse = max(dot(Normal, lightDir), 0.0) * Diffuse * lightColor;
+    // specular
+    vec3 halfwayDir = normalize(lightDir + viewDir);  
+    float spec = pow(max(dot(Normal, halfwayDir), 0.0), 16.0);
+    vec3 specular = lightColor * spec * Specular;
+    // attenuation, faded out towards the radius of influence in lightPos.w
+    float distance = length(lightPos.xyz - FragPos);
+    float attenuation = 1.0 / (1.0 + distance * distance);
+    float window = clamp(1.0 - pow(distance / lightPos.w, 4.0), 0.0, 1.0);
+    attenuation *= window * window;
+
+    FragColor = vec4((diffuse + specular) * attenuation, 1.0);
+}
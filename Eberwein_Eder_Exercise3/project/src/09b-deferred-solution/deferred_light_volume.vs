@@ -0,0 +1,19 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+// lights of the texture buffer of LightClusters (util/clustered.h): position + radius and color texel per light
+uniform samplerBuffer lightData;
+uniform int lightIndex;
+
+uniform mat4 projection;
+uniform mat4 view;
+
+// the unit sphere mesh is a polyhedron inside the sphere, scale it up to enclose the radius of influence
+const float VOLUME_SCALE = 1.1;
+
+void main()
+{
+    vec4 light = texelFetch(lightData, 2 * lightIndex);
+    vec3 worldPos = light.xyz + aPos * light.w * VOLUME_SCALE;
+    gl_Position = projection * view * vec4(worldPos, 1.0);
+}
@@ -10,6 +10,9 @@
 #include <util/model.h>
 #include <util/assets.h>
 #include <util/window.h>
+#include <util/profiler.h>
+#include <util/clustered.h>
+#include <util/rendertarget.h>
 
 #include <iostream>
 #include <vector>
@@ -21,12 +24,16 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
 void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
 void renderQuad();
-void renderCube();
+void renderCube(unsigned int instances = 1);
+void renderSphere();
 
 // settings
 int SCR_WIDTH = 1280;
 int SCR_HEIGHT = 720;
 
+const unsigned int LIGHTS_BINDING = 0;    // uniform buffer binding point of the lights of deferred_shading.fs
+const unsigned int MAX_UBO_LIGHTS = 1024; // MAX_LIGHTS of deferred_shading.fs
+
 // camera
 Camera camera(glm::vec3(0.0f, 0.0f, 5.0f));
 float lastX = (float)SCR_WIDTH / 2.0;
@@ -42,23 +49,35 @@ float lastFrame = 0.0f;
 
 const char *APP_NAME = "deferred";
 
-int main()
+int main(int argc, char **argv)
 {
     // Settings for deferred shading
     bool animateLights = true;
     bool displayGBuffers = false;
     int gBufferToDisplay = 0;
     int numLights = 32;
+    int objectGrid = 3; // objectGrid x objectGrid backpacks
     float lightboxAlpha = 0.5f;
     float gamma = 1.6f;
+    int lightingMode = 2; // 0: all lights per pixel, 1: screen tiles, 2: clusters, 3: light volumes
+    bool showLightCounts = false;
+    float lightCutoff = 0.05f; // the radius of a light ends where its attenuation falls below this
 
     // New UI parameters for vignette post–processing
     bool vignetteOn = true;
     float vignetteStrength = 0.5f; // 0 = no effect, 1 = full effect
 
+    if (!ParseCommandLine(argc, argv))
+        return -1;
+    CommandLineOption("lighting", lightingMode); // e.g. --set lighting=3 --set lights=1024
+    CommandLineOption("lights", numLights);
+    CommandLineOption("objects", objectGrid);
+    CommandLineOption("cutoff", lightCutoff);
+
     // glfw: initialize and configure
     // ------------------------------
-    InitWindowAndGUI(SCR_WIDTH, SCR_HEIGHT, APP_NAME, false); // avoid resizing the window!
+    if (InitWindowAndGUI(SCR_WIDTH, SCR_HEIGHT, APP_NAME) < 0)
+        return -1;
     glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 
     SetCursorPosCallback(mouse_callback);
@@ -92,6 +111,9 @@ int main()
 
     Shader shaderGeometryPass(SRC + "g_buffer.vs", SRC + "g_buffer.fs");
     Shader shaderLightingPass(SRC + "deferred_shading.vs", SRC + "deferred_shading.fs");
+    Shader shaderClusteredLightingPass(SRC + "deferred_shading.vs", SRC + "deferred_shading_clustered.fs");
+    Shader shaderLightVolume(SRC + "deferred_light_volume.vs", SRC + "deferred_light_volume.fs");
+    Shader shaderLightResolve(SRC + "deferred_shading.vs", SRC + "deferred_light_resolve.fs");
     Shader shaderLightBox(SRC + "deferred_light_box.vs", SRC + "deferred_light_box.fs");
     Shader shaderDebug(SRC + "fbo_debug.vs", SRC + "fbo_debug.fs");
     // New shader for vignette post–processing:
@@ -102,84 +124,40 @@ int main()
     stbi_set_flip_vertically_on_load(true);
     Model myModel("../resources/objects/backpack/backpack.obj", true);
 
-    // positions for several objects in the scene
-    std::vector<glm::vec3> objectPositions;
-    objectPositions.push_back(glm::vec3(-3.0, -0.5, -3.0));
-    objectPositions.push_back(glm::vec3(0.0, -0.5, -3.0));
-    objectPositions.push_back(glm::vec3(3.0, -0.5, -3.0));
-    objectPositions.push_back(glm::vec3(-3.0, -0.5, 0.0));
-    objectPositions.push_back(glm::vec3(0.0, -0.5, 0.0));
-    objectPositions.push_back(glm::vec3(3.0, -0.5, 0.0));
-    objectPositions.push_back(glm::vec3(-3.0, -0.5, 3.0));
-    objectPositions.push_back(glm::vec3(0.0, -0.5, 3.0));
-    objectPositions.push_back(glm::vec3(3.0, -0.5, 3.0));
-
-    // configure g-buffer framebuffer
+    // model matrices of a grid of objects in the scene, 3 units apart, all drawn with one instanced draw call per mesh
+    std::vector<glm::mat4> objectModels;
+    auto placeObjects = [&objectModels](int grid)
+    {
+        objectModels.clear();
+        for (int z = 0; z < grid; z++)
+            for (int x = 0; x < grid; x++)
+            {
+                glm::vec3 position((x - (grid - 1) * 0.5f) * 3.0f, -0.5f, (z - (grid - 1) * 0.5f) * 3.0f);
+                glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+                objectModels.push_back(glm::scale(model, glm::vec3(0.5f)));
+            }
+    };
+    objectGrid = glm::clamp(objectGrid, 1, 32);
+    placeObjects(objectGrid);
+
+    // render targets, allocated with the size of the window when a pass requests them
     // ------------------------------
-    unsigned int gBuffer;
-    glGenFramebuffers(1, &gBuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
-    unsigned int gPosition, gNormal, gAlbedoSpec;
-    // position color buffer
-    glGenTextures(1, &gPosition);
-    glBindTexture(GL_TEXTURE_2D, gPosition);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gPosition, 0);
-    // normal color buffer
-    glGenTextures(1, &gNormal);
-    glBindTexture(GL_TEXTURE_2D, gNormal);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gNormal, 0);
-    // color + specular color buffer
-    glGenTextures(1, &gAlbedoSpec);
-    glBindTexture(GL_TEXTURE_2D, gAlbedoSpec);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gAlbedoSpec, 0);
-    // tell OpenGL which color attachments we'll use (of this framebuffer) for rendering
-    unsigned int attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
-    glDrawBuffers(3, attachments);
-    // create and attach depth buffer (renderbuffer)
-    unsigned int rboDepth;
-    glGenRenderbuffers(1, &rboDepth);
-    glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, SCR_WIDTH, SCR_HEIGHT);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
-    // finally check if framebuffer is complete
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        std::cout << "GBuffer Framebuffer not complete!" << std::endl;
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    // Configure post–processing framebuffer (for vignette effect)
-    // -----------------------------------------------------------
-    unsigned int ppFBO;
-    glGenFramebuffers(1, &ppFBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, ppFBO);
-    unsigned int ppColorBuffer;
-    glGenTextures(1, &ppColorBuffer);
-    glBindTexture(GL_TEXTURE_2D, ppColorBuffer);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ppColorBuffer, 0);
-    // also create a renderbuffer object for depth and stencil attachment
-    unsigned int rboPP;
-    glGenRenderbuffers(1, &rboPP);
-    glBindRenderbuffer(GL_RENDERBUFFER, rboPP);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, SCR_WIDTH, SCR_HEIGHT);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rboPP);
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        std::cout << "Postprocessing framebuffer not complete!" << std::endl;
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // g-buffer, packed layout with 8 bytes per pixel plus depth: the position is reconstructed from the depth buffer,
+    // the normal is octahedral encoded into two 16 bit channels; the depth has a stencil for the light volumes
+    const std::vector<Attachment> GBUFFER = {{GL_RG16}, {GL_RGBA8}, {GL_DEPTH24_STENCIL8}}; // gNormal, gAlbedoSpec, gDepth
+    // light accumulation (for the light volumes): floating point color and a copy of the g-buffer depth,
+    // the volumes are tested against it while the lighting reads gDepth
+    const std::vector<Attachment> ACCUMULATION = {{GL_RGBA16F}, {GL_DEPTH24_STENCIL8}};
+    // post-processing (for the vignette effect)
+    const std::vector<Attachment> POSTPROCESSING = {{GL_RGBA8, GL_LINEAR}, {GL_DEPTH24_STENCIL8}};
+    // The transient targets are recycled from frame to frame, they never share memory within a frame: the resolve
+    // of the light volumes reads the accumulation while it writes the post-processing target, so both are live
+    // at the same time and a common format would not save anything.
+    FramebufferPool framebuffers;
 
     // lighting info
     // -------------
-    const unsigned int NR_LIGHTS = 128;
+    const unsigned int NR_LIGHTS = 4096;
     std::vector<glm::vec3> lightPositions;
     std::vector<glm::vec3> lightColors;
     std::vector<glm::vec4> lightDirs;
@@ -203,23 +181,89 @@ int main()
 
     // shader configuration
     // --------------------
-    shaderLightingPass.use();
-    shaderLightingPass.setInt("gPosition", 0);
-    shaderLightingPass.setInt("gNormal", 1);
-    shaderLightingPass.setInt("gAlbedoSpec", 2);
+    auto configureShaders = [&]()
+    {
+        shaderDebug.use();
+        shaderDebug.setInt("gDepth", 0);
+        shaderDebug.setInt("gNormal", 1);
+        shaderDebug.setInt("gAlbedoSpec", 2);
+        shaderLightingPass.use();
+        shaderLightingPass.setInt("gDepth", 0);
+        shaderLightingPass.setInt("gNormal", 1);
+        shaderLightingPass.setInt("gAlbedoSpec", 2);
+        shaderLightingPass.setBlockBinding("Lights", LIGHTS_BINDING);
+        shaderClusteredLightingPass.use();
+        shaderClusteredLightingPass.setInt("gDepth", 0);
+        shaderClusteredLightingPass.setInt("gNormal", 1);
+        shaderClusteredLightingPass.setInt("gAlbedoSpec", 2);
+        shaderClusteredLightingPass.setInt("lightData", 3);
+        shaderClusteredLightingPass.setInt("lightIndices", 4);
+        shaderClusteredLightingPass.setInt("clusterLights", 5);
+        shaderLightVolume.use();
+        shaderLightVolume.setInt("gDepth", 0);
+        shaderLightVolume.setInt("gNormal", 1);
+        shaderLightVolume.setInt("gAlbedoSpec", 2);
+        shaderLightVolume.setInt("lightData", 3);
+        shaderLightResolve.use();
+        shaderLightResolve.setInt("gAlbedoSpec", 2);
+        shaderLightResolve.setInt("lightAccumulation", 4);
+        shaderLightBox.use();
+        shaderLightBox.setInt("lightData", 3);
+    };
+    configureShaders();
+
+    // the lighting pass without light assignment reads the lights from a uniform buffer (at most MAX_UBO_LIGHTS),
+    // the tiled/clustered lighting pass and the light boxes from the texture buffer of the light clusters
+    unsigned int lightUBO;
+    glGenBuffers(1, &lightUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, lightUBO);
+    glBufferData(GL_UNIFORM_BUFFER, MAX_UBO_LIGHTS * sizeof(GPULight), nullptr, GL_STREAM_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, LIGHTS_BINDING, lightUBO);
+    std::vector<GPULight> gpuLights(NR_LIGHTS);
+    // screen tiles are clusters with a single depth slice
+    auto clusterGrid = [](int assignment, int &tileSize, int &slices)
+    {
+        tileSize = assignment == 1 ? 16 : 32;
+        slices = assignment == 1 ? 1 : 16;
+    };
+    GLint maxUniformBlockSize = 0;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxUniformBlockSize);
+    if (MAX_UBO_LIGHTS * sizeof(GPULight) > (size_t)maxUniformBlockSize)
+    {
+        std::cout << "ERROR::DEFERRED : " << MAX_UBO_LIGHTS << " lights exceed GL_MAX_UNIFORM_BLOCK_SIZE of " << maxUniformBlockSize << " bytes" << std::endl;
+        return -1;
+    }
+    lightingMode = glm::clamp(lightingMode, 0, 3);
+    if (lightingMode == 0 && numLights > (int)MAX_UBO_LIGHTS)
+    {
+        // refuse instead of clamping, a benchmark run would silently measure fewer lights than requested
+        std::cout << "ERROR::DEFERRED : the full-screen lighting renders at most " << MAX_UBO_LIGHTS << " lights, " << numLights << " requested" << std::endl;
+        return -1;
+    }
+    numLights = glm::clamp(numLights, 1, lightingMode == 0 ? (int)MAX_UBO_LIGHTS : (int)NR_LIGHTS);
+    lightCutoff = glm::clamp(lightCutoff, 0.005f, 0.5f); // range of the GUI slider
+    int tileSize, slices;
+    clusterGrid(lightingMode, tileSize, slices);
+    LightClusters lightClusters(NR_LIGHTS, tileSize, slices);
+    lightClusters.Resize(SCR_WIDTH, SCR_HEIGHT);
+
+    // CPU/GPU time of the passes
+    Profiler profiler;
     
     // render loop
     // -----------
-    while (!glfwWindowShouldClose(window))
+    while (!WindowShouldClose())
     {
         // per-frame time logic
-        float currentFrame = glfwGetTime();
+        float currentFrame = FrameTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        profiler.BeginFrame();
 
         // Poll events and process input
         glfwPollEvents();
         processInput(window);
+        UpdateCamera(camera);
 
         if (gui)
         {
@@ -232,7 +276,26 @@ int main()
             ImGui::Text("FPS: %.1f", ImGui::GetIO().Framerate);
             ImGui::SliderFloat("gamma", &gamma, 0.1f, 5.0f);
             ImGui::Checkbox("animate lights", &animateLights);
-            ImGui::SliderInt("number of lights", &numLights, 1, 128);
+            const char *lightingCombo[] = {"full-screen", "tiles", "clusters", "light volumes"};
+            if (ImGui::Combo("lighting", &lightingMode, lightingCombo, 4))
+            {
+                if (lightingMode == 0)
+                    numLights = std::min(numLights, (int)MAX_UBO_LIGHTS);
+                else if (lightingMode < 3)
+                {
+                    clusterGrid(lightingMode, tileSize, slices);
+                    lightClusters.SetGrid(tileSize, slices);
+                }
+            }
+            ImGui::SliderInt("number of lights", &numLights, 1, lightingMode > 0 ? NR_LIGHTS : MAX_UBO_LIGHTS);
+            ImGui::SliderFloat("light cutoff", &lightCutoff, 0.005f, 0.5f, "%.3f");
+            if (lightingMode == 1 || lightingMode == 2)
+            {
+                ImGui::Checkbox("show light counts", &showLightCounts);
+                ImGui::Text("lights per cluster: %.1f avg, %u max", lightClusters.GetAverageLightsPerCluster(), lightClusters.GetMaxLightsPerCluster());
+            }
+            if (ImGui::SliderInt("object grid", &objectGrid, 1, 32))
+                placeObjects(objectGrid);
             ImGui::SliderFloat("lightbox alpha", &lightboxAlpha, 0.0f, 1.0f);
             ImGui::Checkbox("display GBuffers", &displayGBuffers);
             if (displayGBuffers)
@@ -246,14 +309,17 @@ int main()
             {
                 shaderGeometryPass.reload();
                 shaderLightingPass.reload();
+                shaderClusteredLightingPass.reload();
+                shaderLightVolume.reload();
+                shaderLightResolve.reload();
                 shaderLightBox.reload();
                 shaderDebug.reload();
                 shaderVignette.reload();
-                shaderLightingPass.use();
-                shaderLightingPass.setInt("gPosition", 0);
-                shaderLightingPass.setInt("gNormal", 1);
-                shaderLightingPass.setInt("gAlbedoSpec", 2);
+                configureShaders();
             }
+            ImGui::Text("render targets: %zu, %.1f MB", framebuffers.Count(), framebuffers.Bytes() / (1024.0 * 1024.0));
+            ImGui::Text("model: %.1f MB cpu, %.1f MB gpu", myModel.CpuBytes() / (1024.0 * 1024.0), myModel.GpuBytes() / (1024.0 * 1024.0));
+            profiler.DrawGUI();
             ImGui::End();
             ImGui::Render();
         }
@@ -264,65 +330,180 @@ int main()
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         // 1. Geometry pass: render scene's geometry/color data into gbuffer
-        glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
+        profiler.Begin("geometry pass");
+        RenderTarget &gBuffer = framebuffers.Get("gbuffer", GBUFFER, SCR_WIDTH, SCR_HEIGHT);
+        unsigned int gNormal = gBuffer.Texture(0), gAlbedoSpec = gBuffer.Texture(1), gDepth = gBuffer.Texture(2);
+        gBuffer.Bind();
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / SCR_HEIGHT, 0.1f, 100.0f);
         glm::mat4 view = camera.GetViewMatrix();
-        glm::mat4 model = glm::mat4(1.0f);
+        glm::mat4 invViewProjection = glm::inverse(projection * view); // position reconstruction from depth
         shaderGeometryPass.use();
         shaderGeometryPass.setMat4("projection", projection);
         shaderGeometryPass.setMat4("view", view);
-        for (unsigned int i = 0; i < objectPositions.size(); i++)
-        {
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, objectPositions[i]);
-            model = glm::scale(model, glm::vec3(0.5f));
-            shaderGeometryPass.setMat4("model", model);
-            myModel.Draw(shaderGeometryPass);
-        }
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        myModel.DrawInstanced(shaderGeometryPass, objectModels);
+        glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
+        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+        profiler.End();
 
         if (displayGBuffers)
         {
             // For debugging: display one of the GBuffer attachments
+            profiler.Begin("GBuffer display");
             shaderDebug.use();
             glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, gPosition);
+            glBindTexture(GL_TEXTURE_2D, gDepth);
             glActiveTexture(GL_TEXTURE1);
             glBindTexture(GL_TEXTURE_2D, gNormal);
             glActiveTexture(GL_TEXTURE2);
             glBindTexture(GL_TEXTURE_2D, gAlbedoSpec);
             shaderDebug.setInt("fboAttachment", gBufferToDisplay);
+            shaderDebug.setMat4("invViewProjection", invViewProjection);
             renderQuad();
+            profiler.End();
         }
         else
         {
+            // animate the lights in one loop and upload them with a single write into an orphaned buffer
+            profiler.Begin("light update");
+            for (int i = 0; i < numLights; i++)
+            {
+                glm::vec3 pos = lightPositions[i];
+                if (animateLights)
+                    pos += glm::vec3(lightDirs[i]) * std::sinf(currentFrame + lightDirs[i].w);
+                gpuLights[i].position = glm::vec4(pos, LightRadius(lightColors[i], lightCutoff));
+                gpuLights[i].color = glm::vec4(lightColors[i], 1.0f);
+            }
+            lightClusters.UploadLights(gpuLights, numLights);
+            if (lightingMode == 0)
+            {
+                glBindBuffer(GL_UNIFORM_BUFFER, lightUBO);
+                glBufferData(GL_UNIFORM_BUFFER, MAX_UBO_LIGHTS * sizeof(GPULight), nullptr, GL_STREAM_DRAW);
+                glBufferSubData(GL_UNIFORM_BUFFER, 0, numLights * sizeof(GPULight), gpuLights.data());
+            }
+            profiler.End();
+
+            if (lightingMode == 1 || lightingMode == 2)
+            {
+                // bin the bounding spheres of the lights into the tiles/clusters of the frustum
+                profiler.Begin("light assignment");
+                lightClusters.Resize(SCR_WIDTH, SCR_HEIGHT);
+                lightClusters.Assign(gpuLights, numLights, view, projection);
+                profiler.End();
+            }
+
+            RenderTarget *accumulation = nullptr;
+            if (lightingMode == 3)
+            {
+                // 2a. Light volumes: every light adds its contribution to the pixels covered by its bounding sphere.
+                // The stencil pass marks the pixels whose scene depth lies inside the sphere: back faces behind the
+                // scene increment, front faces behind the scene decrement, the count stays 0 in front of and behind the sphere.
+                profiler.Begin("light volumes");
+                accumulation = &framebuffers.Acquire(ACCUMULATION, SCR_WIDTH, SCR_HEIGHT);
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, gBuffer.Framebuffer());
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, accumulation->Framebuffer());
+                glBlitFramebuffer(0, 0, SCR_WIDTH, SCR_HEIGHT, 0, 0, SCR_WIDTH, SCR_HEIGHT, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+                accumulation->Bind();
+                glClearStencil(0);
+                glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, gDepth);
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_2D, gNormal);
+                glActiveTexture(GL_TEXTURE2);
+                glBindTexture(GL_TEXTURE_2D, gAlbedoSpec);
+                lightClusters.BindLights(3);
+                shaderLightVolume.use();
+                shaderLightVolume.setMat4("projection", projection);
+                shaderLightVolume.setMat4("view", view);
+                shaderLightVolume.setVec3("viewPos", camera.Position);
+                shaderLightVolume.setVec2("screenSize", glm::vec2(SCR_WIDTH, SCR_HEIGHT));
+                shaderLightVolume.setMat4("invViewProjection", invViewProjection);
+                int lightIndexLocation = shaderLightVolume.getLocation("lightIndex");
+                glEnable(GL_STENCIL_TEST);
+                glDepthMask(GL_FALSE);
+                glBlendFunc(GL_ONE, GL_ONE);
+                for (int i = 0; i < numLights; i++)
+                {
+                    shaderLightVolume.setInt(lightIndexLocation, i);
+                    // stencil pass: depth test against the scene, no color
+                    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                    glEnable(GL_DEPTH_TEST);
+                    glDisable(GL_CULL_FACE);
+                    glDisable(GL_BLEND);
+                    glStencilFunc(GL_ALWAYS, 0, 0xFF);
+                    glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+                    glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+                    renderSphere();
+                    // light pass: back faces, so the volume also covers the pixels when the camera is inside of it;
+                    // resets the stencil of the lit pixels, the next light starts with a cleared stencil again
+                    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                    glDisable(GL_DEPTH_TEST);
+                    glEnable(GL_CULL_FACE);
+                    glCullFace(GL_FRONT);
+                    glEnable(GL_BLEND);
+                    glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+                    glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+                    renderSphere();
+                }
+                glCullFace(GL_BACK);
+                glDisable(GL_CULL_FACE);
+                glDisable(GL_BLEND);
+                glDisable(GL_STENCIL_TEST);
+                glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+                glEnable(GL_DEPTH_TEST);
+                glDepthMask(GL_TRUE);
+                profiler.End();
+            }
+
             // 2. Lighting and Light Boxes Pass: render to post–processing framebuffer
-            glBindFramebuffer(GL_FRAMEBUFFER, ppFBO);
+            profiler.Begin("lighting pass");
+            RenderTarget &postprocessing = framebuffers.Acquire(POSTPROCESSING, SCR_WIDTH, SCR_HEIGHT);
+            postprocessing.Bind();
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
             // Lighting pass using the G-buffer textures
-            shaderLightingPass.use();
             glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, gPosition);
+            glBindTexture(GL_TEXTURE_2D, gDepth);
             glActiveTexture(GL_TEXTURE1);
             glBindTexture(GL_TEXTURE_2D, gNormal);
             glActiveTexture(GL_TEXTURE2);
             glBindTexture(GL_TEXTURE_2D, gAlbedoSpec);
-            for (unsigned int i = 0; i < lightPositions.size(); i++)
+            lightClusters.BindLights(3);
+            if (lightingMode == 3)
             {
-                glm::vec3 pos = lightPositions[i];
-                if (animateLights)
-                    pos += glm::vec3(lightDirs[i]) * std::sinf(currentFrame + lightDirs[i].w);
-                shaderLightingPass.setVec3("lights[" + std::to_string(i) + "].Position", pos);
-                shaderLightingPass.setVec3("lights[" + std::to_string(i) + "].Color", lightColors[i]);
+                // ambient, tonemapping and gamma of the accumulated light volumes
+                glActiveTexture(GL_TEXTURE4);
+                glBindTexture(GL_TEXTURE_2D, accumulation->Texture(0));
+                shaderLightResolve.use();
+                shaderLightResolve.setFloat("gamma", gamma);
+            }
+            else if (lightingMode > 0)
+            {
+                lightClusters.BindClusters(4, 5);
+                shaderClusteredLightingPass.use();
+                lightClusters.SetUniforms(shaderClusteredLightingPass);
+                shaderClusteredLightingPass.setMat4("view", view);
+                shaderClusteredLightingPass.setVec3("viewPos", camera.Position);
+                shaderClusteredLightingPass.setMat4("invViewProjection", invViewProjection);
+                shaderClusteredLightingPass.setBool("showLightCounts", showLightCounts);
+                shaderClusteredLightingPass.setFloat("gamma", gamma);
+            }
+            else
+            {
+                shaderLightingPass.use();
+                shaderLightingPass.setVec3("viewPos", camera.Position);
+                shaderLightingPass.setMat4("invViewProjection", invViewProjection);
+                shaderLightingPass.setInt("numLights", numLights);
+                shaderLightingPass.setFloat("gamma", gamma);
             }
-            shaderLightingPass.setVec3("viewPos", camera.Position);
-            shaderLightingPass.setInt("numLights", numLights);
-            shaderLightingPass.setFloat("gamma", gamma);
             renderQuad();
+            if (accumulation)
+                framebuffers.Release(*accumulation);
+            profiler.End();
 
             // Render light boxes on top of the scene
+            profiler.Begin("light boxes");
             glEnable(GL_BLEND);
             glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
             glEnable(GL_CULL_FACE);
@@ -330,37 +511,37 @@ int main()
             shaderLightBox.setMat4("projection", projection);
             shaderLightBox.setMat4("view", view);
             shaderLightBox.setFloat("alpha", lightboxAlpha);
-            for (unsigned int i = 0; i < numLights; i++)
-            {
-                glm::vec3 pos = lightPositions[i];
-                if (animateLights)
-                    pos += glm::vec3(lightDirs[i]) * std::sinf(currentFrame + lightDirs[i].w);
-                model = glm::mat4(1.0f);
-                model = glm::translate(model, pos);
-                model = glm::scale(model, glm::vec3(0.125f));
-                shaderLightBox.setMat4("model", model);
-                shaderLightBox.setVec3("lightColor", lightColors[i]);
-                renderCube();
-            }
+            shaderLightBox.setFloat("boxSize", 0.125f);
+            renderCube(numLights); // one instance per light, positions and colors from the light texture buffer
             glDisable(GL_BLEND);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
+            glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+            profiler.End();
 
             // 3. Post–processing: Apply vignette effect
+            profiler.Begin("vignette");
             glClear(GL_COLOR_BUFFER_BIT);
             shaderVignette.use();
             glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, ppColorBuffer);
+            glBindTexture(GL_TEXTURE_2D, postprocessing.Texture(0));
             shaderVignette.setBool("vignetteOn", vignetteOn);
             shaderVignette.setFloat("vignetteStrength", vignetteStrength);
             renderQuad();
+            framebuffers.Release(postprocessing);
+            profiler.End();
         }
 
         // Render the GUI on top
+        profiler.Begin("GUI");
         if (gui)
             ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        glfwSwapBuffers(window);
+        profiler.End();
+        profiler.EndFrame();
+        framebuffers.EndFrame();
+        PresentFrame();
     }
 
+    framebuffers.Clear();
     glfwTerminate();
     return 0;
 }
@@ -368,7 +549,7 @@ int main()
 // renderCube() renders a 1x1 3D cube in NDC.
 unsigned int cubeVAO = 0;
 unsigned int cubeVBO = 0;
-void renderCube()
+void renderCube(unsigned int instances)
 {
     if (cubeVAO == 0)
     {
@@ -431,7 +612,56 @@ void renderCube()
         glBindVertexArray(0);
     }
     glBindVertexArray(cubeVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, instances);
+    glBindVertexArray(0);
+}
+
+// renderSphere() renders a unit sphere (positions only, counter-clockwise outside) as light volume
+unsigned int sphereVAO = 0;
+unsigned int sphereIndexCount = 0;
+void renderSphere()
+{
+    if (sphereVAO == 0)
+    {
+        const unsigned int X_SEGMENTS = 16;
+        const unsigned int Y_SEGMENTS = 12;
+        std::vector<glm::vec3> positions;
+        std::vector<unsigned int> indices;
+        for (unsigned int y = 0; y <= Y_SEGMENTS; ++y)
+        {
+            for (unsigned int x = 0; x <= X_SEGMENTS; ++x)
+            {
+                float theta = (float)y / Y_SEGMENTS * glm::pi<float>();
+                float phi = (float)x / X_SEGMENTS * 2.0f * glm::pi<float>();
+                positions.push_back(glm::vec3(std::cos(phi) * std::sin(theta), std::cos(theta), std::sin(phi) * std::sin(theta)));
+            }
+        }
+        for (unsigned int y = 0; y < Y_SEGMENTS; ++y)
+        {
+            for (unsigned int x = 0; x < X_SEGMENTS; ++x)
+            {
+                unsigned int i0 = y * (X_SEGMENTS + 1) + x;
+                unsigned int i2 = i0 + X_SEGMENTS + 1;
+                indices.insert(indices.end(), {i0, i0 + 1, i2, i0 + 1, i2 + 1, i2});
+            }
+        }
+        sphereIndexCount = (unsigned int)indices.size();
+
+        unsigned int vbo, ebo;
+        glGenVertexArrays(1, &sphereVAO);
+        glGenBuffers(1, &vbo);
+        glGenBuffers(1, &ebo);
+        glBindVertexArray(sphereVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        glBindVertexArray(0);
+    }
+    glBindVertexArray(sphereVAO);
+    glDrawElements(GL_TRIANGLES, sphereIndexCount, GL_UNSIGNED_INT, 0);
     glBindVertexArray(0);
 }
 
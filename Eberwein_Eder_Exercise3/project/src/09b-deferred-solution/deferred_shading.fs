@@ -3,25 +3,54 @@ out vec4 FragColor;
 
 in vec2 TexCoords;
 
-uniform sampler2D gPosition;
-uniform sampler2D gNormal;
+uniform sampler2D gDepth;      // depth of the geometry pass, the position is reconstructed
+uniform sampler2D gNormal;     // octahedral encoded normal
 uniform sampler2D gAlbedoSpec;
+uniform mat4 invViewProjection;
 uniform float gamma;
 
+// std140 layout: vec3 would be padded to 16 bytes anyway, must match GPULight in deferred_shading.cpp
 struct Light {
-    vec3 Position;
-    vec3 Color;
+    vec4 Position; // xyz, w: radius of influence
+    vec4 Color;    // rgb
+};
+const int MAX_LIGHTS = 1024; // 1024 * 32 bytes = 32 KB, deferred_shading.cpp checks GL_MAX_UNIFORM_BLOCK_SIZE
+layout (std140) uniform Lights {
+    Light lights[MAX_LIGHTS];
 };
-const int MAX_LIGHTS = 128;
-uniform Light lights[MAX_LIGHTS];
 uniform vec3 viewPos;
 uniform int numLights;
 
+// ----------------------------------------------------------------------------
+// must match g_buffer.fs
+vec2 signNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+vec3 decodeNormal(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    return normalize(n);
+}
+// world space position from the depth buffer
+vec3 reconstructPosition(vec2 uv, float depth)
+{
+    vec4 p = invViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    return p.xyz / p.w;
+}
+// ----------------------------------------------------------------------------
+
 void main()
 {             
     // retrieve data from gbuffer
-    vec3 FragPos = texture(gPosition, TexCoords).rgb;
-    vec3 Normal = texture(gNormal, TexCoords).rgb;
+    float depth = texture(gDepth, TexCoords).r;
+    if (depth == 1.0)
+        discard; // background, nothing to light
+    vec3 FragPos = reconstructPosition(TexCoords, depth);
+    vec3 Normal = decodeNormal(texture(gNormal, TexCoords).rg);
     vec3 Diffuse = texture(gAlbedoSpec, TexCoords).rgb;
     float Specular = texture(gAlbedoSpec, TexCoords).a;
     
@@ -31,15 +60,20 @@ void main()
     for(int i = 0; i < numLights; ++i)
     {
         // diffuse
-        vec3 lightDir = normalize(lights[i].Position - FragPos);
-        vec3 diffuse = max(dot(Normal, lightDir), 0.0) * Diffuse * lights[i].Color;
+        vec3 lightPos = lights[i].Position.xyz;
+        vec3 lightColor = lights[i].Color.rgb;
+        vec3 lightDir = normalize(lightPos - FragPos);
+        vec3 diffuse = max(dot(Normal, lightDir), 0.0) * Diffuse * lightColor;
         // specular
         vec3 halfwayDir = normalize(lightDir + viewDir);  
         float spec = pow(max(dot(Normal, halfwayDir), 0.0), 16.0);
-        vec3 specular = lights[i].Color * spec * Specular;
+        vec3 specular = lightColor * spec * Specular;
         // attenuation
-        float distance = length(lights[i].Position - FragPos);
+        float distance = length(lightPos - FragPos);
         float attenuation = 1.0 / (1.0 + distance * distance);
+        // fade out towards the radius of influence, same falloff as deferred_shading_clustered.fs
+        float window = clamp(1.0 - pow(distance / lights[i].Position.w, 4.0), 0.0, 1.0);
+        attenuation *= window * window;
         diffuse *= attenuation;
         specular *= attenuation;
         lighting += diffuse + specular;        
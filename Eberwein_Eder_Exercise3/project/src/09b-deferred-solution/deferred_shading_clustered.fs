@@ -0,0 +1,104 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D gDepth;      // depth of the geometry pass, the position is reconstructed
+uniform sampler2D gNormal;     // octahedral encoded normal
+uniform sampler2D gAlbedoSpec;
+uniform mat4 invViewProjection;
+uniform float gamma;
+
+// written by LightClusters (util/clustered.h)
+uniform samplerBuffer lightData;     // 2 texels per light: position + radius, color
+uniform usamplerBuffer lightIndices; // light lists of all clusters, one after another
+uniform usampler3D clusterLights;    // per cluster: offset and length of its light list
+uniform int clusterTileSize;
+uniform float clusterScale;
+uniform float clusterBias;
+uniform bool showLightCounts;        // heatmap of the number of lights per cluster
+
+uniform mat4 view;
+uniform vec3 viewPos;
+
+// offset and length of the light list of the cluster containing the pixel
+uvec2 clusterLightList(vec3 worldPos)
+{
+    float depth = -(view * vec4(worldPos, 1.0)).z;
+    int slice = clamp(int(log(depth) * clusterScale - clusterBias), 0, textureSize(clusterLights, 0).z - 1);
+    return texelFetch(clusterLights, ivec3(ivec2(gl_FragCoord.xy) / clusterTileSize, slice), 0).rg;
+}
+// ----------------------------------------------------------------------------
+// must match g_buffer.fs
+vec2 signNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+vec3 decodeNormal(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    return normalize(n);
+}
+// world space position from the depth buffer
+vec3 reconstructPosition(vec2 uv, float depth)
+{
+    vec4 p = invViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    return p.xyz / p.w;
+}
+// ----------------------------------------------------------------------------
+
+void main()
+{             
+    // retrieve data from gbuffer
+    float depth = texture(gDepth, TexCoords).r;
+    if (depth == 1.0)
+        discard; // background, nothing to light
+    vec3 FragPos = reconstructPosition(TexCoords, depth);
+    vec3 Normal = decodeNormal(texture(gNormal, TexCoords).rg);
+    vec3 Diffuse = texture(gAlbedoSpec, TexCoords).rgb;
+    float Specular = texture(gAlbedoSpec, TexCoords).a;
+    
+    // then calculate lighting as usual, but only for the lights overlapping the cluster of this pixel
+    vec3 lighting  = Diffuse * 0.1; // hard-coded ambient component
+    vec3 viewDir  = normalize(viewPos - FragPos);
+    uvec2 list = clusterLightList(FragPos);
+    for(uint i = list.x; i < list.x + list.y; ++i)
+    {
+        int light = int(texelFetch(lightIndices, int(i)).r);
+        vec4 lightPos = texelFetch(lightData, 2 * light);
+        vec3 lightColor = texelFetch(lightData, 2 * light + 1).rgb;
+        // diffuse
+        vec3 lightDir = normalize(lightPos.xyz - FragPos);
+        vec3 diffuse = max(dot(Normal, lightDir), 0.0) * Diffuse * lightColor;
+        // specular
+        vec3 halfwayDir = normalize(lightDir + viewDir);  
+        float spec = pow(max(dot(Normal, halfwayDir), 0.0), 16.0);
+        vec3 specular = lightColor * spec * Specular;
+        // attenuation, faded out towards the radius of influence in lightPos.w
+        float distance = length(lightPos.xyz - FragPos);
+        float attenuation = 1.0 / (1.0 + distance * distance);
+        float window = clamp(1.0 - pow(distance / lightPos.w, 4.0), 0.0, 1.0);
+        attenuation *= window * window;
+        diffuse *= attenuation;
+        specular *= attenuation;
+        lighting += diffuse + specular;        
+    }
+
+    vec3 color = lighting;
+    // map to [0,1)
+    color = color / (color + vec3(1.0));
+    // gamma correct
+    color = pow(color, vec3(1.0/gamma)); 
+
+    if (showLightCounts)
+    {
+        // blue: few lights, red: 128 and more
+        float heat = clamp(float(list.y) / 128.0, 0.0, 1.0);
+        color = mix(color, vec3(heat, 4.0 * heat * (1.0 - heat), 1.0 - heat), 0.5);
+    }
+
+    FragColor = vec4(color, 1.0);
+}
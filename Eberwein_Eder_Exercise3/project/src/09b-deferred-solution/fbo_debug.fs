@@ -3,9 +3,38 @@
 out vec4 FragColor;
 in  vec2 TexCoords;
   
-uniform sampler2D fboAttachment;
+uniform sampler2D gDepth;
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedoSpec;
+uniform mat4 invViewProjection;
+uniform int fboAttachment; // 0: position, 1: normal, 2: albedo + specular
+
+// must match g_buffer.fs
+vec2 signNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+vec3 decodeNormal(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    return normalize(n);
+}
   
 void main()
 {
-    FragColor = texture(fboAttachment, TexCoords);
-} 
\ No newline at end of file
+    // the attachments are decoded, so the view matches the former position/normal buffers
+    float depth = texture(gDepth, TexCoords).r;
+    bool background = depth == 1.0;
+    if (fboAttachment == 0)
+    {
+        vec4 p = invViewProjection * vec4(vec3(TexCoords, depth) * 2.0 - 1.0, 1.0);
+        FragColor = background ? vec4(0.0) : vec4(p.xyz / p.w, 1.0);
+    }
+    else if (fboAttachment == 1)
+        FragColor = background ? vec4(0.0) : vec4(decodeNormal(texture(gNormal, TexCoords).rg), 1.0);
+    else
+        FragColor = texture(gAlbedoSpec, TexCoords);
+}
@@ -1,8 +1,7 @@
 #version 330 core
-layout (location = 0) out vec3 gPosition;
-layout (location = 1) out vec3 gNormal;
-layout (location = 2) out vec4 gAlbedoSpec;
-
+layout (location = 0) out vec2 gNormal;
+layout (location = 1) out vec4 gAlbedoSpec;
+// the position is not stored, the lighting passes reconstruct it from the depth buffer
 
 in vec2 TexCoords;
 in vec3 FragPos;
@@ -12,14 +11,24 @@ uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_specular1;
 uniform sampler2D texture_normal1;
 
+// octahedral normal encoding: the unit sphere is projected onto an octahedron which is unfolded into [0,1]^2
+vec2 signNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+vec2 encodeNormal(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    return e * 0.5 + 0.5;
+}
+
 void main()
 {    
-    // store the fragment position vector in the first gbuffer texture
-    gPosition = FragPos;
-    // also store the per-fragment normals into the gbuffer
-    gNormal = normalize(Normal);
+    // store the per-fragment normals into the first gbuffer texture
+    gNormal = encodeNormal(normalize(Normal));
     // and the diffuse per-fragment color
     gAlbedoSpec.rgb = texture(texture_diffuse1, TexCoords).rgb;
     // store specular intensity in gAlbedoSpec's alpha component
     gAlbedoSpec.a = texture(texture_specular1, TexCoords).r;
-}
\ No newline at end of file
+}
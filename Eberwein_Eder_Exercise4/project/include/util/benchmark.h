@@ -0,0 +1,422 @@
+#pragma once
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include "camera.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Benchmark mode: the application renders a fixed number of frames with a fixed time step (so animations and
+// the camera path are the same in every run), measures the CPU and GPU time of every frame and reports
+// mean, median, 95th/99th percentile and worst frame as JSON or CSV.
+struct BenchmarkSettings
+{
+    bool enabled = false;    // fixed number of frames with a fixed time step (also used by the headless mode)
+    bool camera = false;     // drive the camera along the camera path
+    int frames = 0;          // measured frames, 0 = length of the camera path (or 100 without path)
+    int warmup = 10;         // frames rendered before the measurement (shader compilation, uploads ...)
+    float fps = 60.0f;       // frame rate of the fixed time step
+    std::string cameraPath;  // camera path to replay, empty for the default sweep
+    std::string recordPath;  // records the camera of an interactive session into this file
+    std::string report;      // .json or .csv report, empty for the console summary only
+    std::map<std::string, std::string> options; // application settings given with --set name=value
+};
+
+BenchmarkSettings benchmark;
+
+// overrides an application setting with the value given by --set name=value, e.g. to compare
+// rendering modes in benchmark runs; the value stays unchanged if the option is not given
+// ---------------------------------------------------
+template <typename T>
+void CommandLineOption(const std::string &name, T &value)
+{
+    auto it = benchmark.options.find(name);
+    if (it == benchmark.options.end())
+        return;
+    std::istringstream stream(it->second);
+    T parsed;
+    if (stream >> parsed)
+        value = parsed;
+    else
+        std::cout << "ERROR::BENCHMARK::OPTION : Invalid value " << it->second << " for " << name << std::endl;
+}
+
+// camera path with Position/Yaw/Pitch/Zoom keyframes, stored as text file with one keyframe per line:
+// time x y z yaw pitch zoom
+// ---------------------------------------------------
+struct CameraKeyframe
+{
+    float time;
+    glm::vec3 position;
+    float yaw;
+    float pitch;
+    float zoom;
+};
+
+class CameraPath
+{
+public:
+    std::vector<CameraKeyframe> Keyframes;
+
+    float Duration() const { return Keyframes.empty() ? 0.0f : Keyframes.back().time; }
+
+    // ------------------------------------------------------------------------
+    bool Load(const std::string &path)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            std::cout << "ERROR::BENCHMARK::CAMERA_PATH : Failed to read " << path << std::endl;
+            return false;
+        }
+        Keyframes.clear();
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream values(line);
+            CameraKeyframe key;
+            if (values >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch >> key.zoom)
+                Keyframes.push_back(key);
+        }
+        std::sort(Keyframes.begin(), Keyframes.end(), [](const CameraKeyframe &a, const CameraKeyframe &b)
+                  { return a.time < b.time; });
+        if (Keyframes.empty())
+        {
+            std::cout << "ERROR::BENCHMARK::CAMERA_PATH : No keyframes in " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    bool Save(const std::string &path) const
+    {
+        std::ofstream file(path);
+        if (!file)
+        {
+            std::cout << "ERROR::BENCHMARK::CAMERA_PATH : Failed to write " << path << std::endl;
+            return false;
+        }
+        file << "# time x y z yaw pitch zoom" << std::endl;
+        file << std::fixed << std::setprecision(4);
+        for (const CameraKeyframe &key : Keyframes)
+            file << key.time << " " << key.position.x << " " << key.position.y << " " << key.position.z << " "
+                 << key.yaw << " " << key.pitch << " " << key.zoom << std::endl;
+        return true;
+    }
+
+    void Add(float time, const Camera &camera)
+    {
+        Keyframes.push_back({time, camera.Position, camera.Yaw, camera.Pitch, camera.Zoom});
+    }
+
+    // sets the camera to the path at the given time: Catmull-Rom spline for the position, linear for the angles
+    // ------------------------------------------------------------------------
+    void Apply(float time, Camera &camera) const
+    {
+        if (Keyframes.empty())
+            return;
+        size_t next = 0;
+        while (next < Keyframes.size() && Keyframes[next].time <= time)
+            next++;
+        if (next == 0 || next == Keyframes.size())
+        {
+            const CameraKeyframe &key = next == 0 ? Keyframes.front() : Keyframes.back();
+            set(camera, key.position, key.yaw, key.pitch, key.zoom);
+            return;
+        }
+
+        const CameraKeyframe &k1 = Keyframes[next - 1], &k2 = Keyframes[next];
+        const CameraKeyframe &k0 = Keyframes[next >= 2 ? next - 2 : next - 1];
+        const CameraKeyframe &k3 = Keyframes[std::min(next + 1, Keyframes.size() - 1)];
+        float t = (time - k1.time) / std::max(k2.time - k1.time, 1e-6f);
+        float t2 = t * t, t3 = t2 * t;
+        glm::vec3 position = 0.5f * ((2.0f * k1.position) + (-k0.position + k2.position) * t +
+                                     (2.0f * k0.position - 5.0f * k1.position + 4.0f * k2.position - k3.position) * t2 +
+                                     (-k0.position + 3.0f * k1.position - 3.0f * k2.position + k3.position) * t3);
+        set(camera, position, glm::mix(k1.yaw, k2.yaw, t), glm::mix(k1.pitch, k2.pitch, t), glm::mix(k1.zoom, k2.zoom, t));
+    }
+
+    // default path for scenes without a recorded one: dolly in and out while looking around the start view
+    // ------------------------------------------------------------------------
+    static CameraPath Sweep(const Camera &start, float duration = 5.0f)
+    {
+        const float yaw[] = {0.0f, 30.0f, 0.0f, -30.0f, 0.0f};
+        const float pitch[] = {0.0f, 10.0f, 0.0f, -10.0f, 0.0f};
+        const float dolly[] = {0.0f, 1.0f, 1.5f, 1.0f, 0.0f};
+        CameraPath path;
+        for (int i = 0; i < 5; i++)
+            path.Keyframes.push_back({duration * i / 4.0f, start.Position + start.Front * dolly[i],
+                                      start.Yaw + yaw[i], glm::clamp(start.Pitch + pitch[i], -89.0f, 89.0f), start.Zoom});
+        return path;
+    }
+
+private:
+    static void set(Camera &camera, glm::vec3 position, float yaw, float pitch, float zoom)
+    {
+        camera.Position = position;
+        camera.Zoom = zoom;
+        camera.SetOrientation(yaw, pitch);
+    }
+};
+
+// mean, percentiles and worst value of a series of frame times
+// ---------------------------------------------------
+struct FrameStatistics
+{
+    double mean = 0.0, p50 = 0.0, p95 = 0.0, p99 = 0.0, worst = 0.0;
+
+    static FrameStatistics Compute(std::vector<double> values)
+    {
+        FrameStatistics stats;
+        if (values.empty())
+            return stats;
+        std::sort(values.begin(), values.end());
+        for (double value : values)
+            stats.mean += value;
+        stats.mean /= values.size();
+        // nearest rank
+        auto percentile = [&](double p)
+        { return values[std::min(values.size() - 1, (size_t)std::max(0.0, std::ceil(p * values.size()) - 1.0))]; };
+        stats.p50 = percentile(0.50);
+        stats.p95 = percentile(0.95);
+        stats.p99 = percentile(0.99);
+        stats.worst = values.back();
+        return stats;
+    }
+};
+
+// measures the CPU and GPU time of single frames; the GPU time is read right at the end of the frame,
+// which serializes CPU and GPU, but every measurement belongs to exactly one frame
+// ---------------------------------------------------
+class FrameTimer
+{
+public:
+    struct Timing
+    {
+        double cpu;   // time spent on the CPU until the frame was submitted, in ms
+        double gpu;   // time between the start and the end of the frame on the GPU, in ms
+        double frame; // time from the start of the frame until the GPU finished it, in ms
+    };
+
+    std::vector<Timing> Timings;
+
+    bool Running() const { return m_running; }
+
+    // ------------------------------------------------------------------------
+    void Begin()
+    {
+        if (!m_queries[0])
+            glGenQueries(2, m_queries);
+        m_running = true;
+        m_start = glfwGetTime();
+        glQueryCounter(m_queries[0], GL_TIMESTAMP);
+    }
+
+    void End()
+    {
+        m_running = false;
+        Timing timing;
+        timing.cpu = (glfwGetTime() - m_start) * 1000.0;
+        glQueryCounter(m_queries[1], GL_TIMESTAMP);
+        GLuint64 start = 0, end = 0;
+        glGetQueryObjectui64v(m_queries[0], GL_QUERY_RESULT, &start); // waits for the GPU
+        glGetQueryObjectui64v(m_queries[1], GL_QUERY_RESULT, &end);
+        timing.gpu = (end - start) / 1.0e6;
+        timing.frame = (glfwGetTime() - m_start) * 1000.0;
+        Timings.push_back(timing);
+    }
+
+    FrameStatistics Statistics(double Timing::*value, size_t first = 0) const
+    {
+        std::vector<double> values;
+        for (size_t i = first; i < Timings.size(); i++)
+            values.push_back(Timings[i].*value);
+        return FrameStatistics::Compute(values);
+    }
+
+private:
+    unsigned int m_queries[2] = {0, 0};
+    double m_start = 0.0;
+    bool m_running = false;
+};
+
+// runs the benchmark: counts the frames, provides the fixed time step, replays or records the camera path
+// ---------------------------------------------------
+class BenchmarkRunner
+{
+public:
+    // loads the camera path and resolves the number of frames, called after the command line was parsed
+    // ------------------------------------------------------------------------
+    bool Init()
+    {
+        if (!benchmark.cameraPath.empty())
+        {
+            if (!m_path.Load(benchmark.cameraPath))
+                return false;
+            benchmark.camera = true;
+        }
+        if (benchmark.frames <= 0)
+            benchmark.frames = benchmark.camera && !m_path.Keyframes.empty() ? (int)std::ceil(m_path.Duration() * benchmark.fps) + 1 : 100;
+        return true;
+    }
+
+    int Frame() const { return m_frame; }
+    bool Finished() const { return m_frame >= benchmark.warmup + benchmark.frames; }
+
+    // time of the current frame in seconds, 0 during the warmup
+    double Time() const { return std::max(0, m_frame - benchmark.warmup) / (double)benchmark.fps; }
+
+    void BeginFrame()
+    {
+        if (!m_timer.Running())
+            m_timer.Begin();
+    }
+
+    // returns true after the last frame
+    bool EndFrame()
+    {
+        BeginFrame(); // in case the loop did not ask WindowShouldClose before the frame
+        m_timer.End();
+        m_frame++;
+        return Finished();
+    }
+
+    // replays the camera path in benchmark mode, records the camera in interactive sessions
+    // ------------------------------------------------------------------------
+    void UpdateCamera(Camera &camera)
+    {
+        if (benchmark.enabled && benchmark.camera)
+        {
+            if (m_path.Keyframes.empty())
+                m_path = CameraPath::Sweep(camera, (benchmark.frames - 1) / benchmark.fps);
+            m_path.Apply((float)Time(), camera);
+        }
+        else if (!benchmark.recordPath.empty())
+        {
+            float time = (float)glfwGetTime();
+            if (m_recording.Keyframes.empty())
+                m_recordStart = time;
+            // 20 keyframes per second are plenty for the spline
+            if (m_recording.Keyframes.empty() || time - m_recordStart - m_recording.Duration() >= 0.05f)
+                m_recording.Add(time - m_recordStart, camera);
+        }
+    }
+
+    void SaveRecording()
+    {
+        if (benchmark.recordPath.empty() || m_recording.Keyframes.empty())
+            return;
+        if (m_recording.Save(benchmark.recordPath))
+            std::cout << "benchmark: recorded " << m_recording.Keyframes.size() << " keyframes ("
+                      << m_recording.Duration() << " s) to " << benchmark.recordPath << std::endl;
+    }
+
+    // prints the summary and writes the report
+    // ------------------------------------------------------------------------
+    void Report(const char *appname, int width, int height) const
+    {
+        size_t first = std::min((size_t)benchmark.warmup, m_timer.Timings.size());
+        FrameStatistics cpu = m_timer.Statistics(&FrameTimer::Timing::cpu, first);
+        FrameStatistics gpu = m_timer.Statistics(&FrameTimer::Timing::gpu, first);
+        FrameStatistics frame = m_timer.Statistics(&FrameTimer::Timing::frame, first);
+        const char *renderer = (const char *)glGetString(GL_RENDERER);
+
+        std::cout << std::fixed << std::setprecision(3)
+                  << "benchmark: " << appname << ", " << m_timer.Timings.size() - first << " frames at " << width << "x" << height
+                  << " on " << renderer << std::endl;
+        for (const auto &option : benchmark.options)
+            std::cout << "  " << option.first << " = " << option.second << std::endl;
+        std::cout << "            mean     p50     p95     p99   worst (ms)" << std::endl;
+        auto row = [](const char *name, const FrameStatistics &s)
+        {
+            std::cout << "  " << std::left << std::setw(6) << name << std::right << std::setw(8) << s.mean << std::setw(8) << s.p50
+                      << std::setw(8) << s.p95 << std::setw(8) << s.p99 << std::setw(8) << s.worst << std::endl;
+        };
+        row("cpu", cpu);
+        row("gpu", gpu);
+        row("frame", frame);
+
+        if (benchmark.report.empty())
+            return;
+        std::ofstream file(benchmark.report);
+        if (!file)
+        {
+            std::cout << "ERROR::BENCHMARK::REPORT : Failed to write " << benchmark.report << std::endl;
+            return;
+        }
+        file << std::fixed << std::setprecision(4);
+        std::string extension = benchmark.report.substr(benchmark.report.find_last_of('.') + 1);
+        if (extension == "json")
+        {
+            auto stats = [&](const char *name, const FrameStatistics &s)
+            {
+                file << "  \"" << name << "\": {\"mean\": " << s.mean << ", \"p50\": " << s.p50 << ", \"p95\": " << s.p95
+                     << ", \"p99\": " << s.p99 << ", \"worst\": " << s.worst << "}," << std::endl;
+            };
+            file << "{" << std::endl
+                 << "  \"application\": \"" << appname << "\"," << std::endl
+                 << "  \"renderer\": \"" << renderer << "\"," << std::endl
+                 << "  \"width\": " << width << "," << std::endl
+                 << "  \"height\": " << height << "," << std::endl
+                 << "  \"warmup\": " << first << "," << std::endl
+                 << "  \"frames\": " << m_timer.Timings.size() - first << "," << std::endl
+                 << "  \"options\": {";
+            for (auto it = benchmark.options.begin(); it != benchmark.options.end(); ++it)
+                file << (it == benchmark.options.begin() ? "" : ", ") << "\"" << it->first << "\": \"" << it->second << "\"";
+            file << "}," << std::endl;
+            stats("cpu_ms", cpu);
+            stats("gpu_ms", gpu);
+            stats("frame_ms", frame);
+            file << "  \"samples\": [" << std::endl;
+            for (size_t i = first; i < m_timer.Timings.size(); i++)
+            {
+                const FrameTimer::Timing &t = m_timer.Timings[i];
+                file << "    {\"cpu_ms\": " << t.cpu << ", \"gpu_ms\": " << t.gpu << ", \"frame_ms\": " << t.frame << "}"
+                     << (i + 1 < m_timer.Timings.size() ? "," : "") << std::endl;
+            }
+            file << "  ]" << std::endl
+                 << "}" << std::endl;
+        }
+        else
+        {
+            // one row per measured frame, followed by the statistics rows
+            file << "frame,cpu_ms,gpu_ms,frame_ms" << std::endl;
+            for (size_t i = first; i < m_timer.Timings.size(); i++)
+            {
+                const FrameTimer::Timing &t = m_timer.Timings[i];
+                file << i - first << "," << t.cpu << "," << t.gpu << "," << t.frame << std::endl;
+            }
+            file << "mean," << cpu.mean << "," << gpu.mean << "," << frame.mean << std::endl
+                 << "p50," << cpu.p50 << "," << gpu.p50 << "," << frame.p50 << std::endl
+                 << "p95," << cpu.p95 << "," << gpu.p95 << "," << frame.p95 << std::endl
+                 << "p99," << cpu.p99 << "," << gpu.p99 << "," << frame.p99 << std::endl
+                 << "worst," << cpu.worst << "," << gpu.worst << "," << frame.worst << std::endl;
+        }
+    }
+
+private:
+    CameraPath m_path;
+    CameraPath m_recording;
+    FrameTimer m_timer;
+    int m_frame = 0;
+    float m_recordStart = 0.0f;
+};
+
+BenchmarkRunner benchmarkRunner;
+
+#endif
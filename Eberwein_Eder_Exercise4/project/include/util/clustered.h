@@ -0,0 +1,296 @@
+#pragma once
+#ifndef CLUSTERED_H
+#define CLUSTERED_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <util/shader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// point light as stored in the light buffers (std140 uniform blocks and the light texture buffer)
+struct GPULight
+{
+    glm::vec4 position; // xyz, w: radius of influence
+    glm::vec4 color;    // rgb
+};
+
+// distance at which the attenuation 1 / (1 + d^2) of the brightest channel falls below the cutoff,
+// the lighting shaders fade the light out towards this radius
+inline float LightRadius(const glm::vec3 &color, float cutoff)
+{
+    float brightest = std::max(color.r, std::max(color.g, color.b));
+    return std::sqrt(std::max(brightest / cutoff - 1.0f, 0.0f));
+}
+
+// Clustered light assignment on the CPU: the view frustum is divided into screen tiles of TileSize x TileSize
+// pixels and Slices exponentially spaced depth slices. Every frame the lights are binned into the clusters
+// their bounding spheres overlap, and a pixel only loops over the light list of its cluster. With one slice
+// this is tiled light culling.
+// The lights (2 RGBA32F texels each) and the concatenated light lists (R32UI) are texture buffers,
+// the offset and count of every cluster's list is an RG32UI 3D texture with one texel per cluster.
+// Shaders look up their list with
+//     uniform samplerBuffer lightData; uniform usamplerBuffer lightIndices; uniform usampler3D clusterLights;
+//     uniform int clusterTileSize; uniform float clusterScale; uniform float clusterBias;
+//     int slice = clamp(int(log(viewDepth) * clusterScale - clusterBias), 0, textureSize(clusterLights, 0).z - 1);
+//     uvec2 list = texelFetch(clusterLights, ivec3(ivec2(gl_FragCoord.xy) / clusterTileSize, slice), 0).rg;
+class LightClusters
+{
+public:
+    // ------------------------------------------------------------------------
+    LightClusters(int maxLights, int tileSize = 32, int slices = 16) : m_maxLights(maxLights)
+    {
+        glGenBuffers(1, &m_lightBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, m_lightBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, maxLights * sizeof(GPULight), nullptr, GL_STREAM_DRAW);
+        glGenTextures(1, &m_lightTexture);
+        glBindTexture(GL_TEXTURE_BUFFER, m_lightTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_lightBuffer);
+
+        glGenBuffers(1, &m_indexBuffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, m_indexBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(unsigned int), nullptr, GL_STREAM_DRAW);
+        glGenTextures(1, &m_indexTexture);
+        glBindTexture(GL_TEXTURE_BUFFER, m_indexTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, m_indexBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        glGenTextures(1, &m_clusterTexture);
+        GLint maxTexels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        m_maxIndices = (unsigned int)maxTexels;
+
+        SetGrid(tileSize, slices);
+    }
+
+    // the GL objects are not deleted: the clusters outlive the OpenGL context (glfwTerminate)
+    LightClusters(const LightClusters &) = delete;
+    LightClusters &operator=(const LightClusters &) = delete;
+
+    // ------------------------------------------------------------------------
+    void SetGrid(int tileSize, int slices)
+    {
+        m_tileSize = std::max(tileSize, 1);
+        m_slices = std::max(slices, 1);
+        Resize(m_width, m_height, true);
+    }
+
+    // size of the framebuffer the clusters cover, call when it changes
+    // ------------------------------------------------------------------------
+    void Resize(int width, int height, bool force = false)
+    {
+        if (!force && width == m_width && height == m_height)
+            return;
+        m_width = width;
+        m_height = height;
+        m_tilesX = (width + m_tileSize - 1) / m_tileSize;
+        m_tilesY = (height + m_tileSize - 1) / m_tileSize;
+        m_clusters.assign(m_tilesX * m_tilesY * m_slices * 2, 0);
+        if (m_clusters.empty())
+            return;
+
+        glBindTexture(GL_TEXTURE_3D, m_clusterTexture);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RG32UI, m_tilesX, m_tilesY, m_slices, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+
+    // uploads the first count lights with one write into an orphaned buffer
+    // ------------------------------------------------------------------------
+    void UploadLights(const std::vector<GPULight> &lights, int count)
+    {
+        count = std::min(count, m_maxLights);
+        glBindBuffer(GL_TEXTURE_BUFFER, m_lightBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, m_maxLights * sizeof(GPULight), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, count * sizeof(GPULight), lights.data());
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // bins the first count lights into the clusters of the frustum and uploads the light lists
+    // ------------------------------------------------------------------------
+    void Assign(const std::vector<GPULight> &lights, int count, const glm::mat4 &view, const glm::mat4 &projection)
+    {
+        count = std::min(count, m_maxLights);
+        int clusterCount = m_tilesX * m_tilesY * m_slices;
+        std::vector<unsigned int> &counts = m_cursor;
+        counts.assign(clusterCount, 0);
+        m_ranges.resize(count);
+
+        // exponential depth slices between the near and far plane of the projection
+        m_near = projection[3][2] / (projection[2][2] - 1.0f);
+        m_far = projection[3][2] / (projection[2][2] + 1.0f);
+        m_scale = m_slices / std::log(m_far / m_near);
+        m_bias = m_slices * std::log(m_near) / std::log(m_far / m_near);
+
+        // 1. cluster range of every light, count the lights per cluster
+        for (int i = 0; i < count; i++)
+        {
+            Range &range = m_ranges[i];
+            if (!clusterRange(glm::vec3(lights[i].position), lights[i].position.w, view, projection, range))
+            {
+                range = Range{glm::ivec3(0), glm::ivec3(-1)};
+                continue;
+            }
+            for (int z = range.lo.z; z <= range.hi.z; z++)
+                for (int y = range.lo.y; y <= range.hi.y; y++)
+                    for (int x = range.lo.x; x <= range.hi.x; x++)
+                        counts[(z * m_tilesY + y) * m_tilesX + x]++;
+        }
+
+        // 2. offsets of the lists (prefix sum), limited by the size of the index texture buffer
+        unsigned int total = 0;
+        m_maxPerCluster = 0;
+        for (int c = 0; c < clusterCount; c++)
+        {
+            unsigned int n = std::min(counts[c], m_maxIndices - total);
+            if (n < counts[c] && !m_overflowReported)
+            {
+                std::cout << "ERROR::CLUSTERED : light lists exceed GL_MAX_TEXTURE_BUFFER_SIZE, dropping lights" << std::endl;
+                m_overflowReported = true;
+            }
+            m_clusters[2 * c] = total;
+            m_clusters[2 * c + 1] = n;
+            counts[c] = total; // from now on the write cursor of the cluster
+            total += n;
+            m_maxPerCluster = std::max(m_maxPerCluster, n);
+        }
+        m_totalIndices = total;
+
+        // 3. fill the lists, in light order
+        m_indices.resize(std::max(total, 1u));
+        for (int i = 0; i < count; i++)
+        {
+            const Range &range = m_ranges[i];
+            for (int z = range.lo.z; z <= range.hi.z; z++)
+                for (int y = range.lo.y; y <= range.hi.y; y++)
+                    for (int x = range.lo.x; x <= range.hi.x; x++)
+                    {
+                        int c = (z * m_tilesY + y) * m_tilesX + x;
+                        if (counts[c] < m_clusters[2 * c] + m_clusters[2 * c + 1])
+                            m_indices[counts[c]++] = i;
+                    }
+        }
+
+        glBindBuffer(GL_TEXTURE_BUFFER, m_indexBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, m_indices.size() * sizeof(unsigned int), m_indices.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_3D, m_clusterTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, m_tilesX, m_tilesY, m_slices, GL_RG_INTEGER, GL_UNSIGNED_INT, m_clusters.data());
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+
+    // ------------------------------------------------------------------------
+    void BindLights(unsigned int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, m_lightTexture);
+    }
+
+    void BindClusters(unsigned int indexUnit, unsigned int clusterUnit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + indexUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, m_indexTexture);
+        glActiveTexture(GL_TEXTURE0 + clusterUnit);
+        glBindTexture(GL_TEXTURE_3D, m_clusterTexture);
+    }
+
+    // sets the uniforms of the cluster lookup, the shader has to be in use
+    void SetUniforms(Shader &shader) const
+    {
+        shader.setInt("clusterTileSize", m_tileSize);
+        shader.setFloat("clusterScale", m_scale);
+        shader.setFloat("clusterBias", m_bias);
+    }
+
+    int GetTileSize() const { return m_tileSize; }
+    int GetSlices() const { return m_slices; }
+    unsigned int GetMaxLightsPerCluster() const { return m_maxPerCluster; }
+    float GetAverageLightsPerCluster() const
+    {
+        int clusterCount = m_tilesX * m_tilesY * m_slices;
+        return clusterCount > 0 ? (float)m_totalIndices / clusterCount : 0.0f;
+    }
+
+private:
+    struct Range
+    {
+        glm::ivec3 lo, hi; // first and last cluster in x, y and slice
+    };
+
+    int m_maxLights;
+    unsigned int m_maxIndices = 0;
+    int m_tileSize = 32, m_slices = 16;
+    int m_width = 0, m_height = 0;
+    int m_tilesX = 0, m_tilesY = 0;
+    float m_near = 0.1f, m_far = 100.0f;
+    float m_scale = 0.0f, m_bias = 0.0f;
+    unsigned int m_lightBuffer = 0, m_lightTexture = 0;
+    unsigned int m_indexBuffer = 0, m_indexTexture = 0;
+    unsigned int m_clusterTexture = 0;
+
+    std::vector<unsigned int> m_clusters; // offset and count per cluster
+    std::vector<unsigned int> m_indices;
+    std::vector<unsigned int> m_cursor;
+    std::vector<Range> m_ranges;
+    unsigned int m_totalIndices = 0;
+    unsigned int m_maxPerCluster = 0;
+    bool m_overflowReported = false;
+
+    int slice(float depth) const
+    {
+        return glm::clamp((int)std::floor(std::log(depth) * m_scale - m_bias), 0, m_slices - 1);
+    }
+
+    // conservative cluster range of a sphere: the screen rectangle of its projected view-space bounding box
+    // and the slices of its depth range, returns false if the sphere is outside of the frustum
+    // ------------------------------------------------------------------------
+    bool clusterRange(const glm::vec3 &position, float radius, const glm::mat4 &view, const glm::mat4 &projection,
+                      Range &range) const
+    {
+        glm::vec3 center = glm::vec3(view * glm::vec4(position, 1.0f));
+        float minDepth = -center.z - radius, maxDepth = -center.z + radius;
+        if (maxDepth < m_near || minDepth > m_far)
+            return false;
+
+        glm::vec2 lo(-1.0f), hi(1.0f);
+        if (minDepth > m_near)
+        {
+            lo = glm::vec2(1.0f);
+            hi = glm::vec2(-1.0f);
+            for (int c = 0; c < 8; c++)
+            {
+                glm::vec3 corner = center + radius * glm::vec3(c & 1 ? 1.0f : -1.0f, c & 2 ? 1.0f : -1.0f, c & 4 ? 1.0f : -1.0f);
+                glm::vec4 clip = projection * glm::vec4(corner, 1.0f);
+                glm::vec2 ndc = glm::vec2(clip) / clip.w;
+                lo = glm::min(lo, ndc);
+                hi = glm::max(hi, ndc);
+            }
+            if (hi.x < -1.0f || hi.y < -1.0f || lo.x > 1.0f || lo.y > 1.0f)
+                return false;
+        }
+        // else the sphere intersects the near plane: the whole screen
+
+        glm::vec2 size((float)m_width, (float)m_height);
+        glm::vec2 pixelLo = (glm::clamp(lo, -1.0f, 1.0f) * 0.5f + 0.5f) * size;
+        glm::vec2 pixelHi = (glm::clamp(hi, -1.0f, 1.0f) * 0.5f + 0.5f) * size;
+        range.lo = glm::ivec3(std::min((int)pixelLo.x / m_tileSize, m_tilesX - 1),
+                              std::min((int)pixelLo.y / m_tileSize, m_tilesY - 1),
+                              slice(std::max(minDepth, m_near)));
+        range.hi = glm::ivec3(std::min((int)pixelHi.x / m_tileSize, m_tilesX - 1),
+                              std::min((int)pixelHi.y / m_tileSize, m_tilesY - 1),
+                              slice(std::min(maxDepth, m_far)));
+        return true;
+    }
+};
+
+#endif
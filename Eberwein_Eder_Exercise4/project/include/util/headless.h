@@ -0,0 +1,113 @@
+#pragma once
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Headless mode: the application renders a fixed number of frames (see benchmark.h) into an offscreen
+// framebuffer of an invisible window (or a surfaceless EGL / OSMesa context), without GUI.
+// The frames are not rendered into the default framebuffer of the hidden window, since pixels of a window
+// that is not visible may be discarded by the window system (pixel ownership).
+struct HeadlessSettings
+{
+    bool enabled = false;
+    int width = 0;                  // size of the offscreen framebuffer, 0 keeps the size of the application
+    int height = 0;
+    std::string context = "native"; // native (invisible window), egl or osmesa
+    std::string images;             // prefix of the dumped png images, empty for none
+    int imageInterval = 0;          // dump every n-th frame, 0 dumps the last frame only
+};
+
+HeadlessSettings headless;
+
+// offscreen framebuffer of the headless mode
+// ---------------------------------------------------
+class HeadlessTarget
+{
+public:
+    // ------------------------------------------------------------------------
+    bool Create(int width, int height)
+    {
+        m_width = width;
+        m_height = height;
+
+        glGenFramebuffers(1, &m_fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+        glGenRenderbuffers(2, m_renderbuffers);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[0]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_renderbuffers[0]);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_renderbuffers[1]);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_renderbuffers[1]);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            std::cout << "ERROR::HEADLESS::FRAMEBUFFER : Offscreen framebuffer not complete!" << std::endl;
+            return false;
+        }
+        // stays bound for applications that never bind a framebuffer themselves
+        glViewport(0, 0, width, height);
+        return true;
+    }
+
+    unsigned int Framebuffer() const { return m_fbo; }
+
+    // writes the current content of the offscreen framebuffer to <prefix>_<frame>.png
+    // ------------------------------------------------------------------------
+    void WriteImage(int frame)
+    {
+        std::vector<unsigned char> pixels(m_width * m_height * 4);
+        GLint previous = 0;
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previous);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, previous);
+
+        std::stringstream path;
+        path << headless.images << "_" << std::setfill('0') << std::setw(4) << frame << ".png";
+        stbi_flip_vertically_on_write(1); // OpenGL stores the bottom row first
+        if (!stbi_write_png(path.str().c_str(), m_width, m_height, 4, pixels.data(), m_width * 4))
+            std::cout << "ERROR::HEADLESS::IMAGE : Failed to write " << path.str() << std::endl;
+    }
+
+private:
+    unsigned int m_fbo = 0;
+    unsigned int m_renderbuffers[2] = {0, 0};
+    int m_width = 0, m_height = 0;
+};
+
+HeadlessTarget headlessTarget;
+
+// glfw hints of the headless mode, called between glfwInit and glfwCreateWindow
+// ---------------------------------------------------
+void HeadlessWindowHints(int &width, int &height)
+{
+    if (headless.width > 0)
+        width = headless.width;
+    if (headless.height > 0)
+        height = headless.height;
+
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_SCALE_TO_MONITOR, GLFW_FALSE); // the framebuffer keeps the requested size
+    glfwWindowHint(GLFW_SAMPLES, 0);                   // the default framebuffer is not used
+    if (headless.context == "egl")
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+#ifdef GLFW_OSMESA_CONTEXT_API
+    if (headless.context == "osmesa")
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
+}
+
+#endif
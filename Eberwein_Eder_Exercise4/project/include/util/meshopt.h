@@ -0,0 +1,326 @@
+#pragma once
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include <util/meshcache.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// statistics of the post-transform vertex cache of an index buffer
+struct VertexCacheStats
+{
+    size_t misses = 0; // transformed vertices
+    size_t triangles = 0;
+    size_t vertices = 0;
+
+    // average cache miss ratio, transformed vertices per triangle: 3 without any reuse, 0.5 at best
+    float ACMR() const { return triangles ? (float)misses / triangles : 0.0f; }
+    // average transformed vertex ratio, transformed vertices per vertex: 1 at best
+    float ATVR() const { return vertices ? (float)misses / vertices : 0.0f; }
+
+    VertexCacheStats &operator+=(const VertexCacheStats &other)
+    {
+        misses += other.misses;
+        triangles += other.triangles;
+        vertices += other.vertices;
+        return *this;
+    }
+};
+
+// Import-time optimization of triangle meshes (the vertices are expected to be deduplicated already, see
+// aiProcess_JoinIdenticalVertices), in the order of Optimize:
+// 1. vertex cache: triangle order of Forsyth's linear-speed vertex cache optimization
+//    (https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html)
+// 2. overdraw: the triangles are split into clusters that keep the cache efficiency, the clusters facing away
+//    from the center of the mesh are drawn first and occlude the others (Sander et al., Fast Triangle Reordering
+//    for Vertex Locality and Reduced Overdraw)
+// 3. vertex fetch: the vertices are stored in the order they are first used, unused vertices are removed
+// ---------------------------------------------------
+class MeshOptimizer
+{
+public:
+    // size of the simulated post-transform FIFO cache, the size the statistics are reported for
+    static const unsigned int ANALYZE_CACHE_SIZE = 16;
+
+    // optimizes all meshes of a model and prints the cache statistics before and after
+    // ------------------------------------------------------------------------
+    static void Optimize(vector<MeshData> &meshes, const std::string &name)
+    {
+        VertexCacheStats before, after;
+        for (MeshData &mesh : meshes)
+        {
+            before += AnalyzeVertexCache(mesh.indices, mesh.vertices.size());
+            OptimizeVertexCache(mesh.indices, mesh.vertices.size());
+            OptimizeOverdraw(mesh.indices, mesh.vertices);
+            OptimizeVertexFetch(mesh.vertices, mesh.indices);
+            after += AnalyzeVertexCache(mesh.indices, mesh.vertices.size());
+        }
+        // formatted locally and written at once: models are imported on worker threads, and the global cout
+        // keeps its precision
+        std::ostringstream message;
+        message << std::fixed << std::setprecision(3) << "Optimized " << name << ": ACMR " << before.ACMR() << " -> " << after.ACMR()
+                << ", ATVR " << before.ATVR() << " -> " << after.ATVR() << "\n";
+        std::cout << message.str() << std::flush;
+    }
+
+    // transformed vertices of the index buffer with a FIFO cache of the given size
+    // ------------------------------------------------------------------------
+    static VertexCacheStats AnalyzeVertexCache(const std::vector<unsigned int> &indices, size_t vertexCount, unsigned int cacheSize = ANALYZE_CACHE_SIZE)
+    {
+        VertexCacheStats stats;
+        stats.triangles = indices.size() / 3;
+        stats.vertices = vertexCount;
+        // a vertex is in the cache if less than cacheSize vertices were transformed after it
+        std::vector<unsigned int> timestamps(vertexCount, 0);
+        unsigned int time = cacheSize + 1;
+        for (unsigned int index : indices)
+            if (time - timestamps[index] > cacheSize)
+            {
+                timestamps[index] = time++;
+                stats.misses++;
+            }
+        return stats;
+    }
+
+    // reorders the triangles for the post-transform vertex cache (Forsyth)
+    // ------------------------------------------------------------------------
+    static void OptimizeVertexCache(std::vector<unsigned int> &indices, size_t vertexCount)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0)
+            return;
+
+        // remaining triangles of each vertex
+        std::vector<unsigned int> valence(vertexCount, 0), offsets(vertexCount + 1, 0), adjacency(triangleCount * 3);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+            valence[indices[i]]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] = offsets[v] + valence[v];
+        std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+            adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+        std::vector<int> cachePosition(vertexCount, -1);
+        std::vector<float> vertexScores(vertexCount);
+        std::vector<float> triangleScores(triangleCount, 0.0f);
+        for (size_t v = 0; v < vertexCount; v++)
+            vertexScores[v] = forsythScore(-1, valence[v]);
+        for (size_t i = 0; i < triangleCount * 3; i++)
+            triangleScores[i / 3] += vertexScores[indices[i]];
+
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<unsigned int> result;
+        result.reserve(triangleCount * 3);
+        std::vector<unsigned int> cache, nextCache;
+        size_t cursor = 0;
+        int64_t best = -1;
+        while (result.size() < triangleCount * 3)
+        {
+            // nothing in the cache has triangles left: continue with the next triangle in input order
+            if (best < 0)
+            {
+                while (emitted[cursor])
+                    cursor++;
+                best = (int64_t)cursor;
+            }
+            unsigned int triangle = (unsigned int)best;
+            emitted[triangle] = true;
+
+            // emit the triangle, its vertices move to the front of the cache
+            nextCache.clear();
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                unsigned int v = indices[triangle * 3 + k];
+                result.push_back(v);
+                nextCache.push_back(v);
+                unsigned int *begin = &adjacency[offsets[v]];
+                unsigned int *end = begin + valence[v];
+                std::iter_swap(std::find(begin, end, triangle), end - 1);
+                valence[v]--;
+            }
+            for (unsigned int v : cache)
+                if (v != indices[triangle * 3] && v != indices[triangle * 3 + 1] && v != indices[triangle * 3 + 2])
+                    nextCache.push_back(v);
+
+            // rescore the vertices in the cache and the ones just evicted, with their remaining triangles
+            for (size_t i = 0; i < nextCache.size(); i++)
+                cachePosition[nextCache[i]] = i < CACHE_SIZE ? (int)i : -1;
+            for (unsigned int v : nextCache)
+            {
+                float score = forsythScore(cachePosition[v], valence[v]);
+                float delta = score - vertexScores[v];
+                vertexScores[v] = score;
+                for (unsigned int i = 0; i < valence[v]; i++)
+                    triangleScores[adjacency[offsets[v] + i]] += delta;
+            }
+            best = -1;
+            float bestScore = 0.0f;
+            for (size_t i = 0; i < nextCache.size() && i < CACHE_SIZE; i++)
+            {
+                unsigned int v = nextCache[i];
+                for (unsigned int j = 0; j < valence[v]; j++)
+                {
+                    unsigned int t = adjacency[offsets[v] + j];
+                    if (best < 0 || triangleScores[t] > bestScore)
+                    {
+                        best = t;
+                        bestScore = triangleScores[t];
+                    }
+                }
+            }
+            if (nextCache.size() > CACHE_SIZE)
+                nextCache.resize(CACHE_SIZE);
+            std::swap(cache, nextCache);
+        }
+        indices.swap(result);
+    }
+
+    // reorders clusters of triangles of a cache optimized index buffer to reduce overdraw; a cluster ends as soon as
+    // its ACMR (starting with a cold cache) is within threshold of the ACMR of the whole mesh
+    // ------------------------------------------------------------------------
+    static void OptimizeOverdraw(std::vector<unsigned int> &indices, const std::vector<Vertex> &vertices, float threshold = 1.05f)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount < 2)
+            return;
+        float acmr = AnalyzeVertexCache(indices, vertices.size()).ACMR();
+
+        // clusters as their first triangle
+        std::vector<size_t> clusters;
+        std::vector<unsigned int> timestamps(vertices.size(), 0);
+        unsigned int time = ANALYZE_CACHE_SIZE + 1;
+        size_t clusterMisses = 0, clusterStart = 0;
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            unsigned int misses = 0;
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                unsigned int v = indices[t * 3 + k];
+                if (time - timestamps[v] > ANALYZE_CACHE_SIZE)
+                {
+                    timestamps[v] = time++;
+                    misses++;
+                }
+            }
+            if (t == 0 || (float)clusterMisses <= acmr * threshold * (t - clusterStart))
+            {
+                // a new cluster starts with a cold cache, it may be drawn after any other cluster
+                if (t > 0 && misses < 3)
+                {
+                    time += ANALYZE_CACHE_SIZE + 1;
+                    misses = 3;
+                    for (unsigned int k = 0; k < 3; k++)
+                        timestamps[indices[t * 3 + k]] = time++;
+                }
+                clusters.push_back(t);
+                clusterStart = t;
+                clusterMisses = 0;
+            }
+            clusterMisses += misses;
+        }
+        clusters.push_back(triangleCount);
+
+        // area weighted centroid and normal of the clusters
+        struct Cluster
+        {
+            size_t begin, end;
+            glm::vec3 centroid;
+            glm::vec3 normal;
+            float area;
+            float key;
+        };
+        std::vector<Cluster> sorted(clusters.size() - 1);
+        glm::vec3 meshCentroid(0.0f);
+        float meshArea = 0.0f;
+        for (size_t c = 0; c + 1 < clusters.size(); c++)
+        {
+            Cluster &cluster = sorted[c];
+            cluster.begin = clusters[c];
+            cluster.end = clusters[c + 1];
+            cluster.centroid = cluster.normal = glm::vec3(0.0f);
+            cluster.area = 0.0f;
+            for (size_t t = cluster.begin; t < cluster.end; t++)
+            {
+                const glm::vec3 &a = vertices[indices[t * 3]].Position;
+                const glm::vec3 &b = vertices[indices[t * 3 + 1]].Position;
+                const glm::vec3 &p = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 normal = glm::cross(b - a, p - a); // length is twice the area
+                float area = glm::length(normal);
+                cluster.centroid += (a + b + p) * (area / 3.0f);
+                cluster.normal += normal;
+                cluster.area += area;
+            }
+            meshCentroid += cluster.centroid;
+            meshArea += cluster.area;
+            if (cluster.area > 0.0f)
+                cluster.centroid /= cluster.area;
+        }
+        if (meshArea > 0.0f)
+            meshCentroid /= meshArea;
+        for (Cluster &cluster : sorted)
+        {
+            float length = glm::length(cluster.normal);
+            cluster.key = length > 0.0f ? glm::dot(cluster.centroid - meshCentroid, cluster.normal / length) : 0.0f;
+        }
+
+        // clusters facing outwards first
+        std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster &a, const Cluster &b)
+                         { return a.key > b.key; });
+        std::vector<unsigned int> result;
+        result.reserve(indices.size());
+        for (const Cluster &cluster : sorted)
+            result.insert(result.end(), indices.begin() + cluster.begin * 3, indices.begin() + cluster.end * 3);
+        indices.swap(result);
+    }
+
+    // stores the vertices in the order of their first use in the index buffer, drops unused vertices
+    // ------------------------------------------------------------------------
+    static void OptimizeVertexFetch(std::vector<Vertex> &vertices, std::vector<unsigned int> &indices)
+    {
+        const unsigned int UNUSED = ~0u;
+        std::vector<unsigned int> remap(vertices.size(), UNUSED);
+        std::vector<Vertex> result;
+        result.reserve(vertices.size());
+        for (unsigned int &index : indices)
+        {
+            if (remap[index] == UNUSED)
+            {
+                remap[index] = (unsigned int)result.size();
+                result.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+        vertices.swap(result);
+    }
+
+private:
+    // size of the LRU cache modelled by the optimization
+    static const unsigned int CACHE_SIZE = 32;
+
+    // Forsyth's vertex score: recently used vertices and vertices with few remaining triangles first
+    static float forsythScore(int cachePosition, unsigned int valence)
+    {
+        if (valence == 0) // no triangles left
+            return -1.0f;
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            if (cachePosition < 3) // used by the last triangle, no preference for any of its vertices
+                score = 0.75f;
+            else
+                score = std::pow(1.0f - (cachePosition - 3) / (float)(CACHE_SIZE - 3), 1.5f);
+        }
+        return score + 2.0f * std::pow((float)valence, -0.5f);
+    }
+};
+
+#endif
@@ -0,0 +1,371 @@
+#pragma once
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+#include "imgui.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Scoped CPU/GPU profiler for the passes of a frame.
+// Every scope is measured with std::chrono on the CPU and with a pair of GL_TIMESTAMP queries on the GPU
+// (GL_TIME_ELAPSED queries cannot be nested). The queries of the last FRAME_LATENCY frames are kept in flight,
+// so the results are read a few frames later without stalling the pipeline.
+//
+//   profiler.BeginFrame();
+//   profiler.Begin("geometry pass"); ... profiler.End();
+//   { ProfileScope scope(profiler, "lighting pass"); ... }
+//   profiler.EndFrame();
+//   profiler.DrawGUI();
+class Profiler
+{
+public:
+    bool Enabled = true;
+
+    Profiler()
+    {
+        m_epoch = std::chrono::steady_clock::now();
+    }
+
+    // the queries are not deleted: the profiler usually outlives the OpenGL context (glfwTerminate)
+    Profiler(const Profiler &) = delete;
+    Profiler &operator=(const Profiler &) = delete;
+
+    // ------------------------------------------------------------------------
+    void BeginFrame()
+    {
+        if (!Enabled)
+            return;
+        if (m_gpuEpoch == 0)
+        {
+            // aligns the GPU clock with the CPU clock for the trace export
+            GLint64 now = 0;
+            glGetInteger64v(GL_TIMESTAMP, &now);
+            m_gpuEpoch = (GLuint64)now;
+            m_gpuEpochCPU = cpuTime();
+        }
+
+        // collect the finished frames, oldest first, without waiting
+        for (int i = 1; i <= FRAME_LATENCY; i++)
+        {
+            Frame &frame = m_frames[(m_current + i) % FRAME_LATENCY];
+            if (frame.pending && !resolve(frame, false))
+                break;
+        }
+        m_current = (m_current + 1) % FRAME_LATENCY;
+        Frame &frame = m_frames[m_current];
+        if (frame.pending) // the GPU is more than FRAME_LATENCY frames behind
+            resolve(frame, true);
+        frame.scopes.clear();
+        frame.usedQueries = 0;
+        frame.pending = true;
+        m_inFrame = true;
+        Begin("frame");
+    }
+
+    void EndFrame()
+    {
+        if (!m_inFrame)
+            return;
+        while (!m_stack.empty())
+            End();
+        m_inFrame = false;
+    }
+
+    // ------------------------------------------------------------------------
+    void Begin(const char *name)
+    {
+        if (!m_inFrame)
+            return;
+        Frame &frame = m_frames[m_current];
+        Scope scope;
+        scope.name = name;
+        scope.parent = m_stack.empty() ? -1 : m_stack.back();
+        scope.beginQuery = nextQuery(frame);
+        glQueryCounter(frame.queries[scope.beginQuery], GL_TIMESTAMP);
+        scope.cpuBegin = cpuTime();
+        m_stack.push_back((int)frame.scopes.size());
+        frame.scopes.push_back(scope);
+    }
+
+    void End()
+    {
+        if (!m_inFrame || m_stack.empty())
+            return;
+        Frame &frame = m_frames[m_current];
+        Scope &scope = frame.scopes[m_stack.back()];
+        m_stack.pop_back();
+        scope.cpuEnd = cpuTime();
+        scope.endQuery = nextQuery(frame);
+        glQueryCounter(frame.queries[scope.endQuery], GL_TIMESTAMP);
+    }
+
+    // waits for all frames in flight, e.g. after one-off passes before the render loop
+    // ------------------------------------------------------------------------
+    void Flush()
+    {
+        EndFrame();
+        for (int i = 1; i <= FRAME_LATENCY; i++)
+        {
+            Frame &frame = m_frames[(m_current + i) % FRAME_LATENCY];
+            if (frame.pending)
+                resolve(frame, true);
+        }
+    }
+
+    // prints the passes of the last finished frame
+    void Print() const
+    {
+        for (const Result &result : m_latest)
+            std::cout << std::string(2 * result.depth, ' ') << result.name << ": cpu " << result.cpuMs << " ms, gpu "
+                      << result.gpuMs << " ms" << std::endl;
+    }
+
+    // hierarchical table of the passes (averaged over the history) and rolling graphs of the GPU times
+    // ------------------------------------------------------------------------
+    void DrawGUI(const char *label = "profiler")
+    {
+        if (!ImGui::CollapsingHeader(label))
+            return;
+        ImGui::PushID(label);
+        ImGui::Checkbox("enabled", &Enabled);
+        if (!m_latest.empty() && ImGui::BeginTable("passes", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable))
+        {
+            ImGui::TableSetupColumn("pass", ImGuiTableColumnFlags_WidthStretch);
+            ImGui::TableSetupColumn("cpu ms");
+            ImGui::TableSetupColumn("gpu ms");
+            ImGui::TableHeadersRow();
+            drawNode(0);
+            ImGui::EndTable();
+        }
+        for (const Result &result : m_latest)
+        {
+            if (result.depth > 1)
+                continue;
+            const History &history = m_history[result.path];
+            ImGui::PlotLines(result.name.c_str(), history.gpu.data(), HISTORY, history.offset, "gpu ms", 0.0f,
+                             FLT_MAX, ImVec2(0, result.depth == 0 ? 60.0f : 30.0f));
+        }
+        if (ImGui::Button("export chrome trace"))
+            ExportChromeTrace(m_tracePath);
+        ImGui::SameLine();
+        ImGui::Text("%s (%d frames)", m_tracePath.c_str(), (int)m_trace.size());
+        ImGui::PopID();
+    }
+
+    // writes the last TRACE_FRAMES frames in the Chrome trace event format (chrome://tracing, ui.perfetto.dev)
+    // ------------------------------------------------------------------------
+    bool ExportChromeTrace(const std::string &path) const
+    {
+        std::ofstream file(path);
+        if (!file)
+        {
+            std::cout << "ERROR::PROFILER::TRACE : Failed to write " << path << std::endl;
+            return false;
+        }
+        file << std::fixed << std::setprecision(3);
+        file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl
+             << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"CPU\"}}," << std::endl
+             << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"GPU\"}}";
+        for (const std::vector<Result> &frame : m_trace)
+            for (const Result &result : frame)
+            {
+                // timestamps in microseconds
+                file << "," << std::endl
+                     << "{\"name\": \"" << result.name << "\", \"cat\": \"cpu\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": "
+                     << result.cpuBegin * 1000.0 << ", \"dur\": " << result.cpuMs * 1000.0 << "}," << std::endl
+                     << "{\"name\": \"" << result.name << "\", \"cat\": \"gpu\", \"ph\": \"X\", \"pid\": 1, \"tid\": 2, \"ts\": "
+                     << result.gpuBegin * 1000.0 << ", \"dur\": " << result.gpuMs * 1000.0 << "}";
+            }
+        file << std::endl
+             << "]}" << std::endl;
+        std::cout << "profiler: wrote " << m_trace.size() << " frames to " << path << std::endl;
+        return true;
+    }
+
+    void SetTracePath(const std::string &path) { m_tracePath = path; }
+
+private:
+    static const int FRAME_LATENCY = 3; // frames in flight before the results are read
+    static const int HISTORY = 120;     // frames of the rolling graphs and averages
+    static const int TRACE_FRAMES = 300;
+
+    struct Scope
+    {
+        std::string name;
+        int parent;
+        int beginQuery, endQuery;
+        double cpuBegin, cpuEnd; // ms since the creation of the profiler
+    };
+
+    struct Frame
+    {
+        std::vector<Scope> scopes; // in the order of Begin, parents before their children
+        std::vector<unsigned int> queries;
+        int usedQueries = 0;
+        bool pending = false;
+    };
+
+    struct Result
+    {
+        std::string name;
+        std::string path; // names of the parents and the scope, separated by '/'
+        int depth;
+        double cpuBegin, cpuMs;
+        double gpuBegin, gpuMs; // gpuBegin in ms on the CPU clock
+    };
+
+    struct History
+    {
+        std::vector<float> cpu = std::vector<float>(HISTORY, 0.0f);
+        std::vector<float> gpu = std::vector<float>(HISTORY, 0.0f);
+        int offset = 0;
+        int count = 0;
+    };
+
+    Frame m_frames[FRAME_LATENCY];
+    int m_current = 0;
+    bool m_inFrame = false;
+    std::vector<int> m_stack;
+
+    std::vector<Result> m_latest;
+    std::unordered_map<std::string, History> m_history;
+    std::deque<std::vector<Result>> m_trace;
+    std::string m_tracePath = "profile_trace.json";
+
+    std::chrono::steady_clock::time_point m_epoch;
+    GLuint64 m_gpuEpoch = 0;
+    double m_gpuEpochCPU = 0.0;
+
+    // ------------------------------------------------------------------------
+    double cpuTime() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_epoch).count();
+    }
+
+    int nextQuery(Frame &frame)
+    {
+        if (frame.usedQueries == (int)frame.queries.size())
+        {
+            size_t count = std::max<size_t>(16, frame.queries.size());
+            frame.queries.resize(frame.queries.size() + count);
+            glGenQueries((GLsizei)count, &frame.queries[frame.queries.size() - count]);
+        }
+        return frame.usedQueries++;
+    }
+
+    // reads the queries of a frame, returns false if they are not available yet and wait is false
+    // ------------------------------------------------------------------------
+    bool resolve(Frame &frame, bool wait)
+    {
+        if (frame.usedQueries == 0)
+        {
+            frame.pending = false;
+            return true;
+        }
+        if (!wait)
+        {
+            // the queries finish in order, the last one is enough
+            GLint available = 0;
+            glGetQueryObjectiv(frame.queries[frame.usedQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return false;
+        }
+
+        std::vector<GLuint64> timestamps(frame.usedQueries);
+        for (int i = 0; i < frame.usedQueries; i++)
+            glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &timestamps[i]);
+
+        std::vector<Result> results(frame.scopes.size());
+        for (size_t i = 0; i < frame.scopes.size(); i++)
+        {
+            const Scope &scope = frame.scopes[i];
+            Result &result = results[i];
+            result.name = scope.name;
+            result.path = scope.parent < 0 ? scope.name : results[scope.parent].path + "/" + scope.name;
+            result.depth = scope.parent < 0 ? 0 : results[scope.parent].depth + 1;
+            result.cpuBegin = scope.cpuBegin;
+            result.cpuMs = scope.cpuEnd - scope.cpuBegin;
+            result.gpuBegin = m_gpuEpochCPU + ((double)timestamps[scope.beginQuery] - (double)m_gpuEpoch) / 1.0e6;
+            result.gpuMs = (timestamps[scope.endQuery] - timestamps[scope.beginQuery]) / 1.0e6;
+
+            History &history = m_history[result.path];
+            history.cpu[history.offset] = (float)result.cpuMs;
+            history.gpu[history.offset] = (float)result.gpuMs;
+            history.offset = (history.offset + 1) % HISTORY;
+            history.count = std::min(history.count + 1, HISTORY);
+        }
+        m_latest = results;
+        m_trace.push_back(std::move(results));
+        if (m_trace.size() > TRACE_FRAMES)
+            m_trace.pop_front();
+        frame.pending = false;
+        return true;
+    }
+
+    // one row per scope, the children of a scope follow it in the list of the latest frame
+    // ------------------------------------------------------------------------
+    void drawNode(int index)
+    {
+        const Result &result = m_latest[index];
+        bool leaf = true;
+        for (size_t i = index + 1; i < m_latest.size() && m_latest[i].depth > result.depth; i++)
+            leaf = false;
+
+        const History &history = m_history[result.path];
+        float cpu = 0.0f, gpu = 0.0f;
+        for (int i = 0; i < HISTORY; i++)
+        {
+            cpu += history.cpu[i];
+            gpu += history.gpu[i];
+        }
+        int count = std::max(history.count, 1);
+
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGuiTreeNodeFlags flags = ImGuiTreeNodeFlags_SpanFullWidth | ImGuiTreeNodeFlags_DefaultOpen;
+        if (leaf)
+            flags |= ImGuiTreeNodeFlags_Leaf | ImGuiTreeNodeFlags_NoTreePushOnOpen;
+        bool open = ImGui::TreeNodeEx(result.path.c_str(), flags, "%s", result.name.c_str());
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", cpu / count);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", gpu / count);
+
+        if (leaf || !open)
+            return;
+        for (size_t i = index + 1; i < m_latest.size() && m_latest[i].depth > result.depth; i++)
+            if (m_latest[i].depth == result.depth + 1)
+                drawNode((int)i);
+        ImGui::TreePop();
+    }
+};
+
+// measures the enclosing block
+// ---------------------------------------------------
+class ProfileScope
+{
+public:
+    ProfileScope(Profiler &profiler, const char *name) : m_profiler(profiler)
+    {
+        m_profiler.Begin(name);
+    }
+    ~ProfileScope()
+    {
+        m_profiler.End();
+    }
+
+private:
+    Profiler &m_profiler;
+};
+
+#endif
@@ -0,0 +1,301 @@
+#pragma once
+#ifndef RENDERTARGET_H
+#define RENDERTARGET_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// attachment of a render target: a texture of the given internal format,
+// depth and depth-stencil formats become the depth (stencil) attachment, all others color attachments in order
+struct Attachment
+{
+    GLenum format;
+    GLenum filter = GL_NEAREST;
+
+    bool operator==(const Attachment &other) const { return format == other.format && filter == other.filter; }
+    bool operator!=(const Attachment &other) const { return !(*this == other); }
+};
+
+// Framebuffer with its own attachment textures. The attachments are (re)allocated by Resize when the size
+// changes, the framebuffer object stays the same, so textures attached to it by the application (e.g. cubemap
+// faces of a capture pass) remain attached.
+// The GL objects are not deleted on destruction (targets may outlive the OpenGL context), see Release.
+class RenderTarget
+{
+public:
+    RenderTarget(const std::vector<Attachment> &attachments) : m_attachments(attachments) {}
+
+    RenderTarget(const RenderTarget &) = delete;
+    RenderTarget &operator=(const RenderTarget &) = delete;
+
+    // (re)allocates the attachments if the size changed, returns true if the content is lost
+    // ------------------------------------------------------------------------
+    bool Resize(int width, int height)
+    {
+        width = std::max(width, 1);
+        height = std::max(height, 1);
+        if (m_fbo && width == m_width && height == m_height)
+            return false;
+        m_width = width;
+        m_height = height;
+
+        if (!m_fbo)
+            glGenFramebuffers(1, &m_fbo);
+        if (!m_textures.empty())
+            glDeleteTextures((GLsizei)m_textures.size(), m_textures.data());
+        m_textures.assign(m_attachments.size(), 0);
+        glGenTextures((GLsizei)m_textures.size(), m_textures.data());
+
+        GLint previous = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+        std::vector<GLenum> drawBuffers;
+        for (size_t i = 0; i < m_attachments.size(); i++)
+        {
+            GLenum format, type, attachment;
+            transferFormat(m_attachments[i].format, format, type);
+            if (format == GL_DEPTH_STENCIL)
+                attachment = GL_DEPTH_STENCIL_ATTACHMENT;
+            else if (format == GL_DEPTH_COMPONENT)
+                attachment = GL_DEPTH_ATTACHMENT;
+            else
+            {
+                attachment = GL_COLOR_ATTACHMENT0 + (GLenum)drawBuffers.size();
+                drawBuffers.push_back(attachment);
+            }
+            glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, m_attachments[i].format, width, height, 0, format, type, NULL);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, m_attachments[i].filter);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, m_attachments[i].filter);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, m_textures[i], 0);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        // without color attachments of its own, the draw buffer is left to the application
+        if (!drawBuffers.empty())
+            glDrawBuffers((GLsizei)drawBuffers.size(), drawBuffers.data());
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE && !drawBuffers.empty())
+            std::cout << "ERROR::RENDERTARGET : Framebuffer not complete!" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, previous);
+        return true;
+    }
+
+    // binds the framebuffer and sets the viewport to its size
+    void Bind() const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+        glViewport(0, 0, m_width, m_height);
+    }
+
+    // deletes the framebuffer and its textures, the next Resize allocates them again
+    // ------------------------------------------------------------------------
+    void Release()
+    {
+        if (!m_textures.empty())
+            glDeleteTextures((GLsizei)m_textures.size(), m_textures.data());
+        if (m_fbo)
+            glDeleteFramebuffers(1, &m_fbo);
+        m_textures.clear();
+        m_fbo = 0;
+        m_width = m_height = 0;
+    }
+
+    unsigned int Framebuffer() const { return m_fbo; }
+    // texture of the i-th attachment, in the order of the attachment list
+    unsigned int Texture(size_t i) const { return i < m_textures.size() ? m_textures[i] : 0; }
+    int Width() const { return m_width; }
+    int Height() const { return m_height; }
+    const std::vector<Attachment> &Attachments() const { return m_attachments; }
+
+    // GPU memory of the attachments
+    size_t Bytes() const
+    {
+        size_t bytes = 0;
+        if (m_fbo)
+            for (const Attachment &a : m_attachments)
+                bytes += (size_t)m_width * m_height * bytesPerPixel(a.format);
+        return bytes;
+    }
+
+private:
+    std::vector<Attachment> m_attachments;
+    std::vector<unsigned int> m_textures;
+    unsigned int m_fbo = 0;
+    int m_width = 0, m_height = 0;
+
+    // pixel transfer format and type of an internal format, needed by glTexImage2D even without data
+    static void transferFormat(GLenum internalFormat, GLenum &format, GLenum &type)
+    {
+        switch (internalFormat)
+        {
+        case GL_DEPTH24_STENCIL8: format = GL_DEPTH_STENCIL; type = GL_UNSIGNED_INT_24_8; break;
+        case GL_DEPTH32F_STENCIL8: format = GL_DEPTH_STENCIL; type = GL_FLOAT_32_UNSIGNED_INT_24_8_REV; break;
+        case GL_DEPTH_COMPONENT16:
+        case GL_DEPTH_COMPONENT24:
+        case GL_DEPTH_COMPONENT: format = GL_DEPTH_COMPONENT; type = GL_UNSIGNED_INT; break;
+        case GL_DEPTH_COMPONENT32F: format = GL_DEPTH_COMPONENT; type = GL_FLOAT; break;
+        case GL_R8: format = GL_RED; type = GL_UNSIGNED_BYTE; break;
+        case GL_R16F:
+        case GL_R32F: format = GL_RED; type = GL_FLOAT; break;
+        case GL_RG8: format = GL_RG; type = GL_UNSIGNED_BYTE; break;
+        case GL_RG16: format = GL_RG; type = GL_UNSIGNED_SHORT; break;
+        case GL_RG16F:
+        case GL_RG32F: format = GL_RG; type = GL_FLOAT; break;
+        case GL_RGB16F:
+        case GL_RGB32F: format = GL_RGB; type = GL_FLOAT; break;
+        case GL_RGBA16F:
+        case GL_RGBA32F: format = GL_RGBA; type = GL_FLOAT; break;
+        case GL_R32UI: format = GL_RED_INTEGER; type = GL_UNSIGNED_INT; break;
+        case GL_RG32UI: format = GL_RG_INTEGER; type = GL_UNSIGNED_INT; break;
+        default: format = GL_RGBA; type = GL_UNSIGNED_BYTE; break; // GL_RGBA, GL_RGBA8, GL_SRGB8_ALPHA8 ...
+        }
+    }
+
+    static size_t bytesPerPixel(GLenum internalFormat)
+    {
+        switch (internalFormat)
+        {
+        case GL_R8: return 1;
+        case GL_DEPTH_COMPONENT16: case GL_RG8: case GL_R16F: return 2;
+        case GL_RGB16F: return 6;
+        case GL_RG32F: case GL_RG32UI: case GL_RGBA16F: case GL_DEPTH32F_STENCIL8: return 8;
+        case GL_RGB32F: return 12;
+        case GL_RGBA32F: return 16;
+        default: return 4; // 8 bit RGBA, 24 bit depth (+ stencil), 32 bit single channel, RG16
+        }
+    }
+};
+
+// Owner of the render targets of an application, allocated lazily with the size they are requested with:
+// after a window resize every target is reallocated when a pass requests it the next time.
+// Persistent targets (Get) keep their content between frames. Transient targets (Acquire/Release) only live
+// between acquiring and releasing them within a frame, released targets are shared by all later passes asking
+// for the same attachments and size, and freed when no pass acquired them for a while (e.g. after a mode change).
+// ---------------------------------------------------
+class FramebufferPool
+{
+public:
+    FramebufferPool() = default;
+    FramebufferPool(const FramebufferPool &) = delete;
+    FramebufferPool &operator=(const FramebufferPool &) = delete;
+
+    // persistent target, created on first use and reallocated if the size or attachments changed
+    // ------------------------------------------------------------------------
+    RenderTarget &Get(const std::string &name, const std::vector<Attachment> &attachments, int width, int height)
+    {
+        for (Entry &entry : m_entries)
+        {
+            if (entry.name != name)
+                continue;
+            if (entry.target->Attachments() != attachments)
+            {
+                entry.target->Release();
+                entry.target.reset(new RenderTarget(attachments));
+            }
+            entry.target->Resize(width, height);
+            entry.lastUsed = m_frame;
+            return *entry.target;
+        }
+        return create(name, attachments, width, height);
+    }
+
+    // transient target, to be released when the pass(es) using it are done
+    // ------------------------------------------------------------------------
+    RenderTarget &Acquire(const std::vector<Attachment> &attachments, int width, int height)
+    {
+        Entry *match = nullptr;
+        for (Entry &entry : m_entries)
+        {
+            if (!entry.name.empty() || entry.inUse || entry.target->Attachments() != attachments)
+                continue;
+            // prefer a target of the right size, otherwise resize a free one
+            if (!match || (entry.target->Width() == std::max(width, 1) && entry.target->Height() == std::max(height, 1)))
+                match = &entry;
+        }
+        if (!match)
+            match = &createEntry("", attachments);
+        match->target->Resize(width, height);
+        match->inUse = true;
+        match->lastUsed = m_frame;
+        return *match->target;
+    }
+
+    void Release(RenderTarget &target)
+    {
+        for (Entry &entry : m_entries)
+            if (entry.target.get() == &target)
+                entry.inUse = false;
+    }
+
+    // once per frame: frees the transient targets nobody acquired for the given number of frames
+    // ------------------------------------------------------------------------
+    void EndFrame(int unusedFrames = 60)
+    {
+        m_frame++;
+        for (size_t i = 0; i < m_entries.size();)
+        {
+            Entry &entry = m_entries[i];
+            if (entry.name.empty() && !entry.inUse && m_frame - entry.lastUsed > unusedFrames)
+            {
+                entry.target->Release();
+                m_entries.erase(m_entries.begin() + i);
+            }
+            else
+                i++;
+        }
+    }
+
+    // deletes all targets, call before the OpenGL context is destroyed
+    void Clear()
+    {
+        for (Entry &entry : m_entries)
+            entry.target->Release();
+        m_entries.clear();
+    }
+
+    // GPU memory of all targets
+    size_t Bytes() const
+    {
+        size_t bytes = 0;
+        for (const Entry &entry : m_entries)
+            bytes += entry.target->Bytes();
+        return bytes;
+    }
+    size_t Count() const { return m_entries.size(); }
+
+private:
+    struct Entry
+    {
+        std::string name; // empty for transient targets
+        std::unique_ptr<RenderTarget> target;
+        bool inUse = false;
+        int lastUsed = 0;
+    };
+    std::vector<Entry> m_entries;
+    int m_frame = 0;
+
+    Entry &createEntry(const std::string &name, const std::vector<Attachment> &attachments)
+    {
+        Entry entry;
+        entry.name = name;
+        entry.target.reset(new RenderTarget(attachments));
+        entry.lastUsed = m_frame;
+        m_entries.push_back(std::move(entry));
+        return m_entries.back();
+    }
+
+    RenderTarget &create(const std::string &name, const std::vector<Attachment> &attachments, int width, int height)
+    {
+        Entry &entry = createEntry(name, attachments);
+        entry.target->Resize(width, height);
+        return *entry.target;
+    }
+};
+
+#endif
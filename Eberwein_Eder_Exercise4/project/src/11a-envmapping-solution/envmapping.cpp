@@ -126,11 +126,15 @@ void loadCubemap() {
 */
 
 const char *APP_NAME = "envmapping";
-int main()
+int main(int argc, char **argv)
 {
+	if (!ParseCommandLine(argc, argv))
+		return -1;
+
 	// glfw: initialize and configure
 	// ------------------------------
-	InitWindowAndGUI(SCR_WIDTH, SCR_HEIGHT, APP_NAME);
+	if (InitWindowAndGUI(SCR_WIDTH, SCR_HEIGHT, APP_NAME) < 0)
+		return -1;
 
 	SetCursorPosCallback(mouse_callback);
 	SetMouseButtonCallback(mouse_button_callback);
@@ -144,9 +148,15 @@ int main()
 	Shader skyboxShader(SRC + "skybox.vert", SRC + "skybox.frag");
 	Shader myShader(SRC + "model.vert", SRC + "model.frag");
 	models.SetActiveGroup("sphere");
-	Model myModel = models.GetActiveAsset<Model>("model");
+	ModelPtr myModel = models.GetActiveAsset<ModelPtr>("model");
 	auto modelTransformation = models.GetActiveAsset<glm::mat4>("transformation");
-	Model skyboxCube = models.GetAsset<Model>("cube", "model");
+	ModelPtr skyboxCube = models.GetAsset<ModelPtr>("cube", "model");
+	// newly selected model and environment, loaded in the background; the current ones stay visible until they are ready
+	AssetHandle<ModelPtr> pendingModel;
+	AssetHandle<glm::mat4> pendingTransformation;
+	AssetHandle<Tex> pendingCubemap;
+	// groups of the model and environment on screen, restored if a selected group fails to load
+	std::string renderedModelGroup = models.GetActiveGroup(), renderedSkyboxGroup = skyboxes.GetActiveGroup();
 	// Model myModel("objects/torus/torus.obj");
 	// Model myModel("objects/sphere/sphere.obj");
 	// Model myModel("objects/cyborg/cyborg.obj");
@@ -159,10 +169,10 @@ int main()
 	skyboxShader.setInt("skybox", 0);
 
 	// Main Loop
-	while (!glfwWindowShouldClose(window))
+	while (!WindowShouldClose())
 	{
 
-		float currentFrame = glfwGetTime();
+		float currentFrame = FrameTime();
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
 
@@ -172,6 +182,7 @@ int main()
 		// input
 		// -----
 		processInput(window);
+		UpdateCamera(camera);
 		if (gui)
 		{
 			// Start the Dear ImGui frame
@@ -195,8 +206,8 @@ int main()
 					if (models.GetActiveGroupId() != item_current)
 					{
 						models.SetActiveGroup(item_current);
-						myModel = models.GetActiveAsset<Model>("model");
-						modelTransformation = models.GetActiveAsset<glm::mat4>("transformation");
+						pendingModel = models.GetActiveAssetAsync<ModelPtr>("model");
+						pendingTransformation = models.GetActiveAssetAsync<glm::mat4>("transformation");
 					}
 				}
 				ImGui::Checkbox("rotate model", &rotateModel);
@@ -212,10 +223,30 @@ int main()
 					if (skyboxes.GetActiveGroupId() != item_current)
 					{
 						skyboxes.SetActiveGroup(item_current);
-						cubeTexture = skyboxes.GetActiveAsset<Tex>("cubemap");
-						glBindTexture(GL_TEXTURE_CUBE_MAP, cubeTexture);
+						pendingCubemap = skyboxes.GetActiveAssetAsync<Tex>("cubemap");
 					}
 				}
+				if (pendingModel.Valid() || pendingCubemap.Valid())
+					ImGui::Text("loading ...");
+				// resident memory of the loaded models and cube maps (of both asset managers)
+				if (ImGui::CollapsingHeader("assets") && ImGui::BeginTable("memory", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable))
+				{
+					ImGui::TableSetupColumn("asset", ImGuiTableColumnFlags_WidthStretch);
+					ImGui::TableSetupColumn("cpu MB");
+					ImGui::TableSetupColumn("gpu MB");
+					ImGui::TableHeadersRow();
+					for (const AssetMemory &asset : models.GetMemoryReport())
+					{
+						ImGui::TableNextRow();
+						ImGui::TableNextColumn();
+						ImGui::TextUnformatted(asset.name.c_str());
+						ImGui::TableNextColumn();
+						ImGui::Text("%.2f", asset.cpuBytes / (1024.0 * 1024.0));
+						ImGui::TableNextColumn();
+						ImGui::Text("%.2f", asset.gpuBytes / (1024.0 * 1024.0));
+					}
+					ImGui::EndTable();
+				}
 
 				const char *mode_combo[] = {"reflection", "refraction"};
 				ImGui::Combo("reflect/refract", &shaderMode, mode_combo, 2);
@@ -235,6 +266,33 @@ int main()
 			ImGui::Render();
 		}
 
+		// upload the assets loaded in the background (shared by both asset managers), switch to them once ready
+		models.Update();
+		if (pendingModel.Failed() || pendingTransformation.Failed()) // reported by the loader, keep the current model
+		{
+			pendingModel.Reset();
+			models.SetActiveGroup(renderedModelGroup);
+		}
+		else if (pendingModel.Ready() && pendingTransformation.Ready())
+		{
+			renderedModelGroup = models.GetActiveGroup();
+			myModel = pendingModel.Get();
+			modelTransformation = pendingTransformation.Get();
+			pendingModel.Reset();
+		}
+		if (pendingCubemap.Failed())
+		{
+			pendingCubemap.Reset();
+			skyboxes.SetActiveGroup(renderedSkyboxGroup);
+		}
+		else if (pendingCubemap.Ready())
+		{
+			renderedSkyboxGroup = skyboxes.GetActiveGroup();
+			cubeTexture = pendingCubemap.Get();
+			glBindTexture(GL_TEXTURE_CUBE_MAP, cubeTexture);
+			pendingCubemap.Reset();
+		}
+
 		mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
 		mat4 view = camera.GetViewMatrix();
 
@@ -244,7 +302,7 @@ int main()
 		mat4 model = mat4(1.0f);
 		if (rotateModel)
 		{
-			model = rotate(model, (float)glfwGetTime(), vec3(0.0f, 1.0f, 0.0f));
+			model = rotate(model, (float)FrameTime(), vec3(0.0f, 1.0f, 0.0f));
 		}
 		// model = rotate(model, (float)glfwGetTime(), vec3(0.0f, 0.0f, 1.0f));
 		model = translate(model, vec3(0.0f, -0.5f, 0.0f));
@@ -256,19 +314,19 @@ int main()
 		myShader.setVec3("cameraPos", camera.Position);
 		myShader.setInt("mode", shaderMode);
 
-		myModel.Draw(myShader);
+		myModel->Draw(myShader);
 
 		// draw the skybox
 		glDepthFunc(GL_LEQUAL); // change depth function so depth test passes when values are equal to depth buffer's content
 		skyboxShader.use();
 		skyboxShader.setMat4("projection", projection);
 		skyboxShader.setMat4("view", view);
-		skyboxCube.Draw(skyboxShader);
+		skyboxCube->Draw(skyboxShader);
 		glDepthFunc(GL_LESS); // change depth function so depth test passes when values are equal to depth buffer's content
 
 		if (gui)
 			ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-		glfwSwapBuffers(window);
+		PresentFrame();
 	}
 
 	glfwTerminate();
@@ -127,11 +127,15 @@ void loadCubemap() {
 */
 
 const char *APP_NAME = "envmapping";
-int main()
+int main(int argc, char **argv)
 {
+	if (!ParseCommandLine(argc, argv))
+		return -1;
+
 	// glfw: initialize and configure
 	// ------------------------------
-	InitWindowAndGUI(SCR_WIDTH, SCR_HEIGHT, APP_NAME);
+	if (InitWindowAndGUI(SCR_WIDTH, SCR_HEIGHT, APP_NAME) < 0)
+		return -1;
 
 	SetCursorPosCallback(mouse_callback);
 	SetMouseButtonCallback(mouse_button_callback);
@@ -145,9 +149,9 @@ int main()
 	Shader skyboxShader(SRC + "skybox.vert", SRC + "skybox.frag");
 	Shader myShader(SRC + "model.vert", SRC + "model.frag");
 	models.SetActiveGroup("sphere");
-	Model myModel = models.GetActiveAsset<Model>("model");
+	ModelPtr myModel = models.GetActiveAsset<ModelPtr>("model");
 	auto modelTransformation = models.GetActiveAsset<glm::mat4>("transformation");
-	Model skyboxCube = models.GetAsset<Model>("cube", "model");
+	ModelPtr skyboxCube = models.GetAsset<ModelPtr>("cube", "model");
 	//Model myModel("objects/torus/torus.obj");
 	//Model myModel("objects/sphere/sphere.obj");
 	//Model myModel("objects/cyborg/cyborg.obj");
@@ -160,10 +164,10 @@ int main()
 	skyboxShader.setInt("skybox", 0);
 
 	// Main Loop
-	while (!glfwWindowShouldClose(window))
+	while (!WindowShouldClose())
 	{
 
-		float currentFrame = glfwGetTime();
+		float currentFrame = FrameTime();
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
 
@@ -173,6 +177,7 @@ int main()
 		// input
 		// -----
 		processInput(window);
+		UpdateCamera(camera);
 		if (gui)
 		{
 			// Start the Dear ImGui frame
@@ -196,7 +201,7 @@ int main()
 					if (models.GetActiveGroupId() != item_current)
 					{
 						models.SetActiveGroup(item_current);
-						myModel = models.GetActiveAsset<Model>("model");
+						myModel = models.GetActiveAsset<ModelPtr>("model");
 						modelTransformation = models.GetActiveAsset<glm::mat4>("transformation");
 					}
 				}
@@ -245,9 +250,9 @@ int main()
 		mat4 model = mat4(1.0f);
 		if (rotateModel)
 		{
-			model = rotate(model, (float)glfwGetTime(), vec3(0.0f, 1.0f, 0.0f));
+			model = rotate(model, (float)FrameTime(), vec3(0.0f, 1.0f, 0.0f));
 		}
-		//model = rotate(model, (float)glfwGetTime(), vec3(0.0f, 0.0f, 1.0f));
+		//model = rotate(model, (float)FrameTime(), vec3(0.0f, 0.0f, 1.0f));
 		model = translate(model, vec3(0.0f, -0.5f, 0.0f));
 		model *= modelTransformation;
 		myShader.use();
@@ -257,19 +262,19 @@ int main()
 		myShader.setVec3("cameraPos", camera.Position);
 		myShader.setInt("mode", shaderMode);
 
-		myModel.Draw(myShader);
+		myModel->Draw(myShader);
 
 		// draw the skybox
 		glDepthFunc(GL_LEQUAL); // change depth function so depth test passes when values are equal to depth buffer's content
 		skyboxShader.use();
 		skyboxShader.setMat4("projection", projection);
 		skyboxShader.setMat4("view", view);
-		skyboxCube.Draw(skyboxShader);
+		skyboxCube->Draw(skyboxShader);
 		glDepthFunc(GL_LESS); // change depth function so depth test passes when values are equal to depth buffer's content
 
 		if (gui)
 			ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-		glfwSwapBuffers(window);
+		PresentFrame();
 	}
 
 	glfwTerminate();
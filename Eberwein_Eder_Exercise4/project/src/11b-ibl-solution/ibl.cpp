@@ -11,6 +11,9 @@
 #include <util/model.h>
 #include <util/assets.h>
 #include <util/window.h>
+#include <util/profiler.h>
+#include <util/clustered.h>
+#include <util/rendertarget.h>
 
 #include <iostream>
 
@@ -30,6 +33,7 @@ AssetManager assets({{"sphere", // group
                       {{"model", "../resources/simple/sphere.obj"},
                        {"transformation", glm::scale(glm::mat4(1.0f), glm::vec3(1.0))},
                        //{ TEX_FLIP, true }, // if true, causes textures to be flipped in y
+                       //{ MESH_RETENTION, RETAIN_POSITIONS }, // keeps positions and indices on the CPU (e.g. for picking)
                        {"albedo", "../resources/textures/rusted_iron/albedo.png"},
                        {"normal", "../resources/textures/rusted_iron/normal.png"},
                        {"metallness", "../resources/textures/rusted_iron/metallic.png"},
@@ -72,7 +76,7 @@ float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
 const char *APP_NAME = "IBL";
-int main()
+int main(int argc, char **argv)
 {
     // controllable settings
     float gamma = 2.2f;
@@ -82,10 +86,17 @@ int main()
     bool useTextures = false;
     int bg_texture = 0;
     bool rotateModel = false;
+    int extraLights = 0;
+    float lightCutoff = 0.01f; // the radius of a light ends where its attenuation falls below this
+
+    if (!ParseCommandLine(argc, argv))
+        return -1;
+    CommandLineOption("lights", extraLights); // e.g. --set lights=512
 
     // glfw: initialize and configure
     // ------------------------------
-    InitWindowAndGUI(SCR_WIDTH, SCR_HEIGHT, APP_NAME);
+    if (InitWindowAndGUI(SCR_WIDTH, SCR_HEIGHT, APP_NAME) < 0)
+        return -1;
 
     // OpenGL is initialized now, so we can use OpenGL functions (glFoo ...)
     // ------------------------------
@@ -130,6 +141,9 @@ int main()
     pbrShader.setInt("metallicMap", 5);
     pbrShader.setInt("roughnessMap", 6);
     pbrShader.setInt("aoMap", 7);
+    pbrShader.setInt("lightData", 8);
+    pbrShader.setInt("lightIndices", 9);
+    pbrShader.setInt("clusterLights", 10);
 
     backgroundShader.use();
     backgroundShader.setInt("environmentMap", 0);
@@ -137,7 +151,7 @@ int main()
     // loaded model
     // -------------------------
     assets.SetActiveGroup("sphere");
-    Model loadedModel = assets.GetActiveAsset<Model>("model"); // new Model(FileSystem::getPath("resources/objects/cerberus/Cerberus_LP.FBX").c_str());
+    ModelPtr loadedModel = assets.GetActiveAsset<ModelPtr>("model"); // new Model(FileSystem::getPath("resources/objects/cerberus/Cerberus_LP.FBX").c_str());
     glm::mat4 modelTransformation = assets.GetActiveAsset<glm::mat4>("transformation");
     // loadedModel = backpack.getModel();
 
@@ -149,6 +163,15 @@ int main()
     unsigned int roughnessMap = assets.GetActiveAsset<Tex>("roughness"); //  = loadTexture(FileSystem::getPath("resources/objects/cerberus/Textures/Cerberus_R.tga").c_str());
     unsigned int aoMap = assets.GetActiveAsset<Tex>("ao");               //        = loadTexture(FileSystem::getPath("resources/textures/pbr/rusted_iron/ao.png").c_str());
 
+    // model and textures of a newly selected group, loaded in the background; the current ones stay
+    // visible until all of them are ready
+    const char *MAP_NAMES[] = {"albedo", "normal", "metallness", "roughness", "ao"};
+    unsigned int *maps[] = {&albedoMap, &normalMap, &metallicMap, &roughnessMap, &aoMap};
+    AssetHandle<ModelPtr> pendingModel;
+    AssetHandle<glm::mat4> pendingTransformation;
+    AssetHandle<Tex> pendingMaps[5];
+    std::string renderedGroup = assets.GetActiveGroup(); // restored if the selected group fails to load
+
     // lights
     // ------
     glm::vec3 lightPositions[] = {
@@ -162,21 +185,36 @@ int main()
         glm::vec3(300.0f, 300.0f, 300.0f),
         glm::vec3(300.0f, 300.0f, 300.0f),
         glm::vec3(300.0f, 300.0f, 300.0f)};
+    const int NUM_MAIN_LIGHTS = sizeof(lightPositions) / sizeof(lightPositions[0]);
+
+    // additional small lights around the model, all lights are assigned to clusters of the view frustum every frame
+    const int MAX_EXTRA_LIGHTS = 1020;
+    extraLights = glm::clamp(extraLights, 0, MAX_EXTRA_LIGHTS);
+    std::vector<GPULight> gpuLights(NUM_MAIN_LIGHTS + MAX_EXTRA_LIGHTS);
+    srand(7);
+    for (int i = 0; i < MAX_EXTRA_LIGHTS; i++)
+    {
+        glm::vec3 dir(rand() % 200 / 100.0f - 1.0f, rand() % 200 / 100.0f - 1.0f, rand() % 200 / 100.0f - 1.0f);
+        float distance = 1.5f + rand() % 100 / 40.0f;
+        glm::vec3 color(rand() % 100 / 50.0f, rand() % 100 / 50.0f, rand() % 100 / 50.0f);
+        gpuLights[NUM_MAIN_LIGHTS + i].position = glm::vec4(glm::vec3(0.0f, 0.0f, 1.0f) + glm::normalize(dir + glm::vec3(0.001f)) * distance, 0.0f);
+        gpuLights[NUM_MAIN_LIGHTS + i].color = glm::vec4(color, 1.0f);
+    }
+    LightClusters lightClusters(gpuLights.size());
 
     // pbr: setup framebuffer
     // ----------------------
-    unsigned int captureFBO;
-    unsigned int captureRBO;
-    glGenFramebuffers(1, &captureFBO);
-    glGenRenderbuffers(1, &captureRBO);
+    // depth only, the cubemap faces and the LUT are attached as color attachment 0 by the capture passes
+    RenderTarget capture({Attachment{GL_DEPTH_COMPONENT24}});
+    capture.Resize(512, 512);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
+    // CPU/GPU time of the one-off capture passes and of the passes of every frame
+    Profiler captureProfiler, profiler;
+    captureProfiler.BeginFrame();
 
     // pbr: load the HDR environment map
     // ---------------------------------
+    captureProfiler.Begin("load HDR");
     stbi_set_flip_vertically_on_load(true);
     int width, height, nrComponents;
     // if you want to use a different latitude-longitude environment map, change below
@@ -199,6 +237,7 @@ int main()
     {
         std::cout << "Failed to load HDR image." << std::endl;
     }
+    captureProfiler.End();
 
     // pbr: setup cubemap to render to and attach to framebuffer
     // ---------------------------------------------------------
@@ -229,14 +268,14 @@ int main()
 
     // pbr: convert HDR equirectangular environment map to cubemap equivalent
     // ----------------------------------------------------------------------
+    captureProfiler.Begin("equirectangular to cubemap");
     equirectangularToCubemapShader.use();
     equirectangularToCubemapShader.setInt("equirectangularMap", 0);
     equirectangularToCubemapShader.setMat4("projection", captureProjection);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, hdrTexture);
 
-    glViewport(0, 0, 512, 512); // don't forget to configure the viewport to the capture dimensions.
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+    capture.Bind(); // also configures the viewport to the capture dimensions.
     for (unsigned int i = 0; i < 6; ++i)
     {
         equirectangularToCubemapShader.setMat4("view", captureViews[i]);
@@ -245,11 +284,12 @@ int main()
 
         renderCube();
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
 
     // then let OpenGL generate mipmaps from first mip face (combatting visible dots artifact)
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
     glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    captureProfiler.End();
 
     // pbr: create an irradiance cubemap, and re-scale capture FBO to irradiance scale.
     // --------------------------------------------------------------------------------
@@ -266,20 +306,18 @@ int main()
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 32, 32);
+    capture.Resize(32, 32);
 
     // pbr: solve diffuse integral by convolution to create an irradiance (cube)map.
     // -----------------------------------------------------------------------------
+    captureProfiler.Begin("irradiance convolution");
     irradianceShader.use();
     irradianceShader.setInt("environmentMap", 0);
     irradianceShader.setMat4("projection", captureProjection);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
 
-    glViewport(0, 0, 32, 32); // don't forget to configure the viewport to the capture dimensions.
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
+    capture.Bind(); // also configures the viewport to the capture dimensions.
     for (unsigned int i = 0; i < 6; ++i)
     {
         irradianceShader.setMat4("view", captureViews[i]);
@@ -288,7 +326,8 @@ int main()
 
         renderCube();
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
+    captureProfiler.End();
 
     // pbr: create a pre-filter cubemap, and re-scale capture FBO to pre-filter scale.
     // --------------------------------------------------------------------------------
@@ -309,22 +348,21 @@ int main()
 
     // pbr: run a quasi monte-carlo simulation on the environment lighting to create a prefilter (cube)map.
     // ----------------------------------------------------------------------------------------------------
+    captureProfiler.Begin("prefilter");
     prefilterShader.use();
     prefilterShader.setInt("environmentMap", 0);
     prefilterShader.setMat4("projection", captureProjection);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
     unsigned int maxMipLevels = 5;
     for (unsigned int mip = 0; mip < maxMipLevels; ++mip)
     {
         // reisze framebuffer according to mip-level size.
         unsigned int mipWidth = 128 * std::pow(0.5, mip);
         unsigned int mipHeight = 128 * std::pow(0.5, mip);
-        glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipWidth, mipHeight);
-        glViewport(0, 0, mipWidth, mipHeight);
+        capture.Resize(mipWidth, mipHeight);
+        capture.Bind();
 
         float roughness = (float)mip / (float)(maxMipLevels - 1);
         prefilterShader.setFloat("roughness", roughness);
@@ -337,10 +375,12 @@ int main()
             renderCube();
         }
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
+    captureProfiler.End();
 
     // pbr: generate a 2D LUT from the BRDF equations used.
     // ----------------------------------------------------
+    captureProfiler.Begin("BRDF LUT");
     unsigned int brdfLUTTexture;
     glGenTextures(1, &brdfLUTTexture);
 
@@ -354,17 +394,19 @@ int main()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
     // then re-configure capture framebuffer object and render screen-space quad with BRDF shader.
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
+    capture.Resize(512, 512);
+    capture.Bind();
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brdfLUTTexture, 0);
 
-    glViewport(0, 0, 512, 512);
     brdfShader.use();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     renderQuad();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
+    capture.Release(); // the capture passes are done, free the depth buffer
+    captureProfiler.End();
+    captureProfiler.Flush();
+    captureProfiler.Print();
 
     // initialize static shader uniforms before rendering
     // --------------------------------------------------
@@ -381,13 +423,14 @@ int main()
 
     // render loop
     // -----------
-    while (!glfwWindowShouldClose(window))
+    while (!WindowShouldClose())
     {
         // per-frame time logic
         // --------------------
-        float currentFrame = glfwGetTime();
+        float currentFrame = FrameTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        profiler.BeginFrame();
 
         // Poll and handle events (inputs, window resize, etc.)
         glfwPollEvents();
@@ -395,6 +438,7 @@ int main()
         // input
         // -----
         processInput(window);
+        UpdateCamera(camera);
         if (gui)
         {
             // Start the Dear ImGui frame
@@ -416,6 +460,9 @@ int main()
                 }
 
                 ImGui::Checkbox("rotate model", &rotateModel);
+                ImGui::SliderInt("extra lights", &extraLights, 0, MAX_EXTRA_LIGHTS);
+                ImGui::SliderFloat("light cutoff", &lightCutoff, 0.001f, 0.5f, "%.3f");
+                ImGui::Text("lights per cluster: %.1f avg, %u max", lightClusters.GetAverageLightsPerCluster(), lightClusters.GetMaxLightsPerCluster());
                 // Combobox with Texture options:
                 auto ass = assets.GetGroups();
                 int item_current = assets.GetActiveGroupId();
@@ -428,13 +475,31 @@ int main()
                     assets.SetActiveGroup(item_current);
                     // loaded model and (PBR) texutes
                     // -------------------------
-                    loadedModel = assets.GetActiveAsset<Model>("model");
-                    modelTransformation = assets.GetActiveAsset<glm::mat4>("transformation");
-                    albedoMap = assets.GetActiveAsset<Tex>("albedo");
-                    normalMap = assets.GetActiveAsset<Tex>("normal");
-                    metallicMap = assets.GetActiveAsset<Tex>("metallness");
-                    roughnessMap = assets.GetActiveAsset<Tex>("roughness");
-                    aoMap = assets.GetActiveAsset<Tex>("ao");
+                    pendingModel = assets.GetActiveAssetAsync<ModelPtr>("model");
+                    pendingTransformation = assets.GetActiveAssetAsync<glm::mat4>("transformation");
+                    for (int i = 0; i < 5; i++)
+                        pendingMaps[i] = assets.GetActiveAssetAsync<Tex>(MAP_NAMES[i]);
+                }
+                if (pendingModel.Valid())
+                    ImGui::Text("loading %s ...", assets.GetActiveGroup().c_str());
+                // resident memory of the loaded models and textures
+                if (ImGui::CollapsingHeader("assets") && ImGui::BeginTable("memory", 3, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable))
+                {
+                    ImGui::TableSetupColumn("asset", ImGuiTableColumnFlags_WidthStretch);
+                    ImGui::TableSetupColumn("cpu MB");
+                    ImGui::TableSetupColumn("gpu MB");
+                    ImGui::TableHeadersRow();
+                    for (const AssetMemory &asset : assets.GetMemoryReport())
+                    {
+                        ImGui::TableNextRow();
+                        ImGui::TableNextColumn();
+                        ImGui::TextUnformatted(asset.name.c_str());
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%.2f", asset.cpuBytes / (1024.0 * 1024.0));
+                        ImGui::TableNextColumn();
+                        ImGui::Text("%.2f", asset.gpuBytes / (1024.0 * 1024.0));
+                    }
+                    ImGui::EndTable();
                 }
 
                 const char *bg_combo[] = {"environment", "irradiance", "prefilter"};
@@ -453,12 +518,44 @@ int main()
                     pbrShader.setInt("metallicMap", 5);
                     pbrShader.setInt("roughnessMap", 6);
                     pbrShader.setInt("aoMap", 7);
+                    pbrShader.setInt("lightData", 8);
+                    pbrShader.setInt("lightIndices", 9);
+                    pbrShader.setInt("clusterLights", 10);
                 }
 
+                profiler.DrawGUI();
+                captureProfiler.DrawGUI("precomputation");
                 ImGui::End();
             }
         }
 
+        // upload the assets loaded in the background, switch once the whole group is ready
+        assets.Update();
+        if (pendingModel.Valid())
+        {
+            bool ready = pendingModel.Ready() && pendingTransformation.Ready();
+            bool failed = pendingModel.Failed() || pendingTransformation.Failed();
+            for (int i = 0; i < 5; i++)
+            {
+                ready = ready && pendingMaps[i].Ready();
+                failed = failed || pendingMaps[i].Failed();
+            }
+            if (failed) // reported by the loader, keep rendering the current model and select its group again
+            {
+                pendingModel.Reset();
+                assets.SetActiveGroup(renderedGroup);
+            }
+            else if (ready)
+            {
+                renderedGroup = assets.GetActiveGroup();
+                loadedModel = pendingModel.Get();
+                modelTransformation = pendingTransformation.Get();
+                for (int i = 0; i < 5; i++)
+                    *maps[i] = pendingMaps[i].Get();
+                pendingModel.Reset();
+            }
+        }
+
         // render
         // ------
         if (gui)
@@ -474,14 +571,35 @@ int main()
         glEnable(GL_DEPTH_TEST);
         glDisable(GL_BLEND);
 
+        projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+        glm::mat4 view = camera.GetViewMatrix();
+
+        // assign the lights to the clusters of the view frustum
+        // ------------------------------------------------------------------------------------------
+        profiler.Begin("light assignment");
+        int numLights = NUM_MAIN_LIGHTS + extraLights;
+        for (int i = 0; i < numLights; i++)
+        {
+            if (i < NUM_MAIN_LIGHTS)
+            {
+                gpuLights[i].position = glm::vec4(lightPositions[i], 0.0f);
+                gpuLights[i].color = glm::vec4(lightColors[i], 1.0f);
+            }
+            gpuLights[i].position.w = LightRadius(glm::vec3(gpuLights[i].color), lightCutoff);
+        }
+        lightClusters.Resize(display_w, display_h);
+        lightClusters.UploadLights(gpuLights, numLights);
+        lightClusters.Assign(gpuLights, numLights, view, projection);
+        profiler.End();
+
         // render scene, supplying the convoluted irradiance map to the final shader.
         // ------------------------------------------------------------------------------------------
+        profiler.Begin("model");
         pbrShader.use();
         glm::mat4 model = glm::mat4(1.0f);
-        projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
         pbrShader.setMat4("projection", projection);
-        glm::mat4 view = camera.GetViewMatrix();
         pbrShader.setMat4("view", view);
+        lightClusters.SetUniforms(pbrShader);
         pbrShader.setVec3("camPos", camera.Position);
         pbrShader.setVec3("Albedo", albedo.r, albedo.g, albedo.b);
         pbrShader.setFloat("AO", 1.0f);
@@ -497,6 +615,8 @@ int main()
         glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
         glActiveTexture(GL_TEXTURE2);
         glBindTexture(GL_TEXTURE_2D, brdfLUTTexture);
+        lightClusters.BindLights(8);
+        lightClusters.BindClusters(9, 10);
 
         if (useTextures)
         {
@@ -515,21 +635,20 @@ int main()
         model *= (glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 1.0f))) * modelTransformation;
         if (rotateModel)
         {
-            model = glm::rotate(model, (float)glfwGetTime(), glm::vec3(0.0f, 1.0f, 0.0f));
+            model = glm::rotate(model, (float)FrameTime(), glm::vec3(0.0f, 1.0f, 0.0f));
         }
         pbrShader.setMat4("model", model);
-        loadedModel.Draw(pbrShader);
+        loadedModel->Draw(pbrShader);
+        profiler.End();
 
         // render light source (simply re-render sphere at light positions)
         // this looks a bit off as we use the same shader, but it'll make their positions obvious and
         // keeps the codeprint small.
-        for (unsigned int i = 0; i < sizeof(lightPositions) / sizeof(lightPositions[0]); ++i)
+        profiler.Begin("light spheres");
+        for (int i = 0; i < NUM_MAIN_LIGHTS; ++i)
         {
-            glm::vec3 newPos = lightPositions[i] + glm::vec3(sin(glfwGetTime() * 5.0) * 5.0, 0.0, 0.0);
+            glm::vec3 newPos = lightPositions[i] + glm::vec3(sin(FrameTime() * 5.0) * 5.0, 0.0, 0.0);
             newPos = lightPositions[i];
-            pbrShader.use();
-            pbrShader.setVec3("lightPositions[" + std::to_string(i) + "]", newPos);
-            pbrShader.setVec3("lightColors[" + std::to_string(i) + "]", lightColors[i]);
 
             lightShader.use();
             model = glm::mat4(1.0f);
@@ -541,8 +660,10 @@ int main()
             lightShader.setVec3("lightColor", lightColors[i]);
             renderSphere();
         }
+        profiler.End();
 
         // render skybox (render as last to prevent overdraw)
+        profiler.Begin("skybox");
         backgroundShader.use();
         backgroundShader.setFloat("gamma", gamma);
         backgroundShader.setMat4("view", view);
@@ -562,6 +683,7 @@ int main()
         // glBindTexture(GL_TEXTURE_CUBE_MAP, irradianceMap); // display irradiance map
         // glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap); // display prefilter map
         renderCube();
+        profiler.End();
 
         // render BRDF map to screen
         // brdfShader.Use();
@@ -569,9 +691,12 @@ int main()
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
+        profiler.Begin("GUI");
         if (gui)
             ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        glfwSwapBuffers(window);
+        profiler.End();
+        profiler.EndFrame();
+        PresentFrame();
     }
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
@@ -23,10 +23,15 @@ uniform samplerCube irradianceMap;
 uniform samplerCube prefilterMap;
 uniform sampler2D brdfLUT;
 
-// lights
-uniform vec3 lightPositions[4];
-uniform vec3 lightColors[4];
-
+// lights, assigned to clusters of the view frustum by LightClusters (util/clustered.h)
+uniform samplerBuffer lightData;     // 2 texels per light: position + radius, color
+uniform usamplerBuffer lightIndices; // light lists of all clusters, one after another
+uniform usampler3D clusterLights;    // per cluster: offset and length of its light list
+uniform int clusterTileSize;
+uniform float clusterScale;
+uniform float clusterBias;
+
+uniform mat4 view;
 uniform vec3 camPos;
 
 const float PI = 3.14159265359;
@@ -52,6 +57,14 @@ vec3 getNormalFromMap()
     return normalize(TBN * tangentNormal);
 }
 // ----------------------------------------------------------------------------
+// offset and length of the light list of the cluster containing the fragment
+uvec2 clusterLightList()
+{
+    float depth = -(view * vec4(WorldPos, 1.0)).z;
+    int slice = clamp(int(log(depth) * clusterScale - clusterBias), 0, textureSize(clusterLights, 0).z - 1);
+    return texelFetch(clusterLights, ivec3(ivec2(gl_FragCoord.xy) / clusterTileSize, slice), 0).rg;
+}
+// ----------------------------------------------------------------------------
 float DistributionGGX(vec3 N, vec3 H, float roughness)
 {
     float a = roughness*roughness;
@@ -126,14 +139,21 @@ void main()
 
     // reflectance equation
     vec3 Lo = vec3(0.0);
-    for(int i = 0; i < 4; ++i) 
+    uvec2 list = clusterLightList();
+    for(uint i = list.x; i < list.x + list.y; ++i) 
     {
-        // calculate per-light radiance
-        vec3 L = normalize(lightPositions[i] - WorldPos);
+        int light = int(texelFetch(lightIndices, int(i)).r);
+        vec4 lightPosition = texelFetch(lightData, 2 * light);
+        vec3 lightColor = texelFetch(lightData, 2 * light + 1).rgb;
+
+        // calculate per-light radiance, faded out towards the radius of influence in lightPosition.w
+        vec3 L = normalize(lightPosition.xyz - WorldPos);
         vec3 H = normalize(V + L);
-        float distance = length(lightPositions[i] - WorldPos);
+        float distance = length(lightPosition.xyz - WorldPos);
         float attenuation = 1.0 / (distance * distance);
-        vec3 radiance = lightColors[i] * attenuation;
+        float window = clamp(1.0 - pow(distance / lightPosition.w, 4.0), 0.0, 1.0);
+        attenuation *= window * window;
+        vec3 radiance = lightColor * attenuation;
 
         // Cook-Torrance BRDF
         float NDF = DistributionGGX(N, H, roughness);   
@@ -73,7 +73,7 @@ float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
 const char *APP_NAME = "IBL";
-int main()
+int main(int argc, char **argv)
 {
     // controllable settings
     float gamma = 2.2f;
@@ -84,9 +84,13 @@ int main()
     int bg_texture = 0;
     bool rotateModel = false;
 
+    if (!ParseCommandLine(argc, argv))
+        return -1;
+
     // glfw: initialize and configure
     // ------------------------------
-    InitWindowAndGUI(SCR_WIDTH, SCR_HEIGHT, APP_NAME);
+    if (InitWindowAndGUI(SCR_WIDTH, SCR_HEIGHT, APP_NAME) < 0)
+        return -1;
 
     // OpenGL is initialized now, so we can use OpenGL functions (glFoo ...)
     // ------------------------------
@@ -138,7 +142,7 @@ int main()
     // loaded model
     // -------------------------
     assets.SetActiveGroup("sphere");
-    Model loadedModel = assets.GetActiveAsset<Model>("model"); // new Model(FileSystem::getPath("resources/objects/cerberus/Cerberus_LP.FBX").c_str());
+    ModelPtr loadedModel = assets.GetActiveAsset<ModelPtr>("model"); // new Model(FileSystem::getPath("resources/objects/cerberus/Cerberus_LP.FBX").c_str());
     glm::mat4 modelTransformation = assets.GetActiveAsset<glm::mat4>("transformation");
     // loadedModel = backpack.getModel();
 
@@ -246,7 +250,7 @@ int main()
 
         renderCube();
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
 
     // then let OpenGL generate mipmaps from first mip face (combatting visible dots artifact)
     glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
@@ -289,7 +293,7 @@ int main()
 
         renderCube();
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
 
     // pbr: create a pre-filter cubemap, and re-scale capture FBO to pre-filter scale.
     // --------------------------------------------------------------------------------
@@ -338,7 +342,7 @@ int main()
             renderCube();
         }
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
 
     // pbr: generate a 2D LUT from the BRDF equations used.
     // ----------------------------------------------------
@@ -365,7 +369,7 @@ int main()
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     renderQuad();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
 
     // initialize static shader uniforms before rendering
     // --------------------------------------------------
@@ -382,11 +386,11 @@ int main()
 
     // render loop
     // -----------
-    while (!glfwWindowShouldClose(window))
+    while (!WindowShouldClose())
     {
         // per-frame time logic
         // --------------------
-        float currentFrame = glfwGetTime();
+        float currentFrame = FrameTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
@@ -396,6 +400,7 @@ int main()
         // input
         // -----
         processInput(window);
+        UpdateCamera(camera);
         if (gui)
         {
             // Start the Dear ImGui frame
@@ -429,7 +434,7 @@ int main()
                     assets.SetActiveGroup(item_current);
                     // loaded model and (PBR) texutes
                     // -------------------------
-                    loadedModel = assets.GetActiveAsset<Model>("model");
+                    loadedModel = assets.GetActiveAsset<ModelPtr>("model");
                     modelTransformation = assets.GetActiveAsset<glm::mat4>("transformation");
                     albedoMap = assets.GetActiveAsset<Tex>("albedo");
                     normalMap = assets.GetActiveAsset<Tex>("normal");
@@ -516,17 +521,17 @@ int main()
         model *= (glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 1.0f))) * modelTransformation;
         if (rotateModel)
         {
-            model = glm::rotate(model, (float)glfwGetTime(), glm::vec3(0.0f, 1.0f, 0.0f));
+            model = glm::rotate(model, (float)FrameTime(), glm::vec3(0.0f, 1.0f, 0.0f));
         }
         pbrShader.setMat4("model", model);
-        loadedModel.Draw(pbrShader);
+        loadedModel->Draw(pbrShader);
 
         // render light source (simply re-render sphere at light positions)
         // this looks a bit off as we use the same shader, but it'll make their positions obvious and
         // keeps the codeprint small.
         for (unsigned int i = 0; i < sizeof(lightPositions) / sizeof(lightPositions[0]); ++i)
         {
-            glm::vec3 newPos = lightPositions[i] + glm::vec3(sin(glfwGetTime() * 5.0) * 5.0, 0.0, 0.0);
+            glm::vec3 newPos = lightPositions[i] + glm::vec3(sin(FrameTime() * 5.0) * 5.0, 0.0, 0.0);
             newPos = lightPositions[i];
             pbrShader.use();
             pbrShader.setVec3("lightPositions[" + std::to_string(i) + "]", newPos);
@@ -572,7 +577,7 @@ int main()
         // -------------------------------------------------------------------------------
         if (gui)
             ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        glfwSwapBuffers(window);
+        PresentFrame();
     }
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
@@ -0,0 +1,236 @@
+#pragma once
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <util/rtscene.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+// Bounding volume hierarchy over the ray tracer primitives (util/rtscene.h).
+// Built on the CPU with the surface area heuristic (binned), then flattened in depth-first order.
+// Every node stores its escape ("miss") link - the next node to visit once the node's subtree is done or missed -
+// so the shader can walk the tree without a stack:
+//   box hit, interior node -> i + 1 (the left child)
+//   box hit, leaf          -> test the primitives, then miss
+//   box missed             -> miss
+// Traversal ends when the index reaches the node count. The right child of an interior node is the miss link of
+// its left child, which lets the CPU renderer traverse the same array with an explicit stack in near-to-far order.
+
+// one node, uploaded as two RGBA32F texels (ints are stored bit-cast, floatBitsToInt() in GLSL)
+struct BVHNode
+{
+    glm::vec3 boxMin;
+    int miss;          // escape link
+    glm::vec3 boxMax;
+    int primitiveInfo; // leaves: (first primitive << 3) | count, interior nodes: 0
+};
+static_assert(sizeof(BVHNode) == 8 * sizeof(float), "BVHNode must be two vec4 texels");
+
+class BVH
+{
+public:
+    static const int MAX_LEAF_SIZE = 4; // at most 7, the count is stored in 3 bits
+    static const int SAH_BINS = 16;
+    // bound of the number of interior nodes on any path from the root, the CPU traversal stack has this size.
+    // Below MAX_SAH_DEPTH the items are split at their median, which needs at most 31 more levels.
+    static const int MAX_DEPTH = 64;
+    static const int MAX_SAH_DEPTH = 32;
+
+    std::vector<BVHNode> nodes;
+    std::vector<int> primitiveOrder; // primitives in leaf order: pack the scene with this order
+
+    // build the hierarchy over the primitives of a scene
+    // ------------------------------------------------------------------------
+    void Build(const RaytracingScene &scene)
+    {
+        nodes.clear();
+        primitiveOrder.clear();
+        m_items.clear();
+        for (int i = 0; i < (int)scene.primitives.size(); i++)
+        {
+            Item item;
+            GetPrimitiveBounds(scene.primitives[i], item.boxMin, item.boxMax);
+            item.centroid = 0.5f * (item.boxMin + item.boxMax);
+            item.index = i;
+            m_items.push_back(item);
+        }
+        if (m_items.empty())
+            return;
+        nodes.reserve(2 * m_items.size());
+        buildRecursive(0, (int)m_items.size(), 0);
+        for (const Item &item : m_items)
+            primitiveOrder.push_back(item.index);
+        m_items.clear();
+    }
+
+    // tight axis aligned box of a primitive
+    // ------------------------------------------------------------------------
+    static void GetPrimitiveBounds(const RaytracingPrimitive &p, glm::vec3 &boxMin, glm::vec3 &boxMax)
+    {
+        glm::vec3 extent = glm::vec3(p.size.x);
+        if (p.type == PRIM_TORUS)
+        {
+            // the ring (radius R around the axis) extends R * sqrt(1 - axis_i^2) along world axis i, the tube adds r
+            glm::vec3 axis = p.GetRotation()[1];
+            for (int i = 0; i < 3; i++)
+                extent[i] = p.size.x * std::sqrt(std::max(1.0f - axis[i] * axis[i], 0.0f)) + p.size.y;
+        }
+        boxMin = p.position - extent;
+        boxMax = p.position + extent;
+    }
+
+    static bool IsLeaf(const BVHNode &node) { return node.primitiveInfo != 0; }
+    static int FirstPrimitive(const BVHNode &node) { return node.primitiveInfo >> 3; }
+    static int PrimitiveCount(const BVHNode &node) { return node.primitiveInfo & 7; }
+
+    // nodes as texels for a GL_RGBA32F texture buffer
+    const float *GetData() const { return nodes.empty() ? nullptr : &nodes[0].boxMin.x; }
+    size_t GetDataSize() const { return nodes.size() * sizeof(BVHNode); }
+
+private:
+    struct Item
+    {
+        glm::vec3 boxMin, boxMax, centroid;
+        int index;
+    };
+    struct Bin
+    {
+        glm::vec3 boxMin = glm::vec3(FLT_MAX);
+        glm::vec3 boxMax = glm::vec3(-FLT_MAX);
+        int count = 0;
+    };
+
+    std::vector<Item> m_items;
+
+    static float surfaceArea(const glm::vec3 &boxMin, const glm::vec3 &boxMax)
+    {
+        glm::vec3 d = glm::max(boxMax - boxMin, glm::vec3(0.0f));
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    // emits the subtree over m_items[first, first + count) in depth-first order, returns its root index
+    int buildRecursive(int first, int count, int depth)
+    {
+        int index = (int)nodes.size();
+        nodes.push_back(BVHNode());
+
+        glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX), centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+        for (int i = first; i < first + count; i++)
+        {
+            boxMin = glm::min(boxMin, m_items[i].boxMin);
+            boxMax = glm::max(boxMax, m_items[i].boxMax);
+            centroidMin = glm::min(centroidMin, m_items[i].centroid);
+            centroidMax = glm::max(centroidMax, m_items[i].centroid);
+        }
+        nodes[index].boxMin = boxMin;
+        nodes[index].boxMax = boxMax;
+
+        int mid = -1;
+        if (count > 1 && depth >= MAX_SAH_DEPTH)
+            mid = count <= MAX_LEAF_SIZE ? -1 : medianSplit(first, count, centroidMin, centroidMax);
+        else if (count > 1)
+            mid = findSplit(first, count, boxMin, boxMax, centroidMin, centroidMax);
+        if (mid < 0)
+        {
+            nodes[index].primitiveInfo = (first << 3) | count;
+            nodes[index].miss = (int)nodes.size();
+            return index;
+        }
+
+        nodes[index].primitiveInfo = 0;
+        buildRecursive(first, mid - first, depth + 1);
+        buildRecursive(mid, first + count - mid, depth + 1);
+        nodes[index].miss = (int)nodes.size();
+        return index;
+    }
+
+    // splits the items at the median of the longest centroid axis, keeps the depth logarithmic
+    // (degenerate SAH splits, e.g. one primitive per level, could otherwise exceed MAX_DEPTH)
+    int medianSplit(int first, int count, const glm::vec3 &centroidMin, const glm::vec3 &centroidMax)
+    {
+        glm::vec3 extent = centroidMax - centroidMin;
+        int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+        int mid = first + count / 2;
+        std::nth_element(m_items.begin() + first, m_items.begin() + mid, m_items.begin() + first + count, [axis](const Item &a, const Item &b)
+                         { return a.centroid[axis] < b.centroid[axis]; });
+        return mid;
+    }
+
+    // binned SAH split: partitions the items and returns the first index of the right half,
+    // or -1 if a leaf is cheaper (only allowed up to MAX_LEAF_SIZE primitives)
+    int findSplit(int first, int count, const glm::vec3 &boxMin, const glm::vec3 &boxMax,
+                  const glm::vec3 &centroidMin, const glm::vec3 &centroidMax)
+    {
+        float bestCost = FLT_MAX;
+        int bestAxis = -1, bestBin = -1;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centroidMax[axis] - centroidMin[axis];
+            if (extent <= 0.0f)
+                continue;
+            Bin bins[SAH_BINS];
+            float scale = SAH_BINS / extent;
+            for (int i = first; i < first + count; i++)
+            {
+                int b = std::min((int)((m_items[i].centroid[axis] - centroidMin[axis]) * scale), SAH_BINS - 1);
+                bins[b].boxMin = glm::min(bins[b].boxMin, m_items[i].boxMin);
+                bins[b].boxMax = glm::max(bins[b].boxMax, m_items[i].boxMax);
+                bins[b].count++;
+            }
+
+            // sweep from the right to get the area and count of every right half
+            float rightArea[SAH_BINS];
+            int rightCount[SAH_BINS];
+            glm::vec3 rMin(FLT_MAX), rMax(-FLT_MAX);
+            int rCount = 0;
+            for (int b = SAH_BINS - 1; b > 0; b--)
+            {
+                rMin = glm::min(rMin, bins[b].boxMin);
+                rMax = glm::max(rMax, bins[b].boxMax);
+                rCount += bins[b].count;
+                rightArea[b] = surfaceArea(rMin, rMax);
+                rightCount[b] = rCount;
+            }
+            glm::vec3 lMin(FLT_MAX), lMax(-FLT_MAX);
+            int lCount = 0;
+            for (int b = 0; b < SAH_BINS - 1; b++)
+            {
+                lMin = glm::min(lMin, bins[b].boxMin);
+                lMax = glm::max(lMax, bins[b].boxMax);
+                lCount += bins[b].count;
+                if (lCount == 0 || rightCount[b + 1] == 0)
+                    continue;
+                float cost = lCount * surfaceArea(lMin, lMax) + rightCount[b + 1] * rightArea[b + 1];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        // cost of a leaf vs. one traversal step plus the children (both relative to the node area)
+        float leafCost = (float)count;
+        float splitCost = 1.0f + bestCost / surfaceArea(boxMin, boxMax);
+        if (bestAxis < 0 || (splitCost >= leafCost && count <= MAX_LEAF_SIZE))
+        {
+            if (count <= MAX_LEAF_SIZE)
+                return -1;
+            // all centroids coincide or no split found: split in the middle of the list
+            return first + count / 2;
+        }
+
+        float scale = SAH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        auto it = std::partition(m_items.begin() + first, m_items.begin() + first + count, [&](const Item &item)
+                                 { return std::min((int)((item.centroid[bestAxis] - centroidMin[bestAxis]) * scale), SAH_BINS - 1) <= bestBin; });
+        return (int)(it - m_items.begin());
+    }
+};
+
+#endif
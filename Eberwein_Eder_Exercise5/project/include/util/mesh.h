@@ -2,6 +2,7 @@
 #define MESH_H
 
 #include <glad/glad.h> // holds all OpenGL type declarations
+#include <GLFW/glfw3.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -9,6 +10,7 @@
 #include <util/shader.h>
 
 #include <string>
+#include <utility>
 #include <vector>
 using namespace std;
 
@@ -33,40 +35,161 @@ struct Texture
     string path;
 };
 
+// what a mesh keeps of its vertices and indices on the CPU after the upload
+enum Mesh_Retention {
+    RETAIN_NONE,      // nothing, Draw only needs the VAO
+    RETAIN_POSITIONS, // positions and indices, e.g. for picking or culling on the CPU
+    RETAIN_ALL        // all vertex attributes and indices
+};
+
+// OpenGL objects are only deleted while a context is current: objects destroyed after glfwTerminate (e.g. the
+// assets cached until the end of the program) are gone with the context, and worker threads have no context
+inline bool HasCurrentContext() { return glfwGetCurrentContext() != nullptr; }
+
+// Mesh on the GPU: the vertices and indices are uploaded by the constructor, the CPU copy kept depends on the retention.
+// Meshes are move-only and own their vertex array and buffers, the destructor deletes them.
 class Mesh
 {
 public:
     // mesh Data
-    vector<Vertex> vertices;
-    vector<unsigned int> indices;
+    vector<Vertex> vertices;       // RETAIN_ALL only
+    vector<glm::vec3> positions;   // RETAIN_POSITIONS only
+    vector<unsigned int> indices;  // RETAIN_POSITIONS and RETAIN_ALL
     vector<Texture> textures;
     unsigned int VAO;
+    unsigned int vertexCount;
+    unsigned int indexCount;
 
     // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    Mesh(const vector<Vertex> &vertices, const vector<unsigned int> &indices, vector<Texture> textures, Mesh_Retention retention = RETAIN_NONE)
+        : Mesh(vertices.data(), vertices.size(), indices.data(), indices.size(), std::move(textures), retention)
+    {
+    }
+
+    // uploads the vertices and indices straight from memory (e.g. a memory mapped mesh cache)
+    Mesh(const Vertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount, vector<Texture> textures, Mesh_Retention retention = RETAIN_NONE)
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        this->textures = std::move(textures);
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        setupMesh(vertices, vertexCount, indices, indexCount);
+        retain(vertices, vertexCount, indices, indexCount, retention);
     }
 
+    Mesh(const Mesh &) = delete;
+    Mesh &operator=(const Mesh &) = delete;
+    // the moved-from mesh keeps no OpenGL objects, its destructor deletes nothing
+    Mesh(Mesh &&other) noexcept
+        : vertices(std::move(other.vertices)), positions(std::move(other.positions)), indices(std::move(other.indices)),
+          textures(std::move(other.textures)), VAO(std::exchange(other.VAO, 0)), vertexCount(std::exchange(other.vertexCount, 0)),
+          indexCount(std::exchange(other.indexCount, 0)), samplerNames(std::move(other.samplerNames)),
+          VBO(std::exchange(other.VBO, 0)), EBO(std::exchange(other.EBO, 0)), instanceVBO(std::exchange(other.instanceVBO, 0))
+    {
+    }
+    Mesh &operator=(Mesh &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            vertices = std::move(other.vertices);
+            positions = std::move(other.positions);
+            indices = std::move(other.indices);
+            textures = std::move(other.textures);
+            samplerNames = std::move(other.samplerNames);
+            VAO = std::exchange(other.VAO, 0);
+            vertexCount = std::exchange(other.vertexCount, 0);
+            indexCount = std::exchange(other.indexCount, 0);
+            VBO = std::exchange(other.VBO, 0);
+            EBO = std::exchange(other.EBO, 0);
+            instanceVBO = std::exchange(other.instanceVBO, 0);
+        }
+        return *this;
+    }
+    ~Mesh() { release(); }
+
     // render the mesh
-    void Draw(Shader shader)
+    void Draw(Shader &shader)
+    {
+        bindTextures(shader);
+
+        // draw mesh
+        glBindVertexArray(VAO);
+        glDrawElements(GL_TRIANGLES, (GLsizei)indexCount, GL_UNSIGNED_INT, 0);
+        glBindVertexArray(0);
+
+        // always good practice to set everything back to defaults once configured.
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // render the mesh once per model matrix of the instance buffer (attributes 5 to 8, one mat4 per instance)
+    void DrawInstanced(Shader &shader, unsigned int instanceBuffer, unsigned int count)
+    {
+        bindTextures(shader);
+
+        glBindVertexArray(VAO);
+        if (instanceBuffer != instanceVBO)
+            setupInstances(instanceBuffer);
+        glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)indexCount, GL_UNSIGNED_INT, 0, (GLsizei)count);
+        glBindVertexArray(0);
+
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // memory of the vertices and indices kept on the CPU
+    size_t CpuBytes() const
+    {
+        return vertices.capacity() * sizeof(Vertex) + positions.capacity() * sizeof(glm::vec3) + indices.capacity() * sizeof(unsigned int);
+    }
+    // memory of the vertex and index buffers
+    size_t GpuBytes() const { return (size_t)vertexCount * sizeof(Vertex) + (size_t)indexCount * sizeof(unsigned int); }
+
+private:
+    // render data
+    vector<string> samplerNames; // of the textures, see nameSamplers
+    unsigned int VBO, EBO;
+    unsigned int instanceVBO = 0; // instance buffer the attributes 5 to 8 of the VAO point to, owned by the Model
+
+    // deletes the vertex array and the buffers, the textures belong to the Model
+    void release()
+    {
+        if (VAO && HasCurrentContext())
+        {
+            glDeleteVertexArrays(1, &VAO);
+            glDeleteBuffers(1, &VBO);
+            glDeleteBuffers(1, &EBO);
+        }
+        VAO = VBO = EBO = 0;
+        instanceVBO = 0;
+    }
+
+    // binds the textures to consecutive units and sets the samplers (diffuse_textureN, ...)
+    void bindTextures(Shader &shader)
+    {
+        if (samplerNames.size() != textures.size())
+            nameSamplers();
+        for (unsigned int i = 0; i < textures.size(); i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
+            // now set the sampler to the correct texture unit, the location is cached by the shader
+            shader.setInt(samplerNames[i], i);
+            // and finally bind the texture
+            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+        }
+    }
+
+    // sampler name of every texture, built once instead of on every draw
+    void nameSamplers()
     {
-        // bind appropriate textures
         unsigned int diffuseNr = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr = 1;
         unsigned int heightNr = 1;
-        for (unsigned int i = 0; i < textures.size(); i++)
+        samplerNames.clear();
+        for (const Texture &texture : textures)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
-            string name = textures[i].type;
+            const string &name = texture.type;
             if (name == "texture_diffuse")
                 number = std::to_string(diffuseNr++);
             else if (name == "texture_specular")
@@ -75,29 +198,47 @@ public:
                 number = std::to_string(normalNr++); // transfer unsigned int to stream
             else if (name == "texture_height")
                 number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            samplerNames.push_back(name + number);
         }
+    }
 
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, (GLsizei)indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // points the per-instance model matrix attributes of the bound VAO to the instance buffer,
+    // a mat4 attribute takes four locations, one per column
+    void setupInstances(unsigned int instanceBuffer)
+    {
+        instanceVBO = instanceBuffer;
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            glEnableVertexAttribArray(5 + i);
+            glVertexAttribPointer(5 + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *)(i * sizeof(glm::vec4)));
+            glVertexAttribDivisor(5 + i, 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
     }
 
-private:
-    // render data
-    unsigned int VBO, EBO;
+    // copies what the retention keeps of the uploaded data
+    void retain(const Vertex *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount, Mesh_Retention retention)
+    {
+        if (retention == RETAIN_NONE)
+            return;
+        indices.assign(indexData, indexData + indexCount);
+        if (retention == RETAIN_ALL)
+            vertices.assign(vertexData, vertexData + vertexCount);
+        else
+        {
+            positions.resize(vertexCount);
+            for (size_t i = 0; i < vertexCount; i++)
+                positions[i] = vertexData[i].Position;
+        }
+    }
 
     // initializes all the buffer objects/arrays
-    void setupMesh()
+    void setupMesh(const Vertex *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount)
     {
+        this->vertexCount = (unsigned int)vertexCount;
+        this->indexCount = (unsigned int)indexCount;
+
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
@@ -109,10 +250,10 @@ private:
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertexData, GL_STATIC_DRAW);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indexData, GL_STATIC_DRAW);
 
         // set the vertex attribute pointers
         // vertex Positions
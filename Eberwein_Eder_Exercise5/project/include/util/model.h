@@ -12,6 +12,8 @@
 #include <assimp/postprocess.h>
 
 #include <util/mesh.h>
+#include <util/meshcache.h>
+#include <util/meshopt.h>
 #include <util/shader.h>
 
 #include <string>
@@ -19,11 +21,23 @@
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <utility>
 #include <vector>
 using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+size_t TextureBytes(unsigned int id, GLenum target = GL_TEXTURE_2D);
 
+// CPU side data of a model, imported without an OpenGL context (e.g. on a worker thread), see Model::Import
+struct ModelData
+{
+    string directory;
+    vector<MeshData> meshes;
+};
+
+// Model with its meshes on the GPU, move-only like its meshes: share it with a ModelPtr (e.g. from the AssetManager).
+// The model owns its textures and instance buffer, the destructor deletes them.
 class Model 
 {
 public:
@@ -33,42 +47,192 @@ public:
     string directory;
     bool gammaCorrection;
     bool loadTexturesFromModel;
+    Mesh_Retention retention; // what the meshes keep on the CPU after the upload
 
     // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool loadTextures = false, bool gamma = false) : gammaCorrection(gamma), loadTexturesFromModel(loadTextures)
+    Model(string const &path, bool loadTextures = false, bool gamma = false, Mesh_Retention retention = RETAIN_NONE)
+        : gammaCorrection(gamma), loadTexturesFromModel(loadTextures), retention(retention)
     {
         loadModel(path);
     }
 
+    // model of imported data without any meshes yet, they are uploaded by AddMesh (e.g. a few per frame)
+    Model(const ModelData &data, bool loadTextures = false, bool gamma = false, Mesh_Retention retention = RETAIN_NONE)
+        : directory(data.directory), gammaCorrection(gamma), loadTexturesFromModel(loadTextures), retention(retention)
+    {
+    }
+
+    Model(const Model &) = delete;
+    Model &operator=(const Model &) = delete;
+    // the moved-from model keeps no OpenGL objects, its destructor deletes nothing
+    Model(Model &&other) noexcept
+        : textures_loaded(std::move(other.textures_loaded)), meshes(std::move(other.meshes)), directory(std::move(other.directory)),
+          gammaCorrection(other.gammaCorrection), loadTexturesFromModel(other.loadTexturesFromModel), retention(other.retention),
+          instanceVBO(std::exchange(other.instanceVBO, 0)), instanceBytes(std::exchange(other.instanceBytes, 0))
+    {
+        other.textures_loaded.clear();
+        other.meshes.clear();
+    }
+    Model &operator=(Model &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            textures_loaded = std::move(other.textures_loaded);
+            meshes = std::move(other.meshes);
+            directory = std::move(other.directory);
+            gammaCorrection = other.gammaCorrection;
+            loadTexturesFromModel = other.loadTexturesFromModel;
+            retention = other.retention;
+            instanceVBO = std::exchange(other.instanceVBO, 0);
+            instanceBytes = std::exchange(other.instanceBytes, 0);
+            other.textures_loaded.clear();
+            other.meshes.clear();
+        }
+        return *this;
+    }
+    ~Model() { release(); }
+
+    // imports the meshes of a model file (from the mesh cache if it is up to date), needs no OpenGL context
+    static ModelData Import(string const &path)
+    {
+        ModelData data;
+        data.directory = path.substr(0, path.find_last_of('/'));
+        MeshCache cache;
+        if (cache.Open(path))
+        {
+            data.meshes.resize(cache.MeshCount());
+            for (size_t i = 0; i < cache.MeshCount(); i++)
+            {
+                data.meshes[i].vertices.assign(cache.Vertices(i), cache.Vertices(i) + cache.VertexCount(i));
+                data.meshes[i].indices.assign(cache.Indices(i), cache.Indices(i) + cache.IndexCount(i));
+                data.meshes[i].textures = cache.Textures(i);
+            }
+        }
+        else
+            importFile(path, data.meshes);
+        return data;
+    }
+
+    // uploads a mesh of imported data
+    void AddMesh(const MeshData &mesh)
+    {
+        meshes.push_back(Mesh(mesh.vertices.data(), mesh.vertices.size(), mesh.indices.data(), mesh.indices.size(), loadTextures(mesh.textures), retention));
+    }
+
     // draws the model, and thus all its meshes
-    void Draw(Shader shader)
+    void Draw(Shader &shader)
     {
         for(unsigned int i = 0; i < meshes.size(); i++)
             meshes[i].Draw(shader);
     }
+
+    // draws all meshes of the model once per model matrix with a single instanced draw call per mesh,
+    // the matrices are the per-instance attributes 5 to 8 of the vertex shader (layout (location = 5) in mat4)
+    void DrawInstanced(Shader &shader, const glm::mat4 *models, unsigned int count)
+    {
+        if (count == 0)
+            return;
+        if (instanceVBO == 0)
+            glGenBuffers(1, &instanceVBO);
+        // orphan the buffer, the matrices of the previous frame may still be in use
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+        instanceBytes = count * sizeof(glm::mat4);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(glm::mat4), models);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].DrawInstanced(shader, instanceVBO, count);
+    }
+    void DrawInstanced(Shader &shader, const vector<glm::mat4> &models)
+    {
+        DrawInstanced(shader, models.data(), (unsigned int)models.size());
+    }
+
+    // memory of the vertices and indices the meshes keep on the CPU
+    size_t CpuBytes() const
+    {
+        size_t bytes = 0;
+        for (const Mesh &mesh : meshes)
+            bytes += mesh.CpuBytes();
+        return bytes;
+    }
+
+    // memory of the mesh buffers and the textures of the model on the GPU
+    size_t GpuBytes() const
+    {
+        size_t bytes = instanceBytes;
+        for (const Mesh &mesh : meshes)
+            bytes += mesh.GpuBytes();
+        for (const Texture &texture : textures_loaded)
+            bytes += TextureBytes(texture.id);
+        return bytes;
+    }
     
 private:
+    unsigned int instanceVBO = 0; // per-instance model matrices of DrawInstanced
+    size_t instanceBytes = 0;
+
+    // deletes the meshes, the textures and the instance buffer
+    void release()
+    {
+        meshes.clear();
+        if (HasCurrentContext())
+        {
+            for (const Texture &texture : textures_loaded)
+                glDeleteTextures(1, &texture.id);
+            if (instanceVBO)
+                glDeleteBuffers(1, &instanceVBO);
+        }
+        textures_loaded.clear();
+        instanceVBO = 0;
+        instanceBytes = 0;
+    }
+
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    // The imported meshes are written to a binary cache next to the file, later loads map the cache instead.
     void loadModel(string const &path)
     {
-        // read file via ASSIMP
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+
+        MeshCache cache;
+        if (cache.Open(path))
+        {
+            // the vertex and index arrays are uploaded straight from the mapped file
+            for (size_t i = 0; i < cache.MeshCount(); i++)
+                meshes.push_back(Mesh(cache.Vertices(i), cache.VertexCount(i), cache.Indices(i), cache.IndexCount(i), loadTextures(cache.Textures(i)), retention));
+            return;
+        }
+
+        vector<MeshData> data;
+        importFile(path, data);
+        for (MeshData &mesh : data)
+            AddMesh(mesh);
+    }
+
+    // imports the meshes of a model file via ASSIMP, optimizes them and writes them to the mesh cache
+    static void importFile(string const &path, vector<MeshData> &data)
+    {
+        // read file via ASSIMP, identical vertices are joined (OBJ files are not indexed otherwise)
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace | aiProcess_JoinIdenticalVertices);
         // check for errors
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
             return;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
 
         // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        processNode(scene->mRootNode, scene, data);
+        // vertex cache, overdraw and vertex fetch order, the cache stores the optimized meshes
+        MeshOptimizer::Optimize(data, path);
+        MeshCache::Write(path, data);
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+    static void processNode(aiNode *node, const aiScene *scene, vector<MeshData> &data)
     {
         // process each mesh located at the current node
         for(unsigned int i = 0; i < node->mNumMeshes; i++)
@@ -76,22 +240,23 @@ private:
             // the node object only contains indices to index the actual objects in the scene. 
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            data.push_back(processMesh(mesh, scene));
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for(unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, data);
         }
 
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    static MeshData processMesh(aiMesh *mesh, const aiScene *scene)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        MeshData data;
+        vector<Vertex> &vertices = data.vertices;
+        vector<unsigned int> &indices = data.indices;
+        vector<Texture> &textures = data.textures;
 
         // walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -148,41 +313,50 @@ private:
         // diffuse: texture_diffuseN
         // specular: texture_specularN
         // normal: texture_normalN
+        // the references are kept in the cache, whether the textures are loaded is decided by loadTextures
 
-        if (loadTexturesFromModel)
-        {
-            // 1. diffuse maps
-            vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-            textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-            // 2. specular maps
-            vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-            textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-            // 3. normal maps
-            std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-            textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
-            // 4. height maps
-            std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-            textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-        }
-        
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // 1. diffuse maps
+        materialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", textures);
+        // 2. specular maps
+        materialTextures(material, aiTextureType_SPECULAR, "texture_specular", textures);
+        // 3. normal maps
+        materialTextures(material, aiTextureType_HEIGHT, "texture_normal", textures);
+        // 4. height maps
+        materialTextures(material, aiTextureType_AMBIENT, "texture_height", textures);
+
+        // return the extracted mesh data
+        return data;
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+    // appends the references (type and path) of all material textures of a given type
+    static void materialTextures(aiMaterial *mat, aiTextureType type, string typeName, vector<Texture> &textures)
     {
-        vector<Texture> textures;
         for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
+            Texture texture;
+            texture.id = 0;
+            texture.type = typeName;
+            texture.path = str.C_Str();
+            textures.push_back(texture);
+        }
+    }
+
+    // loads the referenced textures if they're not loaded yet (and if the textures of the model are used at all).
+    // the required info is returned as Texture structs.
+    vector<Texture> loadTextures(const vector<Texture> &references)
+    {
+        vector<Texture> textures;
+        if (!loadTexturesFromModel)
+            return textures;
+        for (const Texture &reference : references)
+        {
             // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
             bool skip = false;
             for(unsigned int j = 0; j < textures_loaded.size(); j++)
             {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
+                if(textures_loaded[j].path == reference.path)
                 {
                     textures.push_back(textures_loaded[j]);
                     skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
@@ -191,10 +365,8 @@ private:
             }
             if(!skip)
             {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
+                Texture texture = reference;
+                texture.id = TextureFromFile(reference.path.c_str(), this->directory);
                 textures.push_back(texture);
                 textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
             }
@@ -203,6 +375,8 @@ private:
     }
 };
 
+// shared handle of a model, copies are O(1) and the meshes exist once
+typedef std::shared_ptr<Model> ModelPtr;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
 {
@@ -243,4 +417,33 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
 
     return textureID;
 }
+
+// GPU memory of a texture (all mip levels, all faces of a cube map), queried from OpenGL
+size_t TextureBytes(unsigned int id, GLenum target)
+{
+    if (id == 0)
+        return 0;
+    GLint previous = 0;
+    glGetIntegerv(target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_BINDING_CUBE_MAP : GL_TEXTURE_BINDING_2D, &previous);
+    glBindTexture(target, id);
+    GLenum level0 = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+    size_t bytes = 0;
+    for (GLint level = 0; level < 16; level++)
+    {
+        GLint width = 0, height = 0, bits = 0, size = 0;
+        glGetTexLevelParameteriv(level0, level, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(level0, level, GL_TEXTURE_HEIGHT, &height);
+        if (width == 0 || height == 0) // no more levels
+            break;
+        const GLenum SIZES[] = {GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE, GL_TEXTURE_ALPHA_SIZE, GL_TEXTURE_DEPTH_SIZE, GL_TEXTURE_STENCIL_SIZE};
+        for (GLenum component : SIZES)
+        {
+            glGetTexLevelParameteriv(level0, level, component, &size);
+            bits += size;
+        }
+        bytes += (size_t)width * height * ((bits + 7) / 8);
+    }
+    glBindTexture(target, previous);
+    return target == GL_TEXTURE_CUBE_MAP ? bytes * 6 : bytes;
+}
 #endif
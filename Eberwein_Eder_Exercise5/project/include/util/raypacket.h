@@ -0,0 +1,327 @@
+#pragma once
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+
+#include <glm/glm.hpp>
+
+#include <util/rtscene.h>
+#include <util/simd.h>
+
+#include <algorithm>
+#include <cmath>
+
+// Ray packet versions of the intersection routines of raytracing.fs.glsl and raytracing_multisample.fs.glsl.
+// A packet holds RT_SIMD_WIDTH rays in structure of arrays layout (SimdVec3, util/simd.h) and every function
+// intersects all of them with one shape at once. Branches of the scalar code become masks: all lanes compute
+// both sides and Select() keeps the valid one, lanes that are done (or were never active) return RT_INFINITY.
+// The order of operations follows the scalar functions in util/raytracer.h, so the results match them.
+struct RayPacketKernels
+{
+    // ------------------------------------------------------------------------
+    // PLANE (grid floor of raytracing.fs.glsl)
+    // ------------------------------------------------------------------------
+    // Intersect the plane y = 0, floorColor is the grid pattern (0 on the lines, 1 in the cells).
+    static SimdFloat rayGridFloorIntersection(const SimdVec3 &ro, const SimdVec3 &rd, SimdFloat &floorColor)
+    {
+        SimdFloat t = -ro.y / rd.y;
+        SimdMask hit = (Abs(rd.y) >= SimdFloat(RT_EPSILON)) & (t >= SimdFloat(RT_EPSILON));
+        SimdVec3 hitPos = ro + rd * t;
+
+        // glm::mod(x, 1) = x - floor(x)
+        SimdFloat modX = hitPos.x - Floor(hitPos.x);
+        SimdFloat modZ = hitPos.z - Floor(hitPos.z);
+        SimdFloat one(1.0f);
+        SimdFloat distToLine = Min(modX, one - modX);
+        distToLine = Min(distToLine, Min(modZ, one - modZ));
+        floorColor = Select(distToLine < SimdFloat(0.05f), SimdFloat(0.0f), one);
+        return Select(hit, t, SimdFloat(RT_INFINITY));
+    }
+
+    // ------------------------------------------------------------------------
+    // BOUNDING VOLUMES
+    // ------------------------------------------------------------------------
+    // lanes that hit the sphere within [0, tMax], with the clamped entry and exit distances
+    static SimdMask intersectBoundingSphere(const SimdVec3 &ro, const SimdVec3 &rd, const glm::vec3 &center, float radius,
+                                           const SimdFloat &tMax, SimdFloat &tEnter, SimdFloat &tExit)
+    {
+        SimdVec3 oc = ro - SimdVec3(center.x, center.y, center.z);
+        SimdFloat b = Dot(oc, rd);
+        SimdFloat h = b * b - Dot(oc, oc) + SimdFloat(radius * radius);
+        SimdMask hit = h >= SimdFloat(0.0f);
+        h = Sqrt(Max(h, SimdFloat(0.0f)));
+        tEnter = Max(-b - h, SimdFloat(0.0f));
+        tExit = Min(-b + h, tMax);
+        return hit & (tEnter <= tExit) & (tExit >= SimdFloat(RT_EPSILON));
+    }
+
+    // slab test, entry distance or RT_INFINITY if the box is missed or farther than tMax
+    static SimdFloat intersectBox(const SimdVec3 &ro, const SimdVec3 &invRd, const glm::vec3 &boxMin, const glm::vec3 &boxMax,
+                                  const SimdFloat &tMax)
+    {
+        SimdFloat t0x = (SimdFloat(boxMin.x) - ro.x) * invRd.x, t1x = (SimdFloat(boxMax.x) - ro.x) * invRd.x;
+        SimdFloat t0y = (SimdFloat(boxMin.y) - ro.y) * invRd.y, t1y = (SimdFloat(boxMax.y) - ro.y) * invRd.y;
+        SimdFloat t0z = (SimdFloat(boxMin.z) - ro.z) * invRd.z, t1z = (SimdFloat(boxMax.z) - ro.z) * invRd.z;
+        SimdFloat tEnter = Max(Max(Min(t0x, t1x), Min(t0y, t1y)), Max(Min(t0z, t1z), SimdFloat(0.0f)));
+        SimdFloat tExit = Min(Min(Max(t0x, t1x), Max(t0y, t1y)), Min(Max(t0z, t1z), tMax));
+        return Select(tEnter <= tExit, tEnter, SimdFloat(RT_INFINITY));
+    }
+
+    // 1 / rd without infinities
+    static SimdVec3 safeInverse(const SimdVec3 &rd)
+    {
+        SimdFloat one(1.0f), tiny(1e-8f);
+        return SimdVec3(one / Select(Abs(rd.x) > tiny, rd.x, tiny),
+                        one / Select(Abs(rd.y) > tiny, rd.y, tiny),
+                        one / Select(Abs(rd.z) > tiny, rd.z, tiny));
+    }
+
+    // ------------------------------------------------------------------------
+    // SPHERE (centered at the origin, in object space)
+    // ------------------------------------------------------------------------
+    static SimdFloat intersectSphere(const SimdVec3 &ro, const SimdVec3 &rd, float radius)
+    {
+        SimdFloat b = Dot(ro, rd);
+        SimdFloat h = b * b - Dot(ro, ro) + SimdFloat(radius * radius);
+        SimdMask hit = h >= SimdFloat(0.0f);
+        h = Sqrt(Max(h, SimdFloat(0.0f)));
+        SimdFloat t = -b - h;
+        t = Select(t < SimdFloat(RT_EPSILON), -b + h, t);
+        return Select(hit & (t >= SimdFloat(RT_EPSILON)), t, SimdFloat(RT_INFINITY));
+    }
+
+    // ------------------------------------------------------------------------
+    // TORUS (around the y-axis through the origin, in object space)
+    // ------------------------------------------------------------------------
+    static SimdFloat sdTorus(const SimdVec3 &p, float R, float r)
+    {
+        SimdFloat qx = Sqrt(p.x * p.x + p.z * p.z) - SimdFloat(R);
+        return Sqrt(qx * qx + p.y * p.y) - SimdFloat(r);
+    }
+
+    // Sphere tracing between tStart and tEnd. Every lane stops on its own, the packet
+    // keeps stepping as long as one of the lanes in active is still marching.
+    static SimdFloat intersectTorus(const SimdVec3 &ro, const SimdVec3 &rd, float R, float r,
+                                    const SimdFloat &tStart, const SimdFloat &tEnd, SimdMask active)
+    {
+        const int MAX_STEPS = 128;
+        SimdFloat tMax = Min(tEnd, SimdFloat(100.0f));
+        SimdFloat t = tStart;
+        SimdFloat result(RT_INFINITY);
+        for (int i = 0; i < MAX_STEPS && active.Any(); i++)
+        {
+            SimdFloat d = sdTorus(ro + rd * t, R, r);
+            SimdMask hit = active & (d < SimdFloat(RT_EPSILON));
+            result = Select(hit, t, result);
+            active = AndNot(active, hit);
+            t = Select(active, t + d, t);
+            active = AndNot(active, t > tMax);
+        }
+        return result;
+    }
+
+    // largest real root of m^3 + a*m^2 + b*m + c = 0 (see Raytracer::solveCubicLargest), the cube roots
+    // and the trigonometric branch have no SIMD instruction and run lane by lane, only where needed
+    static SimdFloat solveCubicLargest(const SimdFloat &a, const SimdFloat &b, const SimdFloat &c)
+    {
+        SimdFloat p = b - a * a / SimdFloat(3.0f);
+        SimdFloat q = SimdFloat(2.0f) * a * a * a / SimdFloat(27.0f) - a * b / SimdFloat(3.0f) + c;
+        SimdFloat disc = q * q / SimdFloat(4.0f) + p * p * p / SimdFloat(27.0f);
+        SimdMask oneRoot = disc > SimdFloat(0.0f);
+        SimdFloat z(0.0f);
+        if (oneRoot.Any())
+        {
+            SimdFloat s = Sqrt(Max(disc, SimdFloat(0.0f)));
+            SimdFloat halfQ = -q / SimdFloat(2.0f);
+            auto cbrt = [](float x)
+            { return std::cbrt(x); };
+            z = Lanewise(halfQ + s, cbrt) + Lanewise(halfQ - s, cbrt);
+        }
+        if (!oneRoot.All())
+        {
+            SimdFloat rho = Sqrt(Max(-p / SimdFloat(3.0f), SimdFloat(0.0f)));
+            SimdFloat cosPhi = Min(Max(-q / (SimdFloat(2.0f) * rho * rho * rho), SimdFloat(-1.0f)), SimdFloat(1.0f));
+            cosPhi = Select(rho > SimdFloat(0.0f), cosPhi, SimdFloat(0.0f));
+            SimdFloat z3 = SimdFloat(2.0f) * rho * Lanewise(cosPhi, [](float x)
+                                                             { return std::cos(std::acos(x) / 3.0f); });
+            z = Select(oneRoot, z, z3);
+        }
+        return z - a / SimdFloat(3.0f);
+    }
+
+    // Real roots of x^4 + b*x^3 + c*x^2 + d*x + e = 0 (Ferrari's method, see Raytracer::solveQuartic).
+    // Every lane has four root slots, valid marks the slots that hold a root.
+    static void solveQuartic(const SimdFloat &b, const SimdFloat &c, const SimdFloat &d, const SimdFloat &e,
+                             SimdFloat roots[4], SimdMask valid[4])
+    {
+        SimdFloat zero(0.0f), two(2.0f), four(4.0f);
+        SimdFloat shift = b / four;
+        SimdFloat b2 = b * b;
+        SimdFloat p = c - SimdFloat(3.0f) * b2 / SimdFloat(8.0f);
+        SimdFloat q = d - b * c / two + b2 * b / SimdFloat(8.0f);
+        SimdFloat r = e - b * d / four + b2 * c / SimdFloat(16.0f) - SimdFloat(3.0f) * b2 * b2 / SimdFloat(256.0f);
+
+        SimdFloat m = Max(solveCubicLargest(p, p * p / four - r, -q * q / SimdFloat(8.0f)), zero);
+        SimdMask biquadratic = m < SimdFloat(1e-10f);
+
+        // y^2 -+ s*y + (p/2 + m +- q/(2s)) = 0
+        SimdFloat s = Sqrt(two * m);
+        for (int k = 0; k < 2; k++)
+        {
+            SimdFloat qb = k == 0 ? -s : s;
+            SimdFloat qc = k == 0 ? p / two + m + q / (two * s) : p / two + m - q / (two * s);
+            SimdFloat h = qb * qb / four - qc;
+            SimdMask real = AndNot(h >= zero, biquadratic);
+            h = Sqrt(Max(h, zero));
+            roots[2 * k] = -qb / two - h - shift;
+            roots[2 * k + 1] = -qb / two + h - shift;
+            valid[2 * k] = real;
+            valid[2 * k + 1] = real;
+        }
+        if (biquadratic.None())
+            return;
+
+        // y^4 + p*y^2 + r = 0
+        SimdFloat h = p * p / four - r;
+        SimdMask real = biquadratic & (h >= zero);
+        h = Sqrt(Max(h, zero));
+        for (int k = 0; k < 2; k++)
+        {
+            SimdFloat y2 = k == 0 ? -p / two - h : -p / two + h;
+            SimdMask ok = real & (y2 >= zero);
+            SimdFloat y = Sqrt(Max(y2, zero));
+            roots[2 * k] = Select(biquadratic, -y - shift, roots[2 * k]);
+            roots[2 * k + 1] = Select(biquadratic, y - shift, roots[2 * k + 1]);
+            valid[2 * k] |= ok;
+            valid[2 * k + 1] |= ok;
+        }
+    }
+
+    // closed-form ray/torus intersection with the ray origins moved to tStart (see Raytracer::intersectTorusAnalytic)
+    static SimdFloat intersectTorusAnalytic(const SimdVec3 &ro, const SimdVec3 &rd, float R, float r, const SimdFloat &tStart)
+    {
+        SimdFloat t0 = tStart;
+        SimdVec3 o = ro + rd * t0;
+
+        float R2 = R * R;
+        SimdFloat k = Dot(o, o) + SimdFloat(R2) - SimdFloat(r * r);
+        SimdFloat a = Dot(o, rd);
+        SimdFloat c3 = SimdFloat(4.0f) * a;
+        SimdFloat c2 = SimdFloat(4.0f) * a * a + SimdFloat(2.0f) * k - SimdFloat(4.0f * R2) * (rd.x * rd.x + rd.z * rd.z);
+        SimdFloat c1 = SimdFloat(4.0f) * a * k - SimdFloat(8.0f * R2) * (o.x * rd.x + o.z * rd.z);
+        SimdFloat c0 = k * k - SimdFloat(4.0f * R2) * (o.x * o.x + o.z * o.z);
+
+        SimdFloat roots[4];
+        SimdMask valid[4];
+        solveQuartic(c3, c2, c1, c0, roots, valid);
+        SimdFloat tHit(RT_INFINITY);
+        for (int i = 0; i < 4; i++)
+        {
+            if (valid[i].None())
+                continue;
+            SimdFloat t = roots[i];
+            for (int j = 0; j < 2; j++)
+            {
+                SimdFloat f = (((t + c3) * t + c2) * t + c1) * t + c0;
+                SimdFloat df = ((SimdFloat(4.0f) * t + SimdFloat(3.0f) * c3) * t + SimdFloat(2.0f) * c2) * t + c1;
+                t = Select(df != SimdFloat(0.0f), t - f / df, t);
+            }
+            SimdFloat tWorld = t0 + t;
+            tHit = Select(valid[i] & (tWorld > SimdFloat(RT_EPSILON)), Min(tHit, tWorld), tHit);
+        }
+        return tHit;
+    }
+
+    // ------------------------------------------------------------------------
+    // CYLINDER (capped, standing on baseCenter, raytracing_multisample.fs.glsl)
+    // ------------------------------------------------------------------------
+    // scalar reference, a direct port of intersectCylinder() in raytracing_multisample.fs.glsl
+    // hitType: 0 = miss, 1 = side, 2 = bottom cap, 3 = top cap
+    static float intersectCylinder(const glm::vec3 &ro, const glm::vec3 &rd, const glm::vec3 &baseCenter, float radius, float height,
+                                   int &hitType)
+    {
+        glm::vec3 oc = ro - baseCenter;
+        float tCylinder = RT_INFINITY;
+        hitType = 0;
+        float a = rd.x * rd.x + rd.z * rd.z;
+        float b = 2.0f * (oc.x * rd.x + oc.z * rd.z);
+        float c = oc.x * oc.x + oc.z * oc.z - radius * radius;
+        if (a > RT_EPSILON)
+        {
+            float disc = b * b - 4.0f * a * c;
+            if (disc > 0.0f)
+            {
+                float sqrtDisc = std::sqrt(disc);
+                float t0 = (-b - sqrtDisc) / (2.0f * a);
+                float t1 = (-b + sqrtDisc) / (2.0f * a);
+                float tCandidate = t0;
+                if (tCandidate < RT_EPSILON)
+                    tCandidate = t1;
+                if (tCandidate > RT_EPSILON)
+                {
+                    float y = oc.y + tCandidate * rd.y;
+                    if (y >= 0.0f && y <= height)
+                    {
+                        tCylinder = tCandidate;
+                        hitType = 1;
+                    }
+                }
+            }
+        }
+        if (std::abs(rd.y) > RT_EPSILON)
+        {
+            for (int cap = 0; cap < 2; cap++)
+            {
+                float tCap = ((cap == 0 ? 0.0f : height) - oc.y) / rd.y;
+                if (tCap > RT_EPSILON)
+                {
+                    glm::vec3 hitPos = oc + tCap * rd;
+                    if (hitPos.x * hitPos.x + hitPos.z * hitPos.z <= radius * radius && tCap < tCylinder)
+                    {
+                        tCylinder = tCap;
+                        hitType = 2 + cap;
+                    }
+                }
+            }
+        }
+        return tCylinder;
+    }
+
+    static SimdFloat intersectCylinder(const SimdVec3 &ro, const SimdVec3 &rd, const glm::vec3 &baseCenter, float radius, float height,
+                                       SimdFloat &hitType)
+    {
+        SimdFloat zero(0.0f), eps(RT_EPSILON);
+        SimdVec3 oc = ro - SimdVec3(baseCenter.x, baseCenter.y, baseCenter.z);
+        SimdFloat tCylinder(RT_INFINITY);
+        hitType = zero;
+
+        // side
+        SimdFloat a = rd.x * rd.x + rd.z * rd.z;
+        SimdFloat b = SimdFloat(2.0f) * (oc.x * rd.x + oc.z * rd.z);
+        SimdFloat c = oc.x * oc.x + oc.z * oc.z - SimdFloat(radius * radius);
+        SimdFloat disc = b * b - SimdFloat(4.0f) * a * c;
+        SimdMask side = (a > eps) & (disc > zero);
+        SimdFloat sqrtDisc = Sqrt(Max(disc, zero));
+        SimdFloat t0 = (-b - sqrtDisc) / (SimdFloat(2.0f) * a);
+        SimdFloat t1 = (-b + sqrtDisc) / (SimdFloat(2.0f) * a);
+        SimdFloat tCandidate = Select(t0 < eps, t1, t0);
+        SimdFloat y = oc.y + tCandidate * rd.y;
+        side = side & (tCandidate > eps) & (y >= zero) & (y <= SimdFloat(height));
+        tCylinder = Select(side, tCandidate, tCylinder);
+        hitType = Select(side, SimdFloat(1.0f), hitType);
+
+        // caps
+        SimdMask notParallel = Abs(rd.y) > eps;
+        for (int cap = 0; cap < 2; cap++)
+        {
+            SimdFloat tCap = (SimdFloat(cap == 0 ? 0.0f : height) - oc.y) / rd.y;
+            SimdVec3 hitPos = oc + rd * tCap;
+            SimdMask hit = notParallel & (tCap > eps) & (hitPos.x * hitPos.x + hitPos.z * hitPos.z <= SimdFloat(radius * radius)) &
+                           (tCap < tCylinder);
+            tCylinder = Select(hit, tCap, tCylinder);
+            hitType = Select(hit, SimdFloat(2.0f + cap), hitType);
+        }
+        return tCylinder;
+    }
+};
+
+#endif
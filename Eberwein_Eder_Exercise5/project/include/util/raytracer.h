@@ -0,0 +1,993 @@
+#pragma once
+#ifndef RAYTRACER_H
+#define RAYTRACER_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <util/bvh.h>
+#include <util/raypacket.h>
+#include <util/rtscene.h>
+#include <util/threadpool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// CPU port of src/13-raytracing-solution/raytracing.fs.glsl.
+// The functions below mirror their GLSL counterparts one by one (same names, same constants and the same
+// order of operations), so the output can be diffed against the GPU image and both can be changed side by side.
+// With usePackets the tiles are traced in packets of RT_SIMD_WIDTH rays (util/raypacket.h) instead of ray by ray.
+
+// linear RGB image, stored top row first
+struct RaytracingImage
+{
+    int width = 0;
+    int height = 0;
+    std::vector<glm::vec3> pixels;
+
+    void Resize(int w, int h)
+    {
+        width = w;
+        height = h;
+        pixels.assign((size_t)w * h, glm::vec3(0.0f));
+    }
+
+    // 8 bit RGB, clamped like the default framebuffer does
+    std::vector<unsigned char> ToRGB8() const
+    {
+        std::vector<unsigned char> rgb(pixels.size() * 3);
+        for (size_t i = 0; i < pixels.size(); i++)
+            for (int c = 0; c < 3; c++)
+                rgb[i * 3 + c] = (unsigned char)std::lround(glm::clamp(pixels[i][c], 0.0f, 1.0f) * 255.0f);
+        return rgb;
+    }
+};
+
+class Raytracer
+{
+public:
+    int maxDepth = 3;
+    int tileSize = 16;
+    bool analyticTorus = true; // closed-form quartic instead of sphere tracing (uniform analyticTorus in GLSL)
+    bool useBVH = true;        // traverse the BVH instead of testing every primitive (uniform useBVH in GLSL)
+    bool accumulate = false;   // progressive accumulation: jittered samples and soft shadows (uniform accumulate in GLSL)
+    float lightSize = 0.1f;    // radius of the spherical light, only sampled while accumulating
+    bool usePackets = false;   // trace RT_SIMD_WIDTH neighboring pixels at once (SSE/AVX2, see util/simd.h)
+
+    Raytracer(const RaytracingScene &scene) { SetScene(scene); }
+
+    // build the BVH and pack the scene in its leaf order, the same way raytracing.cpp uploads it
+    void SetScene(const RaytracingScene &scene)
+    {
+        m_lightPosition = scene.lightPosition;
+        m_bvh.Build(scene);
+        m_primitives = scene.Pack(m_bvh.primitiveOrder);
+        m_numPrimitives = (int)scene.primitives.size();
+    }
+
+    const BVH &GetBVH() const { return m_bvh; }
+
+    // number of rays (primary, reflected and shadow rays) traced since the last ResetRayCount()
+    unsigned long long GetRayCount() const { return m_rayCount; }
+    void ResetRayCount() { m_rayCount = 0; }
+
+    // render the image with the same camera setup as raytracing.vs.glsl.
+    // The image is split into tiles, which are distributed over the thread pool.
+    // With accumulate, frameIndex > 0 adds one more sample to the average already in the image.
+    // ------------------------------------------------------------------------
+    void Render(const glm::mat4 &projection, const glm::mat4 &view, const glm::vec3 &camPos, RaytracingImage &image, ThreadPool &pool,
+                int frameIndex = 0)
+    {
+        // the vertex shader un-projects the corners of the full-screen quad (z = 0 in NDC) and
+        // interpolates the ray direction; for a perspective projection this is the same as
+        // un-projecting every fragment center directly.
+        glm::mat4 invViewProj = glm::inverse(projection * view);
+
+        for (int ty = 0; ty < image.height; ty += tileSize)
+        {
+            for (int tx = 0; tx < image.width; tx += tileSize)
+            {
+                pool.Submit([this, &image, invViewProj, camPos, tx, ty, frameIndex]()
+                            {
+                                if (usePackets)
+                                    renderTilePacket(image, invViewProj, camPos, tx, ty, frameIndex);
+                                else
+                                    renderTile(image, invViewProj, camPos, tx, ty, frameIndex);
+                            });
+            }
+        }
+        pool.Wait();
+    }
+
+    // ------------------------------------------------------------------------
+    // RANDOM NUMBERS
+    // ------------------------------------------------------------------------
+    static uint32_t pcgHash(uint32_t v)
+    {
+        uint32_t state = v * 747796405u + 2891336453u;
+        uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return (word >> 22u) ^ word;
+    }
+
+    // uniform in [0, 1)
+    static float random(uint32_t &rngState)
+    {
+        rngState = pcgHash(rngState);
+        return (float)(rngState >> 8u) / 16777216.0f;
+    }
+
+    // uniform point inside the unit sphere
+    static glm::vec3 randomInUnitSphere(uint32_t &rngState)
+    {
+        float z = 2.0f * random(rngState) - 1.0f;
+        float phi = 2.0f * 3.14159265359f * random(rngState);
+        float r = std::sqrt(std::max(1.0f - z * z, 0.0f));
+        glm::vec3 direction = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+        return direction * std::pow(random(rngState), 1.0f / 3.0f);
+    }
+
+    // ------------------------------------------------------------------------
+    // GRID FLOOR
+    // ------------------------------------------------------------------------
+    // Intersect the plane y = 0 and compute a black & white grid pattern.
+    float rayGridFloorIntersection(const glm::vec3 &ro, const glm::vec3 &rd, glm::vec3 &floorColor) const
+    {
+        if (std::abs(rd.y) < RT_EPSILON)
+            return RT_INFINITY;
+        float t = -ro.y / rd.y;
+        if (t < RT_EPSILON)
+            return RT_INFINITY;
+        glm::vec3 hitPos = ro + t * rd;
+
+        float cellSize = 1.0f;
+        float lineWidth = 0.05f;
+        glm::vec2 modPos = glm::mod(glm::vec2(hitPos.x, hitPos.z), cellSize);
+        float distToLine = std::min(modPos.x, cellSize - modPos.x);
+        distToLine = std::min(distToLine, std::min(modPos.y, cellSize - modPos.y));
+
+        if (distToLine < lineWidth)
+            floorColor = glm::vec3(0.0f);
+        else
+            floorColor = glm::vec3(1.0f);
+        return t;
+    }
+
+    // ------------------------------------------------------------------------
+    // BOUNDING VOLUMES
+    // ------------------------------------------------------------------------
+    // Ray/sphere test used as broad phase. Returns false if the sphere is missed or lies completely
+    // outside [0, tMax], otherwise the (clamped) entry and exit distances.
+    static bool intersectBoundingSphere(const glm::vec3 &ro, const glm::vec3 &rd, const glm::vec3 &center, float radius,
+                                        float tMax, float &tEnter, float &tExit)
+    {
+        glm::vec3 oc = ro - center;
+        float b = glm::dot(oc, rd);
+        float h = b * b - glm::dot(oc, oc) + radius * radius;
+        if (h < 0.0f)
+            return false;
+        h = std::sqrt(h);
+        tEnter = std::max(-b - h, 0.0f);
+        tExit = std::min(-b + h, tMax);
+        return tEnter <= tExit && tExit >= RT_EPSILON;
+    }
+
+    // ------------------------------------------------------------------------
+    // TORUS SDF FUNCTIONS & SPHERE TRACING INTERSECTION
+    // ------------------------------------------------------------------------
+    static float sdTorus(const glm::vec3 &p, const glm::vec2 &t)
+    {
+        glm::vec2 q = glm::vec2(glm::length(glm::vec2(p.x, p.z)) - t.x, p.y);
+        return glm::length(q) - t.y;
+    }
+
+    // Sphere tracing between tStart and tEnd (the interval comes from the bounding sphere).
+    static float intersectTorus(const glm::vec3 &ro, const glm::vec3 &rd, const glm::vec3 &torusCenter, float R, float r,
+                                float tStart, float tEnd)
+    {
+        const int MAX_STEPS = 128;
+        const float tMax = std::min(tEnd, 100.0f);
+        float t = tStart;
+        for (int i = 0; i < MAX_STEPS; i++)
+        {
+            glm::vec3 pos = ro + rd * t - torusCenter;
+            float d = sdTorus(pos, glm::vec2(R, r));
+            if (d < RT_EPSILON)
+                return t;
+            t += d;
+            if (t > tMax)
+                break;
+        }
+        return RT_INFINITY;
+    }
+
+    static glm::vec3 getTorusNormal(const glm::vec3 &pos, const glm::vec3 &torusCenter, float R, float r)
+    {
+        float eps = 0.001f;
+        glm::vec3 p = pos - torusCenter;
+        glm::vec3 grad;
+        grad.x = sdTorus(p + glm::vec3(eps, 0.0f, 0.0f), glm::vec2(R, r)) - sdTorus(p - glm::vec3(eps, 0.0f, 0.0f), glm::vec2(R, r));
+        grad.y = sdTorus(p + glm::vec3(0.0f, eps, 0.0f), glm::vec2(R, r)) - sdTorus(p - glm::vec3(0.0f, eps, 0.0f), glm::vec2(R, r));
+        grad.z = sdTorus(p + glm::vec3(0.0f, 0.0f, eps), glm::vec2(R, r)) - sdTorus(p - glm::vec3(0.0f, 0.0f, eps), glm::vec2(R, r));
+        return glm::normalize(grad);
+    }
+
+    // ------------------------------------------------------------------------
+    // ANALYTIC TORUS INTERSECTION
+    // ------------------------------------------------------------------------
+    // Largest real root of m^3 + a*m^2 + b*m + c = 0.
+    static float solveCubicLargest(float a, float b, float c)
+    {
+        float p = b - a * a / 3.0f;
+        float q = 2.0f * a * a * a / 27.0f - a * b / 3.0f + c;
+        float disc = q * q / 4.0f + p * p * p / 27.0f;
+        float z;
+        if (disc > 0.0f)
+        {
+            float s = std::sqrt(disc);
+            z = std::cbrt(-q / 2.0f + s) + std::cbrt(-q / 2.0f - s);
+        }
+        else
+        {
+            // three real roots, the k = 0 branch of the trigonometric solution is the largest one
+            float rho = std::sqrt(std::max(-p / 3.0f, 0.0f));
+            float cosPhi = (rho > 0.0f) ? glm::clamp(-q / (2.0f * rho * rho * rho), -1.0f, 1.0f) : 0.0f;
+            z = 2.0f * rho * std::cos(std::acos(cosPhi) / 3.0f);
+        }
+        return z - a / 3.0f;
+    }
+
+    // Real roots of the monic quartic x^4 + b*x^3 + c*x^2 + d*x + e = 0 (Ferrari's method).
+    // Returns the number of roots written to roots.
+    static int solveQuartic(float b, float c, float d, float e, float roots[4])
+    {
+        // depressed quartic y^4 + p*y^2 + q*y + r = 0 with x = y - b/4
+        float shift = b / 4.0f;
+        float b2 = b * b;
+        float p = c - 3.0f * b2 / 8.0f;
+        float q = d - b * c / 2.0f + b2 * b / 8.0f;
+        float r = e - b * d / 4.0f + b2 * c / 16.0f - 3.0f * b2 * b2 / 256.0f;
+
+        // resolvent cubic m^3 + p*m^2 + (p^2/4 - r)*m - q^2/8 = 0 always has a root m >= 0
+        float m = std::max(solveCubicLargest(p, p * p / 4.0f - r, -q * q / 8.0f), 0.0f);
+
+        int n = 0;
+        auto addQuadratic = [&](float qb, float qc)
+        {
+            // y^2 + qb*y + qc = 0
+            float h = qb * qb / 4.0f - qc;
+            if (h < 0.0f)
+                return;
+            h = std::sqrt(h);
+            roots[n++] = -qb / 2.0f - h - shift;
+            roots[n++] = -qb / 2.0f + h - shift;
+        };
+        if (m < 1e-10f)
+        {
+            // biquadratic: y^4 + p*y^2 + r = 0
+            float h = p * p / 4.0f - r;
+            if (h < 0.0f)
+                return 0;
+            h = std::sqrt(h);
+            for (float y2 : {-p / 2.0f - h, -p / 2.0f + h})
+            {
+                if (y2 < 0.0f)
+                    continue;
+                roots[n++] = -std::sqrt(y2) - shift;
+                roots[n++] = std::sqrt(y2) - shift;
+            }
+            return n;
+        }
+        float s = std::sqrt(2.0f * m);
+        addQuadratic(-s, p / 2.0f + m + q / (2.0f * s));
+        addQuadratic(s, p / 2.0f + m - q / (2.0f * s));
+        return n;
+    }
+
+    // Closed-form ray/torus intersection: solves the quartic
+    //   (|p|^2 + R^2 - r^2)^2 = 4 R^2 (p.x^2 + p.z^2),  p = ro + t * rd
+    // ro is first moved to tStart (the entry into the bounding sphere) to keep the coefficients well conditioned
+    // in single precision, each root is then polished with two Newton steps.
+    static float intersectTorusAnalytic(const glm::vec3 &ro, const glm::vec3 &rd, const glm::vec3 &torusCenter, float R, float r,
+                                        float tStart)
+    {
+        float t0 = tStart;
+        glm::vec3 o = ro - torusCenter + t0 * rd;
+
+        float R2 = R * R;
+        float k = glm::dot(o, o) + R2 - r * r;
+        float a = glm::dot(o, rd);
+        float c3 = 4.0f * a;
+        float c2 = 4.0f * a * a + 2.0f * k - 4.0f * R2 * (rd.x * rd.x + rd.z * rd.z);
+        float c1 = 4.0f * a * k - 8.0f * R2 * (o.x * rd.x + o.z * rd.z);
+        float c0 = k * k - 4.0f * R2 * (o.x * o.x + o.z * o.z);
+
+        float roots[4];
+        int n = solveQuartic(c3, c2, c1, c0, roots);
+        float tHit = RT_INFINITY;
+        for (int i = 0; i < n; i++)
+        {
+            float t = roots[i];
+            for (int j = 0; j < 2; j++)
+            {
+                float f = (((t + c3) * t + c2) * t + c1) * t + c0;
+                float df = ((4.0f * t + 3.0f * c3) * t + 2.0f * c2) * t + c1;
+                if (df != 0.0f)
+                    t -= f / df;
+            }
+            if (t0 + t > RT_EPSILON)
+                tHit = std::min(tHit, t0 + t);
+        }
+        return tHit;
+    }
+
+    // Exact torus normal: the gradient of sdTorus, i.e. the direction from the closest point on the ring to pos.
+    static glm::vec3 getTorusNormalAnalytic(const glm::vec3 &pos, const glm::vec3 &torusCenter, float R)
+    {
+        glm::vec3 p = pos - torusCenter;
+        glm::vec3 ring = glm::normalize(glm::vec3(p.x, 0.0f, p.z)) * R;
+        return glm::normalize(p - ring);
+    }
+
+    // ------------------------------------------------------------------------
+    // SPHERE
+    // ------------------------------------------------------------------------
+    static float intersectSphere(const glm::vec3 &ro, const glm::vec3 &rd, const glm::vec3 &center, float radius)
+    {
+        glm::vec3 oc = ro - center;
+        float b = glm::dot(oc, rd);
+        float h = b * b - glm::dot(oc, oc) + radius * radius;
+        if (h < 0.0f)
+            return RT_INFINITY;
+        h = std::sqrt(h);
+        float t = -b - h;
+        if (t < RT_EPSILON)
+            t = -b + h;
+        return t < RT_EPSILON ? RT_INFINITY : t;
+    }
+
+    // ------------------------------------------------------------------------
+    // PRIMITIVE BUFFER (texelFetch(primitives, ...) in GLSL, see util/rtscene.h for the layout)
+    // ------------------------------------------------------------------------
+    const glm::vec4 &fetchPrimitive(int index, int texel) const
+    {
+        return m_primitives[(size_t)index * RT_PRIMITIVE_TEXELS + texel];
+    }
+
+    glm::vec3 toObjectSpace(int index, const glm::vec3 &v, float w) const
+    {
+        return glm::vec3(glm::dot(glm::vec3(fetchPrimitive(index, 1)), v) + fetchPrimitive(index, 1).w * w,
+                         glm::dot(glm::vec3(fetchPrimitive(index, 2)), v) + fetchPrimitive(index, 2).w * w,
+                         glm::dot(glm::vec3(fetchPrimitive(index, 3)), v) + fetchPrimitive(index, 3).w * w);
+    }
+
+    // Nearest hit of a primitive closer than tMax. Rays missing the bounding sphere never reach the
+    // actual intersection test, and the torus march only runs across the part of the ray inside the sphere.
+    // The ray is moved into object space; the transform is rigid, so t is the same in both spaces.
+    float intersectPrimitive(int index, const glm::vec3 &ro, const glm::vec3 &rd, float tMax) const
+    {
+        glm::vec4 bounds = fetchPrimitive(index, 0);
+        float tEnter, tExit;
+        if (!intersectBoundingSphere(ro, rd, glm::vec3(bounds), bounds.w, tMax, tEnter, tExit))
+            return RT_INFINITY;
+
+        glm::vec3 roObj = toObjectSpace(index, ro, 1.0f);
+        glm::vec3 rdObj = toObjectSpace(index, rd, 0.0f);
+        glm::vec4 shape = fetchPrimitive(index, 4);
+        if ((int)shape.x == PRIM_TORUS)
+            return analyticTorus ? intersectTorusAnalytic(roObj, rdObj, glm::vec3(0.0f), shape.y, shape.z, tEnter)
+                                 : intersectTorus(roObj, rdObj, glm::vec3(0.0f), shape.y, shape.z, tEnter, tExit + RT_EPSILON);
+        return intersectSphere(roObj, rdObj, glm::vec3(0.0f), shape.y);
+    }
+
+    // world space normal of a primitive at the world space position pos
+    glm::vec3 getPrimitiveNormal(int index, const glm::vec3 &pos) const
+    {
+        glm::vec3 p = toObjectSpace(index, pos, 1.0f);
+        glm::vec4 shape = fetchPrimitive(index, 4);
+        glm::vec3 n;
+        if ((int)shape.x == PRIM_TORUS)
+            n = analyticTorus ? getTorusNormalAnalytic(p, glm::vec3(0.0f), shape.y)
+                              : getTorusNormal(p, glm::vec3(0.0f), shape.y, shape.z);
+        else
+            n = glm::normalize(p);
+        // the world-to-object rows are the object-to-world columns
+        return glm::vec3(fetchPrimitive(index, 1)) * n.x + glm::vec3(fetchPrimitive(index, 2)) * n.y +
+               glm::vec3(fetchPrimitive(index, 3)) * n.z;
+    }
+
+    // If the primitive is hit closer than any previous hit, update the hit distance, color, and normal.
+    void addPrimitive(int index, const glm::vec3 &ro, const glm::vec3 &rd,
+                      float &hitDist, glm::vec3 &hitColor, glm::vec3 &hitNormal) const
+    {
+        float t = intersectPrimitive(index, ro, rd, hitDist);
+        if (t < hitDist)
+        {
+            hitNormal = getPrimitiveNormal(index, ro + rd * t);
+            hitDist = t;
+            hitColor = glm::vec3(fetchPrimitive(index, 5));
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    // BVH TRAVERSAL
+    // ------------------------------------------------------------------------
+    // 1 / rd without infinities (the slab test stays well defined for axis parallel rays)
+    static glm::vec3 safeInverse(const glm::vec3 &rd)
+    {
+        return glm::vec3(1.0f / (std::abs(rd.x) > 1e-8f ? rd.x : 1e-8f),
+                         1.0f / (std::abs(rd.y) > 1e-8f ? rd.y : 1e-8f),
+                         1.0f / (std::abs(rd.z) > 1e-8f ? rd.z : 1e-8f));
+    }
+
+    // slab test, returns the entry distance or RT_INFINITY if the box is missed or farther than tMax
+    static float intersectBox(const glm::vec3 &ro, const glm::vec3 &invRd, const glm::vec3 &boxMin, const glm::vec3 &boxMax, float tMax)
+    {
+        glm::vec3 t0 = (boxMin - ro) * invRd;
+        glm::vec3 t1 = (boxMax - ro) * invRd;
+        glm::vec3 tNear = glm::min(t0, t1);
+        glm::vec3 tFar = glm::max(t0, t1);
+        float tEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+        return tEnter <= tExit ? tEnter : RT_INFINITY;
+    }
+
+    // Closest (or with anyHit the first found) primitive hit closer than tMax. The GLSL version walks the
+    // escape links without a stack; here an explicit stack visits the nearer child first, so tMax shrinks early.
+    float intersectBVH(const glm::vec3 &ro, const glm::vec3 &rd, float tMax, bool anyHit, int &hitIndex) const
+    {
+        hitIndex = -1;
+        const std::vector<BVHNode> &nodes = m_bvh.nodes;
+        if (nodes.empty())
+            return RT_INFINITY;
+        glm::vec3 invRd = safeInverse(rd);
+        if (intersectBox(ro, invRd, nodes[0].boxMin, nodes[0].boxMax, tMax) >= RT_INFINITY)
+            return RT_INFINITY;
+
+        const int STACK_SIZE = BVH::MAX_DEPTH; // the build bounds the depth, the stack can't overflow
+        int stack[STACK_SIZE];
+        float stackT[STACK_SIZE];
+        int sp = 0;
+        int node = 0;
+        while (true)
+        {
+            const BVHNode &n = nodes[node];
+            if (BVH::IsLeaf(n))
+            {
+                int first = BVH::FirstPrimitive(n);
+                for (int i = first; i < first + BVH::PrimitiveCount(n); i++)
+                {
+                    float t = intersectPrimitive(i, ro, rd, tMax);
+                    if (t < tMax)
+                    {
+                        tMax = t;
+                        hitIndex = i;
+                        if (anyHit)
+                            return t;
+                    }
+                }
+            }
+            else
+            {
+                int left = node + 1;
+                int right = nodes[left].miss;
+                float tLeft = intersectBox(ro, invRd, nodes[left].boxMin, nodes[left].boxMax, tMax);
+                float tRight = intersectBox(ro, invRd, nodes[right].boxMin, nodes[right].boxMax, tMax);
+                if (tRight < tLeft)
+                {
+                    std::swap(left, right);
+                    std::swap(tLeft, tRight);
+                }
+                if (tLeft < RT_INFINITY)
+                {
+                    if (tRight < RT_INFINITY)
+                    {
+                        assert(sp < STACK_SIZE);
+                        stack[sp] = right;
+                        stackT[sp++] = tRight;
+                    }
+                    node = left;
+                    continue;
+                }
+            }
+
+            // pop the next subtree that can still contain a closer hit
+            node = -1;
+            while (sp > 0 && node < 0)
+            {
+                sp--;
+                if (stackT[sp] < tMax)
+                    node = stack[sp];
+            }
+            if (node < 0)
+                break;
+        }
+        return hitIndex >= 0 ? tMax : RT_INFINITY;
+    }
+
+    // ------------------------------------------------------------------------
+    // SCENE DEFINITION
+    // ------------------------------------------------------------------------
+    float rayTraceScene(const glm::vec3 &ro, const glm::vec3 &rd, glm::vec3 &hitNormal, glm::vec3 &hitColor) const
+    {
+        float hitDist = RT_INFINITY;
+        hitNormal = glm::vec3(0.0f);
+
+        // Grid floor
+        glm::vec3 floorColor;
+        float tFloor = rayGridFloorIntersection(ro, rd, floorColor);
+        if (tFloor < hitDist)
+        {
+            hitDist = tFloor;
+            hitColor = floorColor;
+            hitNormal = glm::vec3(0.0f, 1.0f, 0.0f);
+        }
+
+        if (useBVH)
+        {
+            int hitIndex;
+            float t = intersectBVH(ro, rd, hitDist, false, hitIndex);
+            if (hitIndex >= 0)
+            {
+                hitNormal = getPrimitiveNormal(hitIndex, ro + rd * t);
+                hitDist = t;
+                hitColor = glm::vec3(fetchPrimitive(hitIndex, 5));
+            }
+        }
+        else
+        {
+            for (int i = 0; i < m_numPrimitives; i++)
+                addPrimitive(i, ro, rd, hitDist, hitColor, hitNormal);
+        }
+
+        return hitDist;
+    }
+
+    // Any-hit query for shadow rays: true as soon as some primitive is hit closer than maxDist.
+    // No normal or color is needed and the search stops at the first occluder.
+    bool rayTraceShadow(const glm::vec3 &ro, const glm::vec3 &rd, float maxDist) const
+    {
+        glm::vec3 floorColor;
+        if (rayGridFloorIntersection(ro, rd, floorColor) < maxDist)
+            return true;
+        if (useBVH)
+        {
+            int hitIndex;
+            return intersectBVH(ro, rd, maxDist, true, hitIndex) < maxDist;
+        }
+        for (int i = 0; i < m_numPrimitives; i++)
+            if (intersectPrimitive(i, ro, rd, maxDist) < maxDist)
+                return true;
+        return false;
+    }
+
+    // ------------------------------------------------------------------------
+    // LIGHTING FUNCTIONS
+    // ------------------------------------------------------------------------
+    static float calcFresnel(const glm::vec3 &normal, const glm::vec3 &inRay)
+    {
+        float bias = 0.0f;
+        float cosTheta = glm::clamp(glm::dot(normal, -inRay), 0.0f, 1.0f);
+        return glm::clamp(bias + std::pow(1.0f - cosTheta, 2.0f), 0.0f, 1.0f);
+    }
+
+    glm::vec3 calcLighting(const glm::vec3 &hitPoint, const glm::vec3 &normal, const glm::vec3 &inRay, const glm::vec3 &color,
+                           unsigned long long &rays, uint32_t &rngState) const
+    {
+        // soft shadows: one random point of the light per sample, the accumulation averages them
+        glm::vec3 lightSample = sampleLight(rngState);
+        glm::vec3 lightVec = lightSample - hitPoint;
+        glm::vec3 lightDir = glm::normalize(lightVec);
+        float lightDist = glm::length(lightVec);
+
+        bool inShadow = rayTraceShadow(hitPoint + lightDir * RT_RAY_OFFSET, lightDir, lightDist);
+        rays++;
+        return calcShading(normal, inRay, color, lightDir, inShadow);
+    }
+
+    // the part of calcLighting after the shadow ray (shared with the packet path)
+    static glm::vec3 calcShading(const glm::vec3 &normal, const glm::vec3 &inRay, const glm::vec3 &color, const glm::vec3 &lightDir,
+                                 bool inShadow)
+    {
+        glm::vec3 ambient = glm::vec3(0.1f);
+        if (inShadow)
+            return ambient * color;
+        else
+        {
+            float diff = std::max(glm::dot(normal, lightDir), 0.0f);
+            glm::vec3 h = glm::normalize(-inRay + lightDir);
+            float ndoth = std::max(glm::dot(normal, h), 0.0f);
+            float spec = std::max(std::pow(ndoth, 50.0f), 0.0f);
+            return glm::min((ambient + glm::vec3(diff)) * color + glm::vec3(spec), glm::vec3(1.0f));
+        }
+    }
+
+    // random point of the spherical light (the light position itself without accumulation)
+    glm::vec3 sampleLight(uint32_t &rngState) const
+    {
+        glm::vec3 lightSample = m_lightPosition;
+        if (accumulate)
+            lightSample += lightSize * randomInUnitSphere(rngState);
+        return lightSample;
+    }
+
+    // ------------------------------------------------------------------------
+    // MAIN RAYTRACING LOOP (main() of the fragment shader)
+    // ------------------------------------------------------------------------
+    glm::vec3 trace(glm::vec3 ro, glm::vec3 rd, unsigned long long &rays, uint32_t &rngState) const
+    {
+        glm::vec3 hitColor;
+        glm::vec3 hitNormal;
+
+        float totalWeight = 0.0f;
+        glm::vec3 accumColor = glm::vec3(0.0f);
+
+        // Reflection loop (up to maxDepth bounces)
+        for (int i = 0; i < maxDepth; i++)
+        {
+            float t = rayTraceScene(ro, rd, hitNormal, hitColor);
+            rays++;
+            if (t >= RT_INFINITY)
+                break;
+
+            glm::vec3 hitPoint = ro + t * rd;
+            float fresnel = calcFresnel(hitNormal, rd);
+            float weight = (1.0f - fresnel) * (1.0f - totalWeight);
+            totalWeight += weight;
+            accumColor += calcLighting(hitPoint, hitNormal, rd, hitColor, rays, rngState) * weight;
+
+            // Reflect the ray and offset to avoid self-intersection.
+            rd = glm::reflect(rd, hitNormal);
+            rd = glm::normalize(rd);
+            ro = hitPoint + hitNormal * RT_RAY_OFFSET;
+        }
+
+        if (totalWeight > 0.0f)
+            accumColor /= totalWeight;
+
+        return accumColor;
+    }
+
+    // ------------------------------------------------------------------------
+    // RAY PACKETS (the functions above for RT_SIMD_WIDTH rays at once, lanes outside active are ignored)
+    // ------------------------------------------------------------------------
+    SimdVec3 toObjectSpace(int index, const SimdVec3 &v, float w) const
+    {
+        SimdFloat result[3];
+        for (int i = 0; i < 3; i++)
+        {
+            const glm::vec4 &row = fetchPrimitive(index, 1 + i);
+            result[i] = SimdFloat(row.x) * v.x + SimdFloat(row.y) * v.y + SimdFloat(row.z) * v.z + SimdFloat(row.w * w);
+        }
+        return SimdVec3(result[0], result[1], result[2]);
+    }
+
+    SimdFloat intersectPrimitive(int index, const SimdVec3 &ro, const SimdVec3 &rd, const SimdFloat &tMax, const SimdMask &active) const
+    {
+        glm::vec4 bounds = fetchPrimitive(index, 0);
+        SimdFloat tEnter, tExit;
+        SimdMask hit = active & RayPacketKernels::intersectBoundingSphere(ro, rd, glm::vec3(bounds), bounds.w, tMax, tEnter, tExit);
+        if (hit.None())
+            return SimdFloat(RT_INFINITY);
+
+        SimdVec3 roObj = toObjectSpace(index, ro, 1.0f);
+        SimdVec3 rdObj = toObjectSpace(index, rd, 0.0f);
+        glm::vec4 shape = fetchPrimitive(index, 4);
+        SimdFloat t;
+        if ((int)shape.x == PRIM_TORUS)
+            t = analyticTorus ? RayPacketKernels::intersectTorusAnalytic(roObj, rdObj, shape.y, shape.z, tEnter)
+                              : RayPacketKernels::intersectTorus(roObj, rdObj, shape.y, shape.z, tEnter, tExit + SimdFloat(RT_EPSILON), hit);
+        else
+            t = RayPacketKernels::intersectSphere(roObj, rdObj, shape.y);
+        return Select(hit, t, SimdFloat(RT_INFINITY));
+    }
+
+    // Packet traversal: the packet enters a node if any of its active rays hits the box, the others ride along
+    // masked out. Children are visited nearest first by the closest entry of any lane.
+    // hitIndex is the primitive per lane (as float) or -1.
+    SimdFloat intersectBVH(const SimdVec3 &ro, const SimdVec3 &rd, SimdFloat tMax, SimdMask active, bool anyHit, SimdFloat &hitIndex) const
+    {
+        hitIndex = SimdFloat(-1.0f);
+        const std::vector<BVHNode> &nodes = m_bvh.nodes;
+        SimdFloat infinity(RT_INFINITY);
+        if (nodes.empty())
+            return infinity;
+        SimdVec3 invRd = RayPacketKernels::safeInverse(rd);
+        active &= RayPacketKernels::intersectBox(ro, invRd, nodes[0].boxMin, nodes[0].boxMax, tMax) < infinity;
+        if (active.None())
+            return infinity;
+
+        const int STACK_SIZE = BVH::MAX_DEPTH; // the build bounds the depth, the stack can't overflow
+        int stack[STACK_SIZE];
+        SimdFloat stackT[STACK_SIZE];
+        int sp = 0;
+        int node = 0;
+        SimdMask found(false);
+        while (true)
+        {
+            const BVHNode &n = nodes[node];
+            if (BVH::IsLeaf(n))
+            {
+                int first = BVH::FirstPrimitive(n);
+                for (int i = first; i < first + BVH::PrimitiveCount(n); i++)
+                {
+                    SimdFloat t = intersectPrimitive(i, ro, rd, tMax, active);
+                    SimdMask closer = active & (t < tMax);
+                    tMax = Select(closer, t, tMax);
+                    hitIndex = Select(closer, SimdFloat((float)i), hitIndex);
+                    found |= closer;
+                    if (anyHit)
+                        active = AndNot(active, closer);
+                }
+                if (active.None())
+                    break;
+            }
+            else
+            {
+                int left = node + 1;
+                int right = nodes[left].miss;
+                SimdFloat tLeft = Select(active, RayPacketKernels::intersectBox(ro, invRd, nodes[left].boxMin, nodes[left].boxMax, tMax), infinity);
+                SimdFloat tRight = Select(active, RayPacketKernels::intersectBox(ro, invRd, nodes[right].boxMin, nodes[right].boxMax, tMax), infinity);
+                float minLeft = HorizontalMin(tLeft, active);
+                float minRight = HorizontalMin(tRight, active);
+                if (minRight < minLeft)
+                {
+                    std::swap(left, right);
+                    std::swap(tLeft, tRight);
+                    std::swap(minLeft, minRight);
+                }
+                if (minLeft < RT_INFINITY)
+                {
+                    if (minRight < RT_INFINITY)
+                    {
+                        assert(sp < STACK_SIZE);
+                        stack[sp] = right;
+                        stackT[sp++] = tRight;
+                    }
+                    node = left;
+                    continue;
+                }
+            }
+
+            // pop the next subtree that can still contain a closer hit for one of the lanes
+            node = -1;
+            while (sp > 0 && node < 0)
+            {
+                sp--;
+                if ((active & (stackT[sp] < tMax)).Any())
+                    node = stack[sp];
+            }
+            if (node < 0)
+                break;
+        }
+        return Select(found, tMax, infinity);
+    }
+
+    // distance to the closest hit per lane; hitIndex is the primitive or -1 (floor or miss)
+    SimdFloat rayTraceScene(const SimdVec3 &ro, const SimdVec3 &rd, const SimdMask &active, SimdFloat &hitIndex, SimdFloat &floorColor) const
+    {
+        SimdFloat hitDist = Select(active, RayPacketKernels::rayGridFloorIntersection(ro, rd, floorColor), SimdFloat(RT_INFINITY));
+        hitIndex = SimdFloat(-1.0f);
+        if (useBVH)
+        {
+            SimdFloat t = intersectBVH(ro, rd, hitDist, active, false, hitIndex);
+            hitDist = Select(hitIndex >= SimdFloat(0.0f), t, hitDist);
+        }
+        else
+        {
+            for (int i = 0; i < m_numPrimitives; i++)
+            {
+                SimdFloat t = intersectPrimitive(i, ro, rd, hitDist, active);
+                SimdMask closer = active & (t < hitDist);
+                hitDist = Select(closer, t, hitDist);
+                hitIndex = Select(closer, SimdFloat((float)i), hitIndex);
+            }
+        }
+        return hitDist;
+    }
+
+    // lanes whose shadow ray is blocked closer than maxDist
+    SimdMask rayTraceShadow(const SimdVec3 &ro, const SimdVec3 &rd, const SimdFloat &maxDist, const SimdMask &active) const
+    {
+        SimdFloat floorColor;
+        SimdMask inShadow = active & (RayPacketKernels::rayGridFloorIntersection(ro, rd, floorColor) < maxDist);
+        SimdMask open = AndNot(active, inShadow);
+        if (open.None())
+            return inShadow;
+        if (useBVH)
+        {
+            SimdFloat hitIndex;
+            return inShadow | (open & (intersectBVH(ro, rd, maxDist, open, true, hitIndex) < maxDist));
+        }
+        for (int i = 0; i < m_numPrimitives && open.Any(); i++)
+        {
+            SimdMask hit = open & (intersectPrimitive(i, ro, rd, maxDist, open) < maxDist);
+            inShadow |= hit;
+            open = AndNot(open, hit);
+        }
+        return inShadow;
+    }
+
+    // trace() for a packet: all lanes bounce together, lanes whose ray leaves the scene are masked out.
+    // Intersections run on the whole packet, the shading of the hits lane by lane.
+    void tracePacket(SimdVec3 ro, SimdVec3 rd, SimdMask active, glm::vec3 colors[RT_SIMD_WIDTH], unsigned long long &rays,
+                     uint32_t rngState[RT_SIMD_WIDTH]) const
+    {
+        float totalWeight[RT_SIMD_WIDTH];
+        glm::vec3 accumColor[RT_SIMD_WIDTH];
+        for (int i = 0; i < RT_SIMD_WIDTH; i++)
+        {
+            totalWeight[i] = 0.0f;
+            accumColor[i] = glm::vec3(0.0f);
+        }
+
+        alignas(RT_SIMD_ALIGN) float lane[9][RT_SIMD_WIDTH]; // t, hitIndex, floorColor, ro.xyz, rd.xyz
+        glm::vec3 hitPoint[RT_SIMD_WIDTH], hitNormal[RT_SIMD_WIDTH], hitColor[RT_SIMD_WIDTH], lightDir[RT_SIMD_WIDTH];
+        float weight[RT_SIMD_WIDTH];
+        for (int depth = 0; depth < maxDepth && active.Any(); depth++)
+        {
+            SimdFloat hitIndex, floorColor;
+            SimdFloat t = rayTraceScene(ro, rd, active, hitIndex, floorColor);
+            rays += active.Count();
+            active &= t < SimdFloat(RT_INFINITY);
+            if (active.None())
+                break;
+
+            // hits: normal, color and a sample of the light per lane
+            t.Store(lane[0]);
+            hitIndex.Store(lane[1]);
+            floorColor.Store(lane[2]);
+            ro.x.Store(lane[3]), ro.y.Store(lane[4]), ro.z.Store(lane[5]);
+            rd.x.Store(lane[6]), rd.y.Store(lane[7]), rd.z.Store(lane[8]);
+            int bits = active.Bits();
+            for (int i = 0; i < RT_SIMD_WIDTH; i++)
+            {
+                if (!((bits >> i) & 1))
+                    continue;
+                glm::vec3 o(lane[3][i], lane[4][i], lane[5][i]);
+                glm::vec3 d(lane[6][i], lane[7][i], lane[8][i]);
+                hitPoint[i] = o + lane[0][i] * d;
+                int index = (int)lane[1][i];
+                if (index >= 0)
+                {
+                    hitNormal[i] = getPrimitiveNormal(index, o + d * lane[0][i]);
+                    hitColor[i] = glm::vec3(fetchPrimitive(index, 5));
+                }
+                else
+                {
+                    hitNormal[i] = glm::vec3(0.0f, 1.0f, 0.0f);
+                    hitColor[i] = glm::vec3(lane[2][i]);
+                }
+                float fresnel = calcFresnel(hitNormal[i], d);
+                weight[i] = (1.0f - fresnel) * (1.0f - totalWeight[i]);
+                totalWeight[i] += weight[i];
+
+                glm::vec3 lightVec = sampleLight(rngState[i]) - hitPoint[i];
+                lightDir[i] = glm::normalize(lightVec);
+                glm::vec3 shadowOrigin = hitPoint[i] + lightDir[i] * RT_RAY_OFFSET;
+                for (int c = 0; c < 3; c++)
+                {
+                    lane[3 + c][i] = shadowOrigin[c];
+                    lane[6 + c][i] = lightDir[i][c];
+                }
+                lane[0][i] = glm::length(lightVec);
+            }
+
+            // shadow rays as a packet
+            SimdVec3 shadowOrigin(SimdFloat::Load(lane[3]), SimdFloat::Load(lane[4]), SimdFloat::Load(lane[5]));
+            SimdVec3 shadowDir(SimdFloat::Load(lane[6]), SimdFloat::Load(lane[7]), SimdFloat::Load(lane[8]));
+            SimdMask inShadow = rayTraceShadow(shadowOrigin, shadowDir, SimdFloat::Load(lane[0]), active);
+            rays += active.Count();
+
+            // shade and reflect
+            int shadowBits = inShadow.Bits();
+            for (int i = 0; i < RT_SIMD_WIDTH; i++)
+            {
+                if (!((bits >> i) & 1))
+                    continue;
+                glm::vec3 d(rd.x.Lane(i), rd.y.Lane(i), rd.z.Lane(i));
+                accumColor[i] += calcShading(hitNormal[i], d, hitColor[i], lightDir[i], (shadowBits >> i) & 1) * weight[i];
+                glm::vec3 reflected = glm::normalize(glm::reflect(d, hitNormal[i]));
+                glm::vec3 origin = hitPoint[i] + hitNormal[i] * RT_RAY_OFFSET;
+                for (int c = 0; c < 3; c++)
+                {
+                    lane[3 + c][i] = origin[c];
+                    lane[6 + c][i] = reflected[c];
+                }
+            }
+            ro = SimdVec3(SimdFloat::Load(lane[3]), SimdFloat::Load(lane[4]), SimdFloat::Load(lane[5]));
+            rd = SimdVec3(SimdFloat::Load(lane[6]), SimdFloat::Load(lane[7]), SimdFloat::Load(lane[8]));
+        }
+
+        for (int i = 0; i < RT_SIMD_WIDTH; i++)
+            colors[i] = totalWeight[i] > 0.0f ? accumColor[i] / totalWeight[i] : glm::vec3(0.0f);
+    }
+
+private:
+    std::vector<glm::vec4> m_primitives;
+    BVH m_bvh;
+    int m_numPrimitives = 0;
+    glm::vec3 m_lightPosition;
+    std::atomic<unsigned long long> m_rayCount{0};
+
+    void renderTile(RaytracingImage &image, const glm::mat4 &invViewProj, const glm::vec3 &camPos, int tx, int ty, int frameIndex)
+    {
+        unsigned long long rays = 0;
+        glm::vec2 jitter = accumulate ? RaytracingJitter(frameIndex) : glm::vec2(0.0f);
+        int xEnd = std::min(tx + tileSize, image.width);
+        int yEnd = std::min(ty + tileSize, image.height);
+        for (int y = ty; y < yEnd; y++)
+        {
+            // image rows are stored top to bottom, gl_FragCoord starts at the bottom
+            int fragY = image.height - 1 - y;
+            for (int x = tx; x < xEnd; x++)
+            {
+                glm::vec3 rayDir = primaryRay(image, invViewProj, camPos, x, fragY, jitter);
+                uint32_t rngState = pcgHash((uint32_t)x + pcgHash((uint32_t)fragY + pcgHash((uint32_t)frameIndex)));
+                glm::vec3 color = trace(camPos, rayDir, rays, rngState);
+                storePixel(image, x, y, color, frameIndex);
+            }
+        }
+        m_rayCount += rays;
+    }
+
+    // the same tile in packets of RT_SIMD_WIDTH pixels of a row
+    void renderTilePacket(RaytracingImage &image, const glm::mat4 &invViewProj, const glm::vec3 &camPos, int tx, int ty, int frameIndex)
+    {
+        unsigned long long rays = 0;
+        glm::vec2 jitter = accumulate ? RaytracingJitter(frameIndex) : glm::vec2(0.0f);
+        int xEnd = std::min(tx + tileSize, image.width);
+        int yEnd = std::min(ty + tileSize, image.height);
+        alignas(RT_SIMD_ALIGN) float dx[RT_SIMD_WIDTH], dy[RT_SIMD_WIDTH], dz[RT_SIMD_WIDTH];
+        uint32_t rngState[RT_SIMD_WIDTH];
+        glm::vec3 colors[RT_SIMD_WIDTH];
+        for (int y = ty; y < yEnd; y++)
+        {
+            int fragY = image.height - 1 - y;
+            for (int x = tx; x < xEnd; x += RT_SIMD_WIDTH)
+            {
+                int count = std::min(RT_SIMD_WIDTH, xEnd - x);
+                for (int i = 0; i < RT_SIMD_WIDTH; i++)
+                {
+                    // unused lanes of a partial packet repeat the last pixel and stay masked out
+                    int px = x + std::min(i, count - 1);
+                    glm::vec3 rayDir = primaryRay(image, invViewProj, camPos, px, fragY, jitter);
+                    dx[i] = rayDir.x;
+                    dy[i] = rayDir.y;
+                    dz[i] = rayDir.z;
+                    rngState[i] = pcgHash((uint32_t)px + pcgHash((uint32_t)fragY + pcgHash((uint32_t)frameIndex)));
+                }
+                SimdVec3 ro(camPos.x, camPos.y, camPos.z);
+                SimdVec3 rd(SimdFloat::Load(dx), SimdFloat::Load(dy), SimdFloat::Load(dz));
+                tracePacket(ro, rd, FirstLanes(count), colors, rays, rngState);
+                for (int i = 0; i < count; i++)
+                    storePixel(image, x + i, y, colors[i], frameIndex);
+            }
+        }
+        m_rayCount += rays;
+    }
+
+    // normalized direction of the primary ray through pixel (x, fragY), fragY counted from the bottom
+    static glm::vec3 primaryRay(const RaytracingImage &image, const glm::mat4 &invViewProj, const glm::vec3 &camPos, int x, int fragY,
+                                const glm::vec2 &jitter)
+    {
+        float ndcX = 2.0f * (x + 0.5f + jitter.x) / image.width - 1.0f;
+        float ndcY = 2.0f * (fragY + 0.5f + jitter.y) / image.height - 1.0f;
+        glm::vec4 worldPos = invViewProj * glm::vec4(ndcX, ndcY, 0.0f, 1.0f);
+        return glm::normalize(glm::vec3(worldPos) / worldPos.w - camPos);
+    }
+
+    // write a pixel, with accumulate as the running average over all samples since frame 0
+    void storePixel(RaytracingImage &image, int x, int y, glm::vec3 color, int frameIndex) const
+    {
+        glm::vec3 &pixel = image.pixels[(size_t)y * image.width + x];
+        if (accumulate && frameIndex > 0)
+            color = glm::mix(pixel, color, 1.0f / (float)(frameIndex + 1));
+        pixel = color;
+    }
+};
+
+#endif
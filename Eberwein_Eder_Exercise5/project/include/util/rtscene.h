@@ -0,0 +1,166 @@
+#pragma once
+#ifndef RTSCENE_H
+#define RTSCENE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+// Scene description for the ray tracer (13-raytracing-solution and the CPU reference in util/raytracer.h).
+// The primitive list is packed into an array of vec4s which raytracing.cpp uploads into a texture buffer
+// (samplerBuffer, GL_RGBA32F) and which the CPU renderer reads directly, so both trace exactly the same data.
+
+// constants of the CPU ray tracer (util/raytracer.h, util/raypacket.h), INFINITY, EPSILON and RAY_OFFSET in GLSL
+#define RT_INFINITY 100000.0f
+#define RT_EPSILON 1e-5f
+#define RT_RAY_OFFSET 0.0001f
+
+// primitive types, must match the PRIM_* defines in raytracing.fs.glsl
+#define PRIM_SPHERE 0
+#define PRIM_TORUS 1
+
+// number of vec4 texels per primitive in the packed buffer, must match PRIMITIVE_TEXELS in raytracing.fs.glsl
+//   0:   world space bounding sphere (center, radius)
+//   1-3: rows of the world-to-object transform (rotation in xyz, translation in w)
+//   4:   type, size.x, size.y, unused
+//   5:   color, unused
+#define RT_PRIMITIVE_TEXELS 6
+
+// sub-pixel offset of the primary rays for sample frameIndex of the progressive accumulation, in pixels
+// (Halton sequence in base 2 and 3, so the samples cover the pixel evenly)
+inline glm::vec2 RaytracingJitter(int frameIndex)
+{
+    glm::vec2 result(0.0f);
+    for (int d = 0; d < 2; d++)
+    {
+        int base = d == 0 ? 2 : 3;
+        float f = 1.0f;
+        for (int i = frameIndex + 1; i > 0; i /= base)
+        {
+            f /= base;
+            result[d] += f * (i % base);
+        }
+    }
+    return result - glm::vec2(0.5f);
+}
+
+struct RaytracingPrimitive
+{
+    int type = PRIM_SPHERE;
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::vec3 rotation = glm::vec3(0.0f);    // euler angles in degrees, applied in the order z, x, y
+    glm::vec2 size = glm::vec2(1.0f, 0.0f); // sphere: (radius, unused), torus: (major radius R, minor radius r)
+    glm::vec3 color = glm::vec3(1.0f);
+
+    static RaytracingPrimitive Sphere(const glm::vec3 &position, float radius, const glm::vec3 &color)
+    {
+        RaytracingPrimitive p;
+        p.type = PRIM_SPHERE;
+        p.position = position;
+        p.size = glm::vec2(radius, 0.0f);
+        p.color = color;
+        return p;
+    }
+
+    // a torus around the (rotated) y-axis
+    static RaytracingPrimitive Torus(const glm::vec3 &position, float R, float r, const glm::vec3 &color,
+                                     const glm::vec3 &rotation = glm::vec3(0.0f))
+    {
+        RaytracingPrimitive p;
+        p.type = PRIM_TORUS;
+        p.position = position;
+        p.rotation = rotation;
+        p.size = glm::vec2(R, r);
+        p.color = color;
+        return p;
+    }
+
+    // object-to-world rotation
+    glm::mat3 GetRotation() const
+    {
+        glm::mat4 m = glm::mat4(1.0f);
+        m = glm::rotate(m, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+        m = glm::rotate(m, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+        m = glm::rotate(m, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+        return glm::mat3(m);
+    }
+
+    // radius of a sphere around position enclosing the primitive
+    float GetBoundingRadius() const
+    {
+        return type == PRIM_TORUS ? size.x + size.y : size.x;
+    }
+};
+
+struct RaytracingScene
+{
+    std::vector<RaytracingPrimitive> primitives;
+    glm::vec3 lightPosition = glm::vec3(-1.0f, 5.0f, 1.0f);
+
+    // the original scene of raytracing.fs.glsl: three blue toruses stacked on top of each other
+    static RaytracingScene Default()
+    {
+        RaytracingScene scene;
+        for (float y : {0.5f, 1.5f, 2.5f})
+            scene.primitives.push_back(RaytracingPrimitive::Torus(glm::vec3(2.0f, y, 2.0f), 0.7f, 0.2f, glm::vec3(0.0f, 0.0f, 1.0f)));
+        return scene;
+    }
+
+    // benchmark scene: count randomly placed, rotated and colored spheres and toruses above the floor.
+    // The area grows with the count so the density stays roughly the same.
+    static RaytracingScene Benchmark(int count, unsigned int seed = 1)
+    {
+        RaytracingScene scene;
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        float halfSize = 2.0f * std::sqrt((float)count);
+        for (int i = 0; i < count; i++)
+        {
+            glm::vec3 position = glm::vec3((unit(rng) * 2.0f - 1.0f) * halfSize, 0.3f + unit(rng) * 3.0f,
+                                           (unit(rng) * 2.0f - 1.0f) * halfSize);
+            glm::vec3 color = glm::vec3(unit(rng), unit(rng), unit(rng));
+            if (i % 2 == 0)
+                scene.primitives.push_back(RaytracingPrimitive::Sphere(position, 0.1f + 0.2f * unit(rng), color));
+            else
+                scene.primitives.push_back(RaytracingPrimitive::Torus(position, 0.2f + 0.3f * unit(rng), 0.05f + 0.05f * unit(rng), color,
+                                                                      glm::vec3(unit(rng), unit(rng), unit(rng)) * 360.0f));
+        }
+        scene.lightPosition = glm::vec3(-1.0f, 10.0f, 1.0f);
+        return scene;
+    }
+
+    // pack the primitives into RT_PRIMITIVE_TEXELS vec4s each (see the layout above)
+    // ------------------------------------------------------------------------
+    std::vector<glm::vec4> Pack() const
+    {
+        std::vector<int> order(primitives.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = (int)i;
+        return Pack(order);
+    }
+
+    // pack in the given order, e.g. the leaf order of a BVH (util/bvh.h)
+    std::vector<glm::vec4> Pack(const std::vector<int> &order) const
+    {
+        std::vector<glm::vec4> data;
+        data.reserve(order.size() * RT_PRIMITIVE_TEXELS);
+        for (int index : order)
+        {
+            const RaytracingPrimitive &p = primitives[index];
+            // rigid transform: the inverse rotation is the transpose, so the rows of the
+            // world-to-object matrix are the columns of the object-to-world rotation
+            glm::mat3 rot = p.GetRotation();
+            data.push_back(glm::vec4(p.position, p.GetBoundingRadius()));
+            for (int i = 0; i < 3; i++)
+                data.push_back(glm::vec4(rot[i], -glm::dot(rot[i], p.position)));
+            data.push_back(glm::vec4((float)p.type, p.size.x, p.size.y, 0.0f));
+            data.push_back(glm::vec4(p.color, 0.0f));
+        }
+        return data;
+    }
+};
+
+#endif
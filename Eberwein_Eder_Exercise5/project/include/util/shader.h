@@ -5,6 +5,7 @@
 #include <glm/glm.hpp>
 
 #include <string>
+#include <unordered_map>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -16,6 +17,8 @@ private:
     std::string fPath = "";
     std::string gPath = "";
     bool isSuccess = false;
+    // uniform locations of the current program by name, filled on first use
+    mutable std::unordered_map<std::string, int> locations;
 
 public:
     // check if the shader program is ready: all shaders have been loaded compiled and linked
@@ -73,8 +76,10 @@ public:
         unsigned int newID;
         if (loadAndCompile(vPath, fPath, gPath, newID))
         {
+            glDeleteProgram(ID);
             ID = newID;
             isSuccess = true;
+            locations.clear(); // handles from getLocation are invalid now
         }
         else
         {
@@ -88,63 +93,92 @@ public:
     {
         glUseProgram(ID);
     }
+    // location of a uniform, looked up once per program and cached (-1 if the uniform is not active).
+    // Hot loops can keep the handle and use the setters below, but have to fetch it again after reload()
+    // ------------------------------------------------------------------------
+    int getLocation(const std::string &name) const
+    {
+        auto it = locations.find(name);
+        if (it != locations.end())
+            return it->second;
+        int location = glGetUniformLocation(ID, name.c_str());
+        locations.emplace(name, location);
+        return location;
+    }
     // utility uniform functions
     // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
+    void setBool(const std::string &name, bool value) const { setBool(getLocation(name), value); }
+    void setBool(int location, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        glUniform1i(location, (int)value);
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
+    void setInt(const std::string &name, int value) const { setInt(getLocation(name), value); }
+    void setInt(int location, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1i(location, value);
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
+    void setFloat(const std::string &name, float value) const { setFloat(getLocation(name), value); }
+    void setFloat(int location, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1f(location, value);
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(const std::string &name, const glm::vec2 &value) const { setVec2(getLocation(name), value); }
+    void setVec2(int location, const glm::vec2 &value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform2fv(location, 1, &value[0]);
     }
     void setVec2(const std::string &name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        glUniform2f(getLocation(name), x, y);
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
+    void setVec3(const std::string &name, const glm::vec3 &value) const { setVec3(getLocation(name), value); }
+    void setVec3(int location, const glm::vec3 &value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform3fv(location, 1, &value[0]);
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        glUniform3f(getLocation(name), x, y, z);
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(const std::string &name, const glm::vec4 &value) const { setVec4(getLocation(name), value); }
+    void setVec4(int location, const glm::vec4 &value) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform4fv(location, 1, &value[0]);
     }
     void setVec4(const std::string &name, float x, float y, float z, float w)
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        glUniform4f(getLocation(name), x, y, z, w);
+    }
+    // ------------------------------------------------------------------------
+    void setMat2(const std::string &name, const glm::mat2 &mat) const { setMat2(getLocation(name), mat); }
+    void setMat2(int location, const glm::mat2 &mat) const
+    {
+        glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    void setMat3(const std::string &name, const glm::mat3 &mat) const { setMat3(getLocation(name), mat); }
+    void setMat3(int location, const glm::mat3 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    void setMat4(const std::string &name, const glm::mat4 &mat) const { setMat4(getLocation(name), mat); }
+    void setMat4(int location, const glm::mat4 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    // connects a uniform block to a buffer binding point (GLSL 330 has no layout(binding = n)), again after reload()
+    void setBlockBinding(const std::string &name, unsigned int binding) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        unsigned int index = glGetUniformBlockIndex(ID, name.c_str());
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
     }
 
 private:
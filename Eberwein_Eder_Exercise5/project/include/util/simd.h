@@ -0,0 +1,300 @@
+#pragma once
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Minimal SIMD float vectors for the packet ray tracer (util/raypacket.h).
+// SimdFloat holds RT_SIMD_WIDTH floats (one per ray of a packet), SimdMask one boolean per lane.
+// The width is chosen at compile time:
+//   AVX2 (-mavx2, /arch:AVX2) -> 8 lanes
+//   SSE2 (every x86-64 compiler)  -> 4 lanes
+//   otherwise, or with RT_SIMD_SCALAR defined -> 4 lanes of plain floats (scalar fallback, left to the auto-vectorizer)
+
+#if defined(RT_SIMD_SCALAR)
+#define RT_SIMD_WIDTH 4
+#define RT_SIMD_NAME "scalar"
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define RT_SIMD_AVX2
+#define RT_SIMD_WIDTH 8
+#define RT_SIMD_NAME "AVX2"
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RT_SIMD_SSE2
+#define RT_SIMD_WIDTH 4
+#define RT_SIMD_NAME "SSE2"
+#else
+#define RT_SIMD_SCALAR
+#define RT_SIMD_WIDTH 4
+#define RT_SIMD_NAME "scalar"
+#endif
+
+// alignment of a SimdFloat and of the lane arrays it is loaded from (16 bytes for 4 lanes, 32 for 8)
+#define RT_SIMD_ALIGN (RT_SIMD_WIDTH * 4)
+
+struct alignas(RT_SIMD_ALIGN) SimdFloat
+{
+#if defined(RT_SIMD_AVX2)
+    __m256 v;
+    SimdFloat() = default;
+    SimdFloat(__m256 x) : v(x) {}
+    SimdFloat(float x) : v(_mm256_set1_ps(x)) {}
+    static SimdFloat Load(const float *p) { return _mm256_loadu_ps(p); }
+    void Store(float *p) const { _mm256_storeu_ps(p, v); }
+#elif defined(RT_SIMD_SSE2)
+    __m128 v;
+    SimdFloat() = default;
+    SimdFloat(__m128 x) : v(x) {}
+    SimdFloat(float x) : v(_mm_set1_ps(x)) {}
+    static SimdFloat Load(const float *p) { return _mm_loadu_ps(p); }
+    void Store(float *p) const { _mm_storeu_ps(p, v); }
+#else
+    float v[RT_SIMD_WIDTH];
+    SimdFloat() = default;
+    SimdFloat(float x)
+    {
+        for (int i = 0; i < RT_SIMD_WIDTH; i++)
+            v[i] = x;
+    }
+    static SimdFloat Load(const float *p)
+    {
+        SimdFloat r;
+        for (int i = 0; i < RT_SIMD_WIDTH; i++)
+            r.v[i] = p[i];
+        return r;
+    }
+    void Store(float *p) const
+    {
+        for (int i = 0; i < RT_SIMD_WIDTH; i++)
+            p[i] = v[i];
+    }
+#endif
+
+    // single lane, for the parts that stay scalar (shading, transcendental functions)
+    float Lane(int i) const
+    {
+        alignas(RT_SIMD_ALIGN) float a[RT_SIMD_WIDTH];
+        Store(a);
+        return a[i];
+    }
+};
+
+struct alignas(RT_SIMD_ALIGN) SimdMask
+{
+#if defined(RT_SIMD_AVX2)
+    __m256 v;
+    SimdMask() = default;
+    SimdMask(__m256 x) : v(x) {}
+    SimdMask(bool b) : v(_mm256_castsi256_ps(_mm256_set1_epi32(b ? -1 : 0))) {}
+    int Bits() const { return _mm256_movemask_ps(v); }
+#elif defined(RT_SIMD_SSE2)
+    __m128 v;
+    SimdMask() = default;
+    SimdMask(__m128 x) : v(x) {}
+    SimdMask(bool b) : v(_mm_castsi128_ps(_mm_set1_epi32(b ? -1 : 0))) {}
+    int Bits() const { return _mm_movemask_ps(v); }
+#else
+    bool v[RT_SIMD_WIDTH];
+    SimdMask() = default;
+    SimdMask(bool b)
+    {
+        for (int i = 0; i < RT_SIMD_WIDTH; i++)
+            v[i] = b;
+    }
+    int Bits() const
+    {
+        int bits = 0;
+        for (int i = 0; i < RT_SIMD_WIDTH; i++)
+            bits |= v[i] ? 1 << i : 0;
+        return bits;
+    }
+#endif
+
+    bool Lane(int i) const { return (Bits() >> i) & 1; }
+    bool Any() const { return Bits() != 0; }
+    bool All() const { return Bits() == (1 << RT_SIMD_WIDTH) - 1; }
+    bool None() const { return Bits() == 0; }
+    int Count() const
+    {
+        int count = 0;
+        for (int bits = Bits(); bits; bits &= bits - 1)
+            count++;
+        return count;
+    }
+};
+
+#if defined(RT_SIMD_AVX2)
+#define RT_SIMD_BINARY(op, fn) \
+    inline SimdFloat operator op(const SimdFloat &a, const SimdFloat &b) { return fn(a.v, b.v); }
+RT_SIMD_BINARY(+, _mm256_add_ps)
+RT_SIMD_BINARY(-, _mm256_sub_ps)
+RT_SIMD_BINARY(*, _mm256_mul_ps)
+RT_SIMD_BINARY(/, _mm256_div_ps)
+#undef RT_SIMD_BINARY
+#define RT_SIMD_COMPARE(op, pred) \
+    inline SimdMask operator op(const SimdFloat &a, const SimdFloat &b) { return _mm256_cmp_ps(a.v, b.v, pred); }
+RT_SIMD_COMPARE(<, _CMP_LT_OQ)
+RT_SIMD_COMPARE(<=, _CMP_LE_OQ)
+RT_SIMD_COMPARE(>, _CMP_GT_OQ)
+RT_SIMD_COMPARE(>=, _CMP_GE_OQ)
+RT_SIMD_COMPARE(!=, _CMP_NEQ_UQ)
+#undef RT_SIMD_COMPARE
+inline SimdFloat operator-(const SimdFloat &a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+inline SimdMask operator&(const SimdMask &a, const SimdMask &b) { return _mm256_and_ps(a.v, b.v); }
+inline SimdMask operator|(const SimdMask &a, const SimdMask &b) { return _mm256_or_ps(a.v, b.v); }
+inline SimdMask operator!(const SimdMask &a) { return _mm256_xor_ps(a.v, SimdMask(true).v); }
+inline SimdFloat Min(const SimdFloat &a, const SimdFloat &b) { return _mm256_min_ps(a.v, b.v); }
+inline SimdFloat Max(const SimdFloat &a, const SimdFloat &b) { return _mm256_max_ps(a.v, b.v); }
+inline SimdFloat Sqrt(const SimdFloat &a) { return _mm256_sqrt_ps(a.v); }
+inline SimdFloat Abs(const SimdFloat &a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+inline SimdFloat Floor(const SimdFloat &a) { return _mm256_floor_ps(a.v); }
+// mask ? a : b
+inline SimdFloat Select(const SimdMask &mask, const SimdFloat &a, const SimdFloat &b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+#elif defined(RT_SIMD_SSE2)
+#define RT_SIMD_BINARY(op, fn) \
+    inline SimdFloat operator op(const SimdFloat &a, const SimdFloat &b) { return fn(a.v, b.v); }
+RT_SIMD_BINARY(+, _mm_add_ps)
+RT_SIMD_BINARY(-, _mm_sub_ps)
+RT_SIMD_BINARY(*, _mm_mul_ps)
+RT_SIMD_BINARY(/, _mm_div_ps)
+#undef RT_SIMD_BINARY
+#define RT_SIMD_COMPARE(op, fn) \
+    inline SimdMask operator op(const SimdFloat &a, const SimdFloat &b) { return fn(a.v, b.v); }
+RT_SIMD_COMPARE(<, _mm_cmplt_ps)
+RT_SIMD_COMPARE(<=, _mm_cmple_ps)
+RT_SIMD_COMPARE(>, _mm_cmpgt_ps)
+RT_SIMD_COMPARE(>=, _mm_cmpge_ps)
+RT_SIMD_COMPARE(!=, _mm_cmpneq_ps)
+#undef RT_SIMD_COMPARE
+inline SimdFloat operator-(const SimdFloat &a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+inline SimdMask operator&(const SimdMask &a, const SimdMask &b) { return _mm_and_ps(a.v, b.v); }
+inline SimdMask operator|(const SimdMask &a, const SimdMask &b) { return _mm_or_ps(a.v, b.v); }
+inline SimdMask operator!(const SimdMask &a) { return _mm_xor_ps(a.v, SimdMask(true).v); }
+inline SimdFloat Min(const SimdFloat &a, const SimdFloat &b) { return _mm_min_ps(a.v, b.v); }
+inline SimdFloat Max(const SimdFloat &a, const SimdFloat &b) { return _mm_max_ps(a.v, b.v); }
+inline SimdFloat Sqrt(const SimdFloat &a) { return _mm_sqrt_ps(a.v); }
+inline SimdFloat Abs(const SimdFloat &a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+// mask ? a : b
+inline SimdFloat Select(const SimdMask &mask, const SimdFloat &a, const SimdFloat &b)
+{
+    return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+// SSE2 has no rounding instruction: truncate, then correct the negative values
+inline SimdFloat Floor(const SimdFloat &a)
+{
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.0f)));
+}
+#else
+#define RT_SIMD_BINARY(op)                                               \
+    inline SimdFloat operator op(const SimdFloat &a, const SimdFloat &b) \
+    {                                                                    \
+        SimdFloat r;                                                     \
+        for (int i = 0; i < RT_SIMD_WIDTH; i++)                          \
+            r.v[i] = a.v[i] op b.v[i];                                   \
+        return r;                                                        \
+    }
+RT_SIMD_BINARY(+)
+RT_SIMD_BINARY(-)
+RT_SIMD_BINARY(*)
+RT_SIMD_BINARY(/)
+#undef RT_SIMD_BINARY
+#define RT_SIMD_COMPARE(op)                                             \
+    inline SimdMask operator op(const SimdFloat &a, const SimdFloat &b) \
+    {                                                                   \
+        SimdMask r;                                                     \
+        for (int i = 0; i < RT_SIMD_WIDTH; i++)                         \
+            r.v[i] = a.v[i] op b.v[i];                                  \
+        return r;                                                       \
+    }
+RT_SIMD_COMPARE(<)
+RT_SIMD_COMPARE(<=)
+RT_SIMD_COMPARE(>)
+RT_SIMD_COMPARE(>=)
+RT_SIMD_COMPARE(!=)
+#undef RT_SIMD_COMPARE
+#define RT_SIMD_LANEWISE(type, expr)        \
+    type r;                                 \
+    for (int i = 0; i < RT_SIMD_WIDTH; i++) \
+        r.v[i] = expr;                      \
+    return r;
+inline SimdFloat operator-(const SimdFloat &a) { RT_SIMD_LANEWISE(SimdFloat, -a.v[i]) }
+inline SimdMask operator&(const SimdMask &a, const SimdMask &b) { RT_SIMD_LANEWISE(SimdMask, a.v[i] && b.v[i]) }
+inline SimdMask operator|(const SimdMask &a, const SimdMask &b) { RT_SIMD_LANEWISE(SimdMask, a.v[i] || b.v[i]) }
+inline SimdMask operator!(const SimdMask &a) { RT_SIMD_LANEWISE(SimdMask, !a.v[i]) }
+inline SimdFloat Min(const SimdFloat &a, const SimdFloat &b) { RT_SIMD_LANEWISE(SimdFloat, a.v[i] < b.v[i] ? a.v[i] : b.v[i]) }
+inline SimdFloat Max(const SimdFloat &a, const SimdFloat &b) { RT_SIMD_LANEWISE(SimdFloat, a.v[i] > b.v[i] ? a.v[i] : b.v[i]) }
+inline SimdFloat Sqrt(const SimdFloat &a) { RT_SIMD_LANEWISE(SimdFloat, std::sqrt(a.v[i])) }
+inline SimdFloat Abs(const SimdFloat &a) { RT_SIMD_LANEWISE(SimdFloat, std::abs(a.v[i])) }
+inline SimdFloat Floor(const SimdFloat &a) { RT_SIMD_LANEWISE(SimdFloat, std::floor(a.v[i])) }
+// mask ? a : b
+inline SimdFloat Select(const SimdMask &mask, const SimdFloat &a, const SimdFloat &b) { RT_SIMD_LANEWISE(SimdFloat, mask.v[i] ? a.v[i] : b.v[i]) }
+#undef RT_SIMD_LANEWISE
+#endif
+
+inline SimdFloat &operator+=(SimdFloat &a, const SimdFloat &b) { return a = a + b; }
+inline SimdFloat &operator-=(SimdFloat &a, const SimdFloat &b) { return a = a - b; }
+inline SimdFloat &operator*=(SimdFloat &a, const SimdFloat &b) { return a = a * b; }
+inline SimdMask &operator&=(SimdMask &a, const SimdMask &b) { return a = a & b; }
+inline SimdMask &operator|=(SimdMask &a, const SimdMask &b) { return a = a | b; }
+
+// a & !b
+inline SimdMask AndNot(const SimdMask &a, const SimdMask &b) { return a & !b; }
+
+// mask with the first count lanes set (partial packets at the image border)
+inline SimdMask FirstLanes(int count)
+{
+    alignas(RT_SIMD_ALIGN) float index[RT_SIMD_WIDTH];
+    for (int i = 0; i < RT_SIMD_WIDTH; i++)
+        index[i] = (float)i;
+    return SimdFloat::Load(index) < SimdFloat((float)count);
+}
+
+// smallest value of the lanes in mask (FLT_MAX-like large value if mask is empty)
+inline float HorizontalMin(const SimdFloat &a, const SimdMask &mask)
+{
+    alignas(RT_SIMD_ALIGN) float values[RT_SIMD_WIDTH];
+    a.Store(values);
+    int bits = mask.Bits();
+    float result = 3.0e38f;
+    for (int i = 0; i < RT_SIMD_WIDTH; i++)
+        if ((bits >> i) & 1)
+            result = std::min(result, values[i]);
+    return result;
+}
+
+// functions without a SIMD instruction, evaluated lane by lane
+template <typename F>
+inline SimdFloat Lanewise(const SimdFloat &a, F f)
+{
+    alignas(RT_SIMD_ALIGN) float values[RT_SIMD_WIDTH];
+    a.Store(values);
+    for (int i = 0; i < RT_SIMD_WIDTH; i++)
+        values[i] = f(values[i]);
+    return SimdFloat::Load(values);
+}
+
+// three SimdFloats: one vec3 per lane (structure of arrays)
+struct SimdVec3
+{
+    SimdFloat x, y, z;
+
+    SimdVec3() = default;
+    SimdVec3(const SimdFloat &x_, const SimdFloat &y_, const SimdFloat &z_) : x(x_), y(y_), z(z_) {}
+    // broadcast
+    SimdVec3(float x_, float y_, float z_) : x(x_), y(y_), z(z_) {}
+};
+
+inline SimdVec3 operator+(const SimdVec3 &a, const SimdVec3 &b) { return SimdVec3(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline SimdVec3 operator-(const SimdVec3 &a, const SimdVec3 &b) { return SimdVec3(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline SimdVec3 operator*(const SimdVec3 &a, const SimdFloat &s) { return SimdVec3(a.x * s, a.y * s, a.z * s); }
+inline SimdFloat Dot(const SimdVec3 &a, const SimdVec3 &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline SimdVec3 Select(const SimdMask &mask, const SimdVec3 &a, const SimdVec3 &b)
+{
+    return SimdVec3(Select(mask, a.x, b.x), Select(mask, a.y, b.y), Select(mask, a.z, b.z));
+}
+
+#endif
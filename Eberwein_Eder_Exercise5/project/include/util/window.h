@@ -9,8 +9,14 @@
 #include <glad/glad.h> // holds all OpenGL type declarations
 #include <GLFW/glfw3.h>
 
+#include "benchmark.h"
+#include "headless.h"
+
 //#include <nanogui/nanogui.h>
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -20,6 +26,63 @@
 
 GLFWwindow *window = nullptr;
 bool gui = false;
+std::string windowTitle;
+
+// parse the command line options of the applications, returns false if the application should quit
+// ---------------------------------------------------
+bool ParseCommandLine(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--headless")
+            headless.enabled = benchmark.enabled = true;
+        else if (arg == "--benchmark")
+            benchmark.enabled = benchmark.camera = true;
+        else if (arg == "--frames" && hasValue)
+            benchmark.frames = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--warmup" && hasValue)
+            benchmark.warmup = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--camera-path" && hasValue)
+            benchmark.cameraPath = argv[++i];
+        else if (arg == "--record-path" && hasValue)
+            benchmark.recordPath = argv[++i];
+        else if (arg == "--report" && hasValue)
+            benchmark.report = argv[++i];
+        else if (arg == "--width" && hasValue)
+            headless.width = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--height" && hasValue)
+            headless.height = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--context" && hasValue)
+            headless.context = argv[++i];
+        else if (arg == "--images" && hasValue)
+            headless.images = argv[++i];
+        else if (arg == "--image-interval" && hasValue)
+            headless.imageInterval = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--set" && hasValue && std::strchr(argv[i + 1], '='))
+        {
+            std::string option = argv[++i];
+            benchmark.options[option.substr(0, option.find('='))] = option.substr(option.find('=') + 1);
+        }
+        else
+        {
+            std::cout << "usage: " << argv[0] << " [--benchmark] [--frames n] [--warmup n] [--camera-path file] [--record-path file]" << std::endl
+                      << "       [--report file.json|file.csv] [--headless] [--width w] [--height h] [--context native|egl|osmesa]" << std::endl
+                      << "       [--images prefix] [--image-interval n] [--set name=value ...]" << std::endl;
+            return false;
+        }
+    }
+    if (headless.context != "native" && headless.context != "egl" && headless.context != "osmesa")
+    {
+        std::cout << "ERROR::WINDOW::CONTEXT : Unknown context " << headless.context << std::endl;
+        return false;
+    }
+    // a camera path implies the benchmark mode
+    if (!benchmark.cameraPath.empty())
+        benchmark.enabled = true;
+    return benchmarkRunner.Init();
+}
 
 // utility function to derminate the window
 // ---------------------------------------------------
@@ -38,6 +101,10 @@ int InitWindow(int &width, int &height, const char *appname = "OpenGL", bool res
 {
     // glfw: initialize and configure
     // ------------------------------
+#ifdef GLFW_PLATFORM_NULL
+    if (headless.enabled && headless.context == "osmesa")
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL); // OSMesa needs no display server
+#endif
     glfwInit();
     glfwWindowHint(GLFW_CLIENT_API, GLFW_OPENGL_API);
 
@@ -54,6 +121,8 @@ int InitWindow(int &width, int &height, const char *appname = "OpenGL", bool res
     glfwWindowHint(GLFW_DEPTH_BITS, 24);
     glfwWindowHint(GLFW_RESIZABLE, resizeable);        // make the window resizeable
     glfwWindowHint(GLFW_SCALE_TO_MONITOR, resizeable); // scale to monitor DPI
+    if (headless.enabled)
+        HeadlessWindowHints(width, height);
 
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
@@ -69,6 +138,9 @@ int InitWindow(int &width, int &height, const char *appname = "OpenGL", bool res
         return -1;
     }
     glfwMakeContextCurrent(window);
+    if (benchmark.enabled)
+        glfwSwapInterval(0); // measure the frames, not the display refresh
+    windowTitle = appname;
     glfwGetFramebufferSize(window, &width, &height); // retrieve current size of the window
 
     // tell GLFW to capture our mouse
@@ -82,6 +154,10 @@ int InitWindow(int &width, int &height, const char *appname = "OpenGL", bool res
         return -1;
     }
 
+    // headless mode: render into an offscreen framebuffer
+    if (headless.enabled && !headlessTarget.Create(width, height))
+        return -1;
+
     return 0; // success
 }
 
@@ -89,6 +165,10 @@ int InitWindow(int &width, int &height, const char *appname = "OpenGL", bool res
 // ---------------------------------------------------
 int InitWindowAndGUI(int &width, int &height, const char *appname = "OpenGL", bool resizeable = true)
 {
+    // no GUI in headless mode
+    if (headless.enabled)
+        return InitWindow(width, height, appname, resizeable);
+
     if (InitWindow(width, height, appname, resizeable) >= 0)
     {
 
@@ -147,6 +227,61 @@ void UpdateWindow(float deltaTime = 0.0f)
     glfwPollEvents();
 }
 
+// framebuffer the application presents to, the default framebuffer or the offscreen one in headless mode
+// ---------------------------------------------------
+unsigned int ScreenFramebuffer()
+{
+    return headless.enabled ? headlessTarget.Framebuffer() : 0;
+}
+
+// loop condition of the render loop, in benchmark (and headless) mode true after the requested number of frames
+// ---------------------------------------------------
+bool WindowShouldClose()
+{
+    bool close = glfwWindowShouldClose(window) || (benchmark.enabled && benchmarkRunner.Finished());
+    if (close)
+        benchmarkRunner.SaveRecording();
+    else if (benchmark.enabled)
+        benchmarkRunner.BeginFrame();
+    return close;
+}
+
+// time of the current frame in seconds, advances by a fixed time step in benchmark mode
+// ---------------------------------------------------
+double FrameTime()
+{
+    return benchmark.enabled ? benchmarkRunner.Time() : glfwGetTime();
+}
+
+// replays the camera path in benchmark mode, records it with --record-path
+// ---------------------------------------------------
+void UpdateCamera(Camera &camera)
+{
+    benchmarkRunner.UpdateCamera(camera);
+}
+
+// end of a frame: records the timings in benchmark mode, swaps the buffers or dumps the images in headless mode
+// ---------------------------------------------------
+void PresentFrame()
+{
+    if (benchmark.enabled)
+    {
+        int frame = benchmarkRunner.Frame();
+        bool last = benchmarkRunner.EndFrame();
+        if (headless.enabled && !headless.images.empty() &&
+            (last || (headless.imageInterval > 0 && (frame + 1) % headless.imageInterval == 0)))
+            headlessTarget.WriteImage(frame);
+        if (last)
+        {
+            int width, height;
+            glfwGetFramebufferSize(window, &width, &height);
+            benchmarkRunner.Report(windowTitle.c_str(), width, height);
+        }
+    }
+    if (!headless.enabled)
+        glfwSwapBuffers(window);
+}
+
 GLFWframebuffersizefun global_fbsize_fun;
 void SetFramebufferSizeCallback(GLFWframebuffersizefun fun)
 {
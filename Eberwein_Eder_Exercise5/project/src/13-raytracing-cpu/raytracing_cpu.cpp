@@ -0,0 +1,460 @@
+// Headless CPU reference renderer for the 13-raytracing-solution scene.
+// Renders the same image as raytracing.fs.glsl on all CPU cores (no window, no OpenGL context required)
+// and reports the throughput in rays per second.
+//
+// usage: 13-raytracing-cpu [--width 1280] [--height 720] [--depth 3] [--tile 16] [--threads 0]
+//                          [--frames 1] [--light x y z] [--torus analytic|march] [--compare]
+//                          [--scene default|benchmark] [--count 1000] [--bvh on|off]
+//                          [--samples 1] [--light-size 0.1] [--packets on|off] [--simd]
+//                          [--out raytracing_cpu.png]
+//   an output file ending in .ppm is written as binary PPM, everything else as PNG.
+//   --compare renders the frame with both torus intersectors and reports timings and pixel differences.
+//   --samples N > 1 accumulates N jittered frames with soft shadows (the progressive mode of raytracing.cpp),
+//   it replaces --frames.
+//   --packets traces packets of 4 (SSE2) or 8 (AVX2, see util/simd.h) rays, --simd benchmarks the plane, sphere,
+//   cylinder and torus intersection kernels and the whole frame ray by ray vs. in packets.
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <util/camera.h>
+#include <util/threadpool.h>
+#include <util/raytracer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// settings (same defaults as raytracing.cpp)
+int SCR_WIDTH = 1280;
+int SCR_HEIGHT = 720;
+
+// camera
+Camera camera(glm::vec3(-2.0f, 5.0f, 5.0f), glm::vec3(0, 1, 0), 0, -45);
+
+bool writePPM(const std::string &path, const RaytracingImage &image)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    auto rgb = image.ToRGB8();
+    fprintf(file, "P6\n%d %d\n255\n", image.width, image.height);
+    fwrite(rgb.data(), 1, rgb.size(), file);
+    fclose(file);
+    return true;
+}
+
+bool writeImage(const std::string &path, const RaytracingImage &image)
+{
+    if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".ppm") == 0)
+        return writePPM(path, image);
+    auto rgb = image.ToRGB8();
+    return stbi_write_png(path.c_str(), image.width, image.height, 3, rgb.data(), image.width * 3) != 0;
+}
+
+void printUsage()
+{
+    std::cout << "usage: 13-raytracing-cpu [--width W] [--height H] [--depth N] [--tile N] [--threads N]\n"
+              << "                         [--frames N] [--light x y z] [--torus analytic|march] [--compare]\n"
+              << "                         [--scene default|benchmark] [--count N] [--bvh on|off]\n"
+              << "                         [--samples N] [--light-size s] [--packets on|off] [--simd]\n"
+              << "                         [--out file.png|file.ppm]" << std::endl;
+}
+
+// renders frames images (accumulated into one if the raytracer accumulates) and returns the average time per frame in seconds
+double renderFrames(Raytracer &raytracer, const glm::mat4 &projection, const glm::mat4 &view, RaytracingImage &image,
+                    ThreadPool &pool, int frames, bool printFrames)
+{
+    double totalSeconds = 0.0;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        auto t1 = std::chrono::high_resolution_clock::now();
+        raytracer.Render(projection, view, camera.Position, image, pool, raytracer.accumulate ? frame : 0);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration<double>(t2 - t1).count();
+        totalSeconds += seconds;
+        if (printFrames)
+            std::cout << "frame " << frame << ": " << (seconds * 1000.0) << " milliseconds" << std::endl;
+    }
+    return totalSeconds / frames;
+}
+
+// number of pixels whose 8 bit color differs by more than 2, the mean and the maximum difference
+size_t compareImages(const RaytracingImage &imageA, const RaytracingImage &imageB, double &meanDiff, int &maxDiff)
+{
+    auto a = imageA.ToRGB8();
+    auto b = imageB.ToRGB8();
+    size_t differing = 0;
+    maxDiff = 0;
+    double sumDiff = 0.0;
+    for (size_t i = 0; i < a.size(); i += 3)
+    {
+        int diff = 0;
+        for (int c = 0; c < 3; c++)
+            diff = std::max(diff, std::abs((int)a[i + c] - (int)b[i + c]));
+        maxDiff = std::max(maxDiff, diff);
+        sumDiff += diff;
+        if (diff > 2)
+            differing++;
+    }
+    meanDiff = sumDiff / (a.size() / 3);
+    return differing;
+}
+
+// renders the scene with the sphere traced and the analytic torus intersection and compares the results
+int compareTorusIntersectors(Raytracer &raytracer, const glm::mat4 &projection, const glm::mat4 &view,
+                             ThreadPool &pool, int frames, const std::string &outPath)
+{
+    RaytracingImage march, analytic;
+    march.Resize(SCR_WIDTH, SCR_HEIGHT);
+    analytic.Resize(SCR_WIDTH, SCR_HEIGHT);
+
+    raytracer.analyticTorus = false;
+    double marchSeconds = renderFrames(raytracer, projection, view, march, pool, frames, false);
+    raytracer.analyticTorus = true;
+    double analyticSeconds = renderFrames(raytracer, projection, view, analytic, pool, frames, false);
+
+    double meanDiff;
+    int maxDiff;
+    size_t differing = compareImages(march, analytic, meanDiff, maxDiff);
+    size_t pixels = march.pixels.size();
+    std::cout << "sphere tracing: " << (marchSeconds * 1000.0) << " milliseconds/frame" << std::endl;
+    std::cout << "analytic:       " << (analyticSeconds * 1000.0) << " milliseconds/frame ("
+              << (marchSeconds / analyticSeconds) << "x)" << std::endl;
+    std::cout << "pixels differing by more than 2/255: " << differing << " of " << pixels << " ("
+              << (100.0 * differing / pixels) << "%), mean difference " << meanDiff
+              << ", max difference " << maxDiff << std::endl;
+
+    if (!writeImage(outPath, analytic))
+    {
+        std::cout << "ERROR::RAYTRACING_CPU : could not write " << outPath << std::endl;
+        return -1;
+    }
+    std::cout << "written to " << outPath << std::endl;
+    return 0;
+}
+
+// Times one intersection kernel on rays (single thread): the scalar function ray by ray and the packet
+// version RT_SIMD_WIDTH rays at a time, best of several runs. Prints both throughputs and the number of
+// differing results.
+template <typename Scalar, typename Packet>
+void benchmarkKernel(const char *name, const std::vector<glm::vec3> &origins, const std::vector<glm::vec3> &directions,
+                     Scalar scalar, Packet packet)
+{
+    size_t count = origins.size() / RT_SIMD_WIDTH * RT_SIMD_WIDTH;
+    std::vector<float> scalarT(count), packetT(count);
+    // the packets read the rays in structure of arrays layout
+    std::vector<float> soa[6];
+    for (int c = 0; c < 6; c++)
+        soa[c].resize(count);
+    for (size_t i = 0; i < count; i++)
+        for (int c = 0; c < 3; c++)
+        {
+            soa[c][i] = origins[i][c];
+            soa[3 + c][i] = directions[i][c];
+        }
+
+    auto runScalar = [&]()
+    {
+        for (size_t i = 0; i < count; i++)
+            scalarT[i] = scalar(origins[i], directions[i]);
+    };
+    auto runPacket = [&]()
+    {
+        for (size_t i = 0; i < count; i += RT_SIMD_WIDTH)
+        {
+            SimdVec3 ro(SimdFloat::Load(&soa[0][i]), SimdFloat::Load(&soa[1][i]), SimdFloat::Load(&soa[2][i]));
+            SimdVec3 rd(SimdFloat::Load(&soa[3][i]), SimdFloat::Load(&soa[4][i]), SimdFloat::Load(&soa[5][i]));
+            packet(ro, rd).Store(&packetT[i]);
+        }
+    };
+    auto seconds = [](auto &&run)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        run();
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    // one untimed pass of each warms the caches and the clock, then the best of alternating runs counts,
+    // so neither version pays for coming first
+    const int RUNS = 5;
+    runScalar();
+    runPacket();
+    double scalarSeconds = 1.0e30, packetSeconds = 1.0e30;
+    for (int run = 0; run < RUNS; run++)
+    {
+        if (run % 2 == 0)
+        {
+            scalarSeconds = std::min(scalarSeconds, seconds(runScalar));
+            packetSeconds = std::min(packetSeconds, seconds(runPacket));
+        }
+        else
+        {
+            packetSeconds = std::min(packetSeconds, seconds(runPacket));
+            scalarSeconds = std::min(scalarSeconds, seconds(runScalar));
+        }
+    }
+
+    size_t hits = 0, differing = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        hits += scalarT[i] < RT_INFINITY;
+        if (std::abs(scalarT[i] - packetT[i]) > 1e-3f * std::max(1.0f, std::abs(scalarT[i])))
+            differing++;
+    }
+    printf("  %-16s scalar %8.2f Mrays/s   packet %8.2f Mrays/s (%.2fx)   %5.1f%% hits, %zu differing\n", name,
+           count / scalarSeconds / 1.0e6, count / packetSeconds / 1.0e6, scalarSeconds / packetSeconds,
+           100.0 * hits / count, differing);
+}
+
+// the intersection kernels of util/raypacket.h against their scalar counterparts, on random rays aimed at the shape
+void benchmarkKernels(Raytracer &raytracer)
+{
+    const int RAYS = 1 << 20;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<glm::vec3> origins(RAYS), directions(RAYS);
+    for (int i = 0; i < RAYS; i++)
+    {
+        origins[i] = glm::vec3(unit(rng), unit(rng), unit(rng)) * 2.0f + glm::vec3(0.0f, 0.0f, 4.0f);
+        glm::vec3 target = glm::vec3(unit(rng), unit(rng), unit(rng));
+        directions[i] = glm::normalize(target - origins[i]);
+    }
+    // the floor test looks down from above
+    std::vector<glm::vec3> floorOrigins(origins);
+    for (glm::vec3 &o : floorOrigins)
+        o.y += 3.0f;
+
+    std::cout << "intersection kernels (" << RT_SIMD_NAME << ", " << RT_SIMD_WIDTH << " rays per packet, one thread):" << std::endl;
+    benchmarkKernel(
+        "plane", floorOrigins, directions,
+        [&](const glm::vec3 &ro, const glm::vec3 &rd)
+        { glm::vec3 color; return raytracer.rayGridFloorIntersection(ro, rd, color); },
+        [](const SimdVec3 &ro, const SimdVec3 &rd)
+        { SimdFloat color; return RayPacketKernels::rayGridFloorIntersection(ro, rd, color); });
+    benchmarkKernel(
+        "sphere", origins, directions,
+        [](const glm::vec3 &ro, const glm::vec3 &rd)
+        { return Raytracer::intersectSphere(ro, rd, glm::vec3(0.0f), 0.8f); },
+        [](const SimdVec3 &ro, const SimdVec3 &rd)
+        { return RayPacketKernels::intersectSphere(ro, rd, 0.8f); });
+    benchmarkKernel(
+        "cylinder", origins, directions,
+        [](const glm::vec3 &ro, const glm::vec3 &rd)
+        { int hitType; return RayPacketKernels::intersectCylinder(ro, rd, glm::vec3(0.0f, -0.75f, 0.0f), 0.5f, 1.5f, hitType); },
+        [](const SimdVec3 &ro, const SimdVec3 &rd)
+        { SimdFloat hitType; return RayPacketKernels::intersectCylinder(ro, rd, glm::vec3(0.0f, -0.75f, 0.0f), 0.5f, 1.5f, hitType); });
+    // toruses: the interval comes from the bounding sphere, like in Raytracer::intersectPrimitive
+    const float R = 0.7f, r = 0.2f;
+    benchmarkKernel(
+        "torus analytic", origins, directions,
+        [&](const glm::vec3 &ro, const glm::vec3 &rd)
+        {
+            float tEnter, tExit;
+            if (!Raytracer::intersectBoundingSphere(ro, rd, glm::vec3(0.0f), R + r, RT_INFINITY, tEnter, tExit))
+                return RT_INFINITY;
+            return Raytracer::intersectTorusAnalytic(ro, rd, glm::vec3(0.0f), R, r, tEnter);
+        },
+        [&](const SimdVec3 &ro, const SimdVec3 &rd)
+        {
+            SimdFloat tEnter, tExit;
+            SimdMask hit = RayPacketKernels::intersectBoundingSphere(ro, rd, glm::vec3(0.0f), R + r, SimdFloat(RT_INFINITY), tEnter, tExit);
+            if (hit.None())
+                return SimdFloat(RT_INFINITY);
+            return Select(hit, RayPacketKernels::intersectTorusAnalytic(ro, rd, R, r, tEnter), SimdFloat(RT_INFINITY));
+        });
+    benchmarkKernel(
+        "torus march", origins, directions,
+        [&](const glm::vec3 &ro, const glm::vec3 &rd)
+        {
+            float tEnter, tExit;
+            if (!Raytracer::intersectBoundingSphere(ro, rd, glm::vec3(0.0f), R + r, RT_INFINITY, tEnter, tExit))
+                return RT_INFINITY;
+            return Raytracer::intersectTorus(ro, rd, glm::vec3(0.0f), R, r, tEnter, tExit + RT_EPSILON);
+        },
+        [&](const SimdVec3 &ro, const SimdVec3 &rd)
+        {
+            SimdFloat tEnter, tExit;
+            SimdMask hit = RayPacketKernels::intersectBoundingSphere(ro, rd, glm::vec3(0.0f), R + r, SimdFloat(RT_INFINITY), tEnter, tExit);
+            if (hit.None())
+                return SimdFloat(RT_INFINITY);
+            return RayPacketKernels::intersectTorus(ro, rd, R, r, tEnter, tExit + SimdFloat(RT_EPSILON), hit);
+        });
+}
+
+// renders the frame ray by ray and in packets, reports both throughputs and compares the images
+int comparePacketPaths(Raytracer &raytracer, const glm::mat4 &projection, const glm::mat4 &view,
+                       ThreadPool &pool, int frames, const std::string &outPath)
+{
+    benchmarkKernels(raytracer);
+
+    RaytracingImage scalar, packet;
+    scalar.Resize(SCR_WIDTH, SCR_HEIGHT);
+    packet.Resize(SCR_WIDTH, SCR_HEIGHT);
+
+    // an untimed frame first, so the ray by ray run does not pay for the thread start-up and cold caches
+    raytracer.usePackets = false;
+    renderFrames(raytracer, projection, view, scalar, pool, 1, false);
+    raytracer.ResetRayCount();
+    double scalarSeconds = renderFrames(raytracer, projection, view, scalar, pool, frames, false) * frames;
+    double scalarRays = (double)raytracer.GetRayCount();
+    raytracer.usePackets = true;
+    raytracer.ResetRayCount();
+    double packetSeconds = renderFrames(raytracer, projection, view, packet, pool, frames, false) * frames;
+    double packetRays = (double)raytracer.GetRayCount();
+
+    double meanDiff;
+    int maxDiff;
+    size_t differing = compareImages(scalar, packet, meanDiff, maxDiff);
+    size_t pixels = scalar.pixels.size();
+    std::cout << "frame, ray by ray: " << (scalarRays / scalarSeconds / 1.0e6) << " Mrays/s" << std::endl;
+    std::cout << "frame, packets:    " << (packetRays / packetSeconds / 1.0e6) << " Mrays/s ("
+              << (scalarSeconds / packetSeconds) << "x)" << std::endl;
+    std::cout << "pixels differing by more than 2/255: " << differing << " of " << pixels << " ("
+              << (100.0 * differing / pixels) << "%), mean difference " << meanDiff
+              << ", max difference " << maxDiff << std::endl;
+
+    if (!writeImage(outPath, packet))
+    {
+        std::cout << "ERROR::RAYTRACING_CPU : could not write " << outPath << std::endl;
+        return -1;
+    }
+    std::cout << "written to " << outPath << std::endl;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    // controllable settings
+    int maxDepth = 3;
+    int tileSize = 16;
+    unsigned int numThreads = 0; // 0 = all cores
+    int frames = 1;
+    bool analyticTorus = true;
+    bool compare = false;
+    bool simd = false;
+    bool usePackets = true;
+    bool useBVH = true;
+    int samples = 1;
+    float lightSize = 0.1f;
+    std::string sceneName = "default";
+    int count = 1000;
+    bool lightSet = false;
+    glm::vec3 lightPosition;
+    std::string outPath = "raytracing_cpu.png";
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--width" && hasValue)
+            SCR_WIDTH = std::atoi(argv[++i]);
+        else if (arg == "--height" && hasValue)
+            SCR_HEIGHT = std::atoi(argv[++i]);
+        else if (arg == "--depth" && hasValue)
+            maxDepth = std::atoi(argv[++i]);
+        else if (arg == "--tile" && hasValue)
+            tileSize = std::atoi(argv[++i]);
+        else if (arg == "--threads" && hasValue)
+            numThreads = (unsigned int)std::atoi(argv[++i]);
+        else if (arg == "--frames" && hasValue)
+            frames = std::atoi(argv[++i]);
+        else if (arg == "--torus" && hasValue && (std::string(argv[i + 1]) == "analytic" || std::string(argv[i + 1]) == "march"))
+            analyticTorus = std::string(argv[++i]) == "analytic";
+        else if (arg == "--compare")
+            compare = true;
+        else if (arg == "--simd")
+            simd = true;
+        else if (arg == "--packets" && hasValue && (std::string(argv[i + 1]) == "on" || std::string(argv[i + 1]) == "off"))
+            usePackets = std::string(argv[++i]) == "on";
+        else if (arg == "--scene" && hasValue)
+            sceneName = argv[++i];
+        else if (arg == "--samples" && hasValue)
+            samples = std::atoi(argv[++i]);
+        else if (arg == "--light-size" && hasValue)
+            lightSize = (float)std::atof(argv[++i]);
+        else if (arg == "--count" && hasValue)
+            count = std::atoi(argv[++i]);
+        else if (arg == "--bvh" && hasValue && (std::string(argv[i + 1]) == "on" || std::string(argv[i + 1]) == "off"))
+            useBVH = std::string(argv[++i]) == "on";
+        else if (arg == "--out" && hasValue)
+            outPath = argv[++i];
+        else if (arg == "--light" && i + 3 < argc)
+        {
+            lightPosition.x = (float)std::atof(argv[++i]);
+            lightPosition.y = (float)std::atof(argv[++i]);
+            lightPosition.z = (float)std::atof(argv[++i]);
+            lightSet = true;
+        }
+        else
+        {
+            printUsage();
+            return arg == "--help" ? 0 : -1;
+        }
+    }
+    if (SCR_WIDTH <= 0 || SCR_HEIGHT <= 0 || maxDepth < 1 || tileSize < 1 || frames < 1 || count < 0 || samples < 1 ||
+        (sceneName != "default" && sceneName != "benchmark"))
+    {
+        printUsage();
+        return -1;
+    }
+
+    RaytracingScene scene = sceneName == "benchmark" ? RaytracingScene::Benchmark(count) : RaytracingScene::Default();
+    if (lightSet)
+        scene.lightPosition = lightPosition;
+
+    ThreadPool pool(numThreads);
+    auto b1 = std::chrono::high_resolution_clock::now();
+    Raytracer raytracer(scene);
+    auto b2 = std::chrono::high_resolution_clock::now();
+    std::cout << "scene: " << scene.primitives.size() << " primitives, BVH with " << raytracer.GetBVH().nodes.size()
+              << " nodes built in " << std::chrono::duration<double, std::milli>(b2 - b1).count() << " milliseconds" << std::endl;
+    raytracer.useBVH = useBVH;
+    raytracer.accumulate = samples > 1;
+    if (raytracer.accumulate)
+        frames = samples;
+    raytracer.lightSize = lightSize;
+    raytracer.maxDepth = maxDepth;
+    raytracer.tileSize = tileSize;
+    raytracer.analyticTorus = analyticTorus;
+    raytracer.usePackets = usePackets;
+
+    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / SCR_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 view = camera.GetViewMatrix();
+
+    std::cout << "Rendering " << SCR_WIDTH << "x" << SCR_HEIGHT << " (ray depth " << maxDepth << ", "
+              << tileSize << "x" << tileSize << " tiles) on " << pool.Size() << " threads ..." << std::endl;
+
+    if (compare)
+        return compareTorusIntersectors(raytracer, projection, view, pool, frames, outPath);
+    if (simd)
+        return comparePacketPaths(raytracer, projection, view, pool, frames, outPath);
+
+    std::cout << "torus intersection: " << (analyticTorus ? "analytic" : "sphere tracing")
+              << ", traversal: " << (useBVH ? "BVH" : "linear")
+              << ", " << (usePackets ? std::string(RT_SIMD_NAME) + " packets of " + std::to_string(RT_SIMD_WIDTH) : "ray by ray") << std::endl;
+
+    RaytracingImage image;
+    image.Resize(SCR_WIDTH, SCR_HEIGHT);
+    double totalSeconds = renderFrames(raytracer, projection, view, image, pool, frames, true) * frames;
+
+    double rays = (double)raytracer.GetRayCount();
+    std::cout << "traced " << (unsigned long long)rays << " rays in " << totalSeconds << " seconds ("
+              << (rays / totalSeconds / 1.0e6) << " Mrays/s)" << std::endl;
+
+    if (!writeImage(outPath, image))
+    {
+        std::cout << "ERROR::RAYTRACING_CPU : could not write " << outPath << std::endl;
+        return -1;
+    }
+    std::cout << "written to " << outPath << std::endl;
+    return 0;
+}
@@ -0,0 +1,32 @@
+#version 330 core
+out vec4 fragColor;
+
+// Checkerboard reconstruction: each frame traces only the pixels with (x + y + checkerParity) even,
+// stored in a half width target (texel (x / 2, y) holds image pixel x). The other half is taken from
+// the previous reconstructed image while nothing moved, otherwise it is interpolated from the four
+// direct neighbors, which all lie on this frame's checkerboard.
+uniform sampler2D traced;
+uniform sampler2D history;
+uniform int checkerParity;
+uniform bool historyValid;
+
+vec3 fetchTraced(ivec2 p) {
+    ivec2 size = textureSize(traced, 0);
+    return texelFetch(traced, clamp(ivec2(p.x >> 1, p.y), ivec2(0), size - 1), 0).rgb;
+}
+
+void main() {
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    if ((p.x & 1) == ((p.y + checkerParity) & 1)) {
+        fragColor = vec4(fetchTraced(p), 1.0);
+        return;
+    }
+
+    if (historyValid) {
+        fragColor = vec4(texelFetch(history, p, 0).rgb, 1.0);
+        return;
+    }
+    vec3 sum = fetchTraced(p + ivec2(-1, 0)) + fetchTraced(p + ivec2(1, 0)) +
+               fetchTraced(p + ivec2(0, -1)) + fetchTraced(p + ivec2(0, 1));
+    fragColor = vec4(0.25 * sum, 1.0);
+}
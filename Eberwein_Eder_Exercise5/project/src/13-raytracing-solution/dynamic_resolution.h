@@ -0,0 +1,106 @@
+#pragma once
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+
+// Keeps the ray tracing pass within the frame budget of a target frame rate by scaling its resolution.
+// The GPU time of the pass is measured with GL_TIME_ELAPSED queries (a small ring, so reading a result never
+// stalls), and since the cost grows with the pixel count, the scale moves by sqrt(budget / time).
+class DynamicResolution
+{
+public:
+    float TargetFPS = 60.0f;
+    float MinScale = 0.25f;
+    float MaxScale = 1.0f;
+    float Headroom = 0.8f; // share of the frame budget the ray tracing pass may use
+
+    // ------------------------------------------------------------------------
+    DynamicResolution()
+    {
+        glGenQueries(QUERY_COUNT, m_queries);
+    }
+
+    // call Release while the OpenGL context exists, the destructor runs too late for locals of main (after glfwTerminate)
+    ~DynamicResolution() { Release(); }
+
+    // deletes the queries, no OpenGL call is left for the destructor
+    void Release()
+    {
+        if (m_queries[0])
+            glDeleteQueries(QUERY_COUNT, m_queries);
+        std::fill(m_queries, m_queries + QUERY_COUNT, 0u);
+        m_pending = 0;
+    }
+
+    DynamicResolution(const DynamicResolution &) = delete;
+    DynamicResolution &operator=(const DynamicResolution &) = delete;
+
+    // current resolution scale in [MinScale, MaxScale]
+    float GetScale() const { return m_scale; }
+    // smoothed GPU time of the measured pass in milliseconds
+    float GetGPUTime() const { return m_gpuTime; }
+
+    // put the ray tracing pass between BeginPass and EndPass
+    // ------------------------------------------------------------------------
+    void BeginPass()
+    {
+        glBeginQuery(GL_TIME_ELAPSED, m_queries[m_next]);
+    }
+
+    void EndPass()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        m_next = (m_next + 1) % QUERY_COUNT;
+        m_pending = std::min(m_pending + 1, QUERY_COUNT);
+    }
+
+    // read finished queries and adjust the scale (call once per frame)
+    // ------------------------------------------------------------------------
+    void Update(bool adjust)
+    {
+        while (m_pending > 0)
+        {
+            unsigned int query = m_queries[(m_next + QUERY_COUNT - m_pending) % QUERY_COUNT];
+            GLint available = 0;
+            glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+            m_pending--;
+
+            float ms = (float)(nanoseconds / 1.0e6);
+            m_gpuTime = m_gpuTime > 0.0f ? 0.9f * m_gpuTime + 0.1f * ms : ms;
+            m_samples++;
+        }
+
+        // adjust a few times per second, on the smoothed time
+        if (!adjust || m_samples < 8 || m_gpuTime <= 0.0f)
+            return;
+        m_samples = 0;
+        float budget = Headroom * 1000.0f / TargetFPS;
+        float ratio = std::sqrt(budget / m_gpuTime);
+        // dead zone against oscillation, at most 10% per step
+        if (ratio > 0.95f && ratio < 1.05f)
+            return;
+        ratio = std::min(std::max(ratio, 0.9f), 1.1f);
+        m_scale = std::min(std::max(m_scale * ratio, MinScale), MaxScale);
+        // the next measurements belong to the new resolution
+        m_gpuTime *= ratio * ratio;
+    }
+
+private:
+    static const int QUERY_COUNT = 4;
+    unsigned int m_queries[QUERY_COUNT] = {};
+    int m_next = 0;
+    int m_pending = 0;
+    int m_samples = 0;
+    float m_gpuTime = 0.0f;
+    float m_scale = 1.0f;
+};
+
+#endif
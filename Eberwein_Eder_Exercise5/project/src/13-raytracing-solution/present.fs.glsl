@@ -0,0 +1,11 @@
+#version 330 core
+in vec2 texCoords;
+
+out vec4 fragColor;
+
+// the accumulated ray tracing result
+uniform sampler2D image;
+
+void main() {
+    fragColor = vec4(texture(image, texCoords).rgb, 1.0);
+}
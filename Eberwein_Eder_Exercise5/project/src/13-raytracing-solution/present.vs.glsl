@@ -0,0 +1,10 @@
+#version 330 core
+layout(location = 0) in vec3 a_position;
+layout(location = 1) in vec2 a_texcoord;
+
+out vec2 texCoords;
+
+void main() {
+    texCoords = a_texcoord;
+    gl_Position = vec4(a_position, 1.0);
+}
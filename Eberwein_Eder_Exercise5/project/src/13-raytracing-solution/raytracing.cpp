@@ -11,7 +11,13 @@
 #include <util/model.h>
 #include <util/assets.h>
 #include <util/window.h>
+#include <util/rtscene.h>
+#include <util/bvh.h>
+#include <util/rendertarget.h>
 
+#include "dynamic_resolution.h"
+
+#include <algorithm>
 #include <iostream>
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
@@ -21,6 +27,8 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
 unsigned int loadTexture(const char *path);
 void renderQuad();
+void uploadScene(unsigned int sceneBuffer, unsigned int bvhBuffer, const RaytracingScene &scene, BVH &bvh);
+bool sceneGUI(RaytracingScene &scene);
 
 // settings
 int SCR_WIDTH = 1280;
@@ -39,16 +47,43 @@ bool rightButtonDown = false;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
+// shaders selectable in the GUI
+enum RenderMode
+{
+    RENDER_RAYTRACING,          // raytracing.fs.glsl
+    RENDER_MULTISAMPLE_GRID,    // raytracing_multisample.fs.glsl, 2x2 grid for every pixel
+    RENDER_MULTISAMPLE_ADAPTIVE // raytracing_multisample.fs.glsl, 2x2 grid only for edge pixels
+};
+const char *RENDER_MODE_NAMES[] = {"raytracing", "multisample: 2x2 grid", "multisample: adaptive"};
+
 const char *APP_NAME = "Raytracing";
-int main()
+int main(int argc, char **argv)
 {
     // controllable settings
     bool animateLight = false;
     int maxDepth = 3;
+    bool analyticTorus = true;
+    bool useBVH = true;
+    int benchmarkCount = 1000;
+    bool accumulate = false;
+    int maxSamples = 1024;
+    float lightSize = 0.1f;
+    bool dynamicResolution = false;
+    float renderScale = 1.0f; // fixed scale while dynamicResolution is off
+    bool checkerboard = false;
+    int renderMode = RENDER_RAYTRACING;
+    bool showEdges = false;
+
+    if (!ParseCommandLine(argc, argv))
+        return -1;
+    CommandLineOption("accumulate", accumulate); // e.g. --set accumulate=1 --set samples=256
+    CommandLineOption("samples", maxSamples);
+    maxSamples = std::max(maxSamples, 1);
 
     // glfw: initialize and configure
     // ------------------------------
-    InitWindowAndGUI(SCR_WIDTH, SCR_HEIGHT, APP_NAME);
+    if (InitWindowAndGUI(SCR_WIDTH, SCR_HEIGHT, APP_NAME) < 0)
+        return -1;
 
     // OpenGL is initialized now, so we can use OpenGL functions
     // ------------------------------
@@ -68,20 +103,64 @@ int main()
     // build and compile shaders
     const std::string SRC = "../src/13-raytracing-solution/";
     Shader shader(SRC + "raytracing.vs.glsl", SRC + "raytracing.fs.glsl");
+    Shader presentShader(SRC + "present.vs.glsl", SRC + "present.fs.glsl");
+    Shader checkerboardShader(SRC + "present.vs.glsl", SRC + "checkerboard.fs.glsl");
+    Shader multisampleShader(SRC + "raytracing.vs.glsl", SRC + "raytracing_multisample.fs.glsl");
     shader.use();
 
+    // scene: the primitives and their BVH are packed into texture buffers (samplerBuffer primitives and
+    // bvhNodes in the shader), so editing the scene only re-uploads the buffers instead of recompiling the shader
+    RaytracingScene scene = RaytracingScene::Default();
+    BVH bvh;
+    unsigned int sceneBuffer, sceneTexture, bvhBuffer, bvhTexture;
+    glGenBuffers(1, &sceneBuffer);
+    glGenTextures(1, &sceneTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, sceneTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, sceneBuffer);
+    glGenBuffers(1, &bvhBuffer);
+    glGenTextures(1, &bvhTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, bvhTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, bvhBuffer);
+    bool sceneChanged = true;
+
     // light
-    glm::vec3 lightPosition(-1.0f, 5.0f, 1.0f);
+    glm::vec3 lightPosition = scene.lightPosition;
+
+    // offscreen ray tracing at render resolution (scaled, accumulated or checkerboarded), upsampled to the
+    // window by the present pass. Two RGBA32F targets: with progressive accumulation each frame reads the
+    // average of the previous one and writes the new average (with one more sample) into the other, with
+    // checkerboard rendering the previous one is the history of the reconstruction.
+    // The targets are linearly filtered for the upsampling present pass and reallocated when the render resolution changes.
+    const std::vector<Attachment> COLOR_TARGET = {{GL_RGBA32F, GL_LINEAR}};
+    RenderTarget image[2] = {{COLOR_TARGET}, {COLOR_TARGET}};
+    // transient targets: the traced half of the checkerboard (half width) and the first pass of the adaptive
+    // multisampling (color and hit ID/distance of one ray per pixel)
+    const std::vector<Attachment> FIRST_PASS_TARGET = {{GL_RGBA32F}, {GL_RG32F}};
+    FramebufferPool framebuffers;
+    int targetWidth = 0, targetHeight = 0;
+    int current = 0;
+    int frameIndex = 0;
+    int checkerFrame = 0;
+    DynamicResolution dynres;
+    // everything that invalidates the accumulated image
+    bool lastAccumulate = accumulate;
+    bool lastCheckerboard = false;
+    glm::mat4 lastViewProjection(0.0f);
+    glm::vec3 lastLightPosition(0.0f);
+    int lastMaxDepth = 0;
+    bool lastAnalyticTorus = analyticTorus;
+    float lastLightSize = lightSize;
 
     // render loop
-    while (!glfwWindowShouldClose(window))
+    while (!WindowShouldClose())
     {
-        float currentFrame = glfwGetTime();
+        float currentFrame = FrameTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
         glfwPollEvents();
         processInput(window);
+        UpdateCamera(camera);
 
         if (gui)
         {
@@ -90,11 +169,50 @@ int main()
             ImGui::NewFrame();
             ImGui::Begin(APP_NAME);
             ImGui::Text("FPS: %.1f", ImGui::GetIO().Framerate);
+            ImGui::Combo("shader", &renderMode, RENDER_MODE_NAMES, 3);
+            if (renderMode == RENDER_MULTISAMPLE_ADAPTIVE)
+                ImGui::Checkbox("show refined pixels", &showEdges);
             ImGui::SliderInt("ray depth", &maxDepth, 1, 10);
             ImGui::Checkbox("animate light", &animateLight);
+            ImGui::Checkbox("analytic torus", &analyticTorus);
+            ImGui::Checkbox("use BVH", &useBVH);
+            ImGui::Checkbox("progressive accumulation", &accumulate);
+            if (accumulate)
+            {
+                ImGui::Text("samples: %d", frameIndex);
+                ImGui::SliderInt("max samples", &maxSamples, 1, 4096);
+                ImGui::SliderFloat("light size", &lightSize, 0.0f, 1.0f);
+            }
+            ImGui::Checkbox("dynamic resolution", &dynamicResolution);
+            if (dynamicResolution)
+                ImGui::SliderFloat("target FPS", &dynres.TargetFPS, 30.0f, 144.0f, "%.0f");
+            else
+                ImGui::SliderFloat("resolution scale", &renderScale, 0.25f, 1.0f);
+            if (!accumulate)
+                ImGui::Checkbox("checkerboard", &checkerboard);
+            ImGui::Text("render resolution: %dx%d", targetWidth, targetHeight);
+            ImGui::Text("ray tracing GPU time: %.2f ms", dynres.GetGPUTime());
+            ImGui::SliderInt("benchmark primitives", &benchmarkCount, 1000, 10000);
+            if (ImGui::Button("load benchmark scene"))
+            {
+                scene = RaytracingScene::Benchmark(benchmarkCount);
+                lightPosition = scene.lightPosition;
+                sceneChanged = true;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("load default scene"))
+            {
+                scene = RaytracingScene::Default();
+                lightPosition = scene.lightPosition;
+                sceneChanged = true;
+            }
+            sceneChanged |= sceneGUI(scene);
             if (ImGui::Button("reload shaders"))
             {
                 shader.reload();
+                presentShader.reload();
+                checkerboardShader.reload();
+                multisampleShader.reload();
                 shader.use();
             }
             ImGui::End();
@@ -112,28 +230,270 @@ int main()
         glDisable(GL_BLEND);
 
         glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / SCR_HEIGHT, 0.1f, 100.0f);
-        shader.setMat4("projection", projection);
         glm::mat4 view = camera.GetViewMatrix();
-        shader.setMat4("view", view);
-        shader.setVec3("camPos", camera.Position);
-        shader.setInt("maxDepth", maxDepth);
-        shader.setVec2("viewportSize", glm::vec2(SCR_WIDTH, SCR_HEIGHT));
-
         glm::vec3 newPos = lightPosition;
         if (animateLight)
-            newPos = lightPosition + glm::vec3(sin(glfwGetTime()) * 3.0, 0.0, 0.0);
-        shader.setVec3("lightPosition", newPos);
+            newPos = lightPosition + glm::vec3(sin(FrameTime()) * 3.0, 0.0, 0.0);
+
+        if (renderMode != RENDER_RAYTRACING)
+        {
+            // the floor and cylinder scene of raytracing_multisample.fs.glsl, at window resolution
+            multisampleShader.use();
+            multisampleShader.setMat4("projection", projection);
+            multisampleShader.setMat4("view", view);
+            multisampleShader.setVec3("camPos", camera.Position);
+            multisampleShader.setInt("maxDepth", maxDepth);
+            multisampleShader.setVec3("lightPosition", newPos);
+            multisampleShader.setVec2("viewportSize", glm::vec2(SCR_WIDTH, SCR_HEIGHT));
+            multisampleShader.setVec2("jitter", glm::vec2(0.0f));
+            multisampleShader.setBool("showEdges", showEdges);
+            targetWidth = SCR_WIDTH;
+            targetHeight = SCR_HEIGHT;
+            dynres.BeginPass();
+            if (renderMode == RENDER_MULTISAMPLE_GRID)
+            {
+                multisampleShader.setInt("aaPass", 0);
+                renderQuad();
+            }
+            else
+            {
+                // one ray per pixel
+                RenderTarget &firstPass = framebuffers.Acquire(FIRST_PASS_TARGET, SCR_WIDTH, SCR_HEIGHT);
+                multisampleShader.setInt("aaPass", 1);
+                firstPass.Bind();
+                renderQuad();
+                glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
+                glViewport(0, 0, display_w, display_h);
+
+                // supersample the pixels on edges of the first pass, copy the rest
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, firstPass.Texture(0));
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_2D, firstPass.Texture(1));
+                multisampleShader.setInt("firstPassColor", 0);
+                multisampleShader.setInt("firstPassHit", 1);
+                multisampleShader.setInt("aaPass", 2);
+                renderQuad();
+                framebuffers.Release(firstPass);
+            }
+            dynres.EndPass();
+        }
+        else
+        {
+            shader.use();
+            shader.setMat4("projection", projection);
+            shader.setMat4("view", view);
+            shader.setVec3("camPos", camera.Position);
+            shader.setInt("maxDepth", maxDepth);
+            shader.setBool("analyticTorus", analyticTorus);
+
+            shader.setVec3("lightPosition", newPos);
+
+            // restart the accumulation if anything changed
+            bool reset = sceneChanged || projection * view != lastViewProjection || newPos != lastLightPosition ||
+                         maxDepth != lastMaxDepth || analyticTorus != lastAnalyticTorus || lightSize != lastLightSize;
+            lastViewProjection = projection * view;
+            lastLightPosition = newPos;
+            lastMaxDepth = maxDepth;
+            lastAnalyticTorus = analyticTorus;
+            lastLightSize = lightSize;
+
+            if (sceneChanged)
+            {
+                uploadScene(sceneBuffer, bvhBuffer, scene, bvh);
+                sceneChanged = false;
+            }
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_BUFFER, sceneTexture);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_BUFFER, bvhTexture);
+            shader.setInt("primitives", 0);
+            shader.setInt("numPrimitives", (int)scene.primitives.size());
+            shader.setInt("bvhNodes", 1);
+            shader.setInt("numBvhNodes", (int)bvh.nodes.size());
+            shader.setBool("useBVH", useBVH);
+            shader.setBool("accumulate", accumulate);
+            shader.setFloat("lightSize", lightSize);
+
+            // resolution of the ray tracing pass
+            float scale = dynamicResolution ? dynres.GetScale() : renderScale;
+            int renderWidth = std::max(1, (int)(SCR_WIDTH * scale + 0.5f));
+            int renderHeight = std::max(1, (int)(SCR_HEIGHT * scale + 0.5f));
+            bool useCheckerboard = checkerboard && !accumulate;
+            // the traced half holds exactly every other pixel of a row, the ray offset of raytracing.fs.glsl
+            // (half a step of the half width target) only matches full resolution pixels for an even width
+            if (useCheckerboard)
+                renderWidth += renderWidth & 1;
+            reset |= accumulate != lastAccumulate || useCheckerboard != lastCheckerboard;
+            lastAccumulate = accumulate;
+            lastCheckerboard = useCheckerboard;
 
-        renderQuad();
+            shader.setVec2("viewportSize", glm::vec2(renderWidth, renderHeight));
+            shader.setBool("checkerboard", false);
+            shader.setInt("frameIndex", 0);
+            shader.setVec2("jitter", glm::vec2(0.0f));
+
+            if (!accumulate && !useCheckerboard && renderWidth == SCR_WIDTH && renderHeight == SCR_HEIGHT)
+            {
+                // full resolution: trace straight into the window
+                targetWidth = SCR_WIDTH;
+                targetHeight = SCR_HEIGHT;
+                dynres.BeginPass();
+                renderQuad();
+                dynres.EndPass();
+            }
+            else
+            {
+                // the content is lost when the targets are reallocated
+                reset |= image[0].Resize(renderWidth, renderHeight);
+                reset |= image[1].Resize(renderWidth, renderHeight);
+                targetWidth = renderWidth;
+                targetHeight = renderHeight;
+                if (reset)
+                    frameIndex = 0;
+
+                // a converged accumulation costs nothing but the present pass
+                if (!accumulate || frameIndex < maxSamples)
+                {
+                    int previous = current;
+                    current = 1 - current;
+                    dynres.BeginPass();
+                    if (accumulate)
+                    {
+                        // add one sample to the average of the previous frame
+                        glActiveTexture(GL_TEXTURE2);
+                        glBindTexture(GL_TEXTURE_2D, image[previous].Texture(0));
+                        shader.setInt("previousFrame", 2);
+                        shader.setInt("frameIndex", frameIndex);
+                        shader.setVec2("jitter", RaytracingJitter(frameIndex));
+                        image[current].Bind();
+                        renderQuad();
+                        frameIndex++;
+                    }
+                    else if (useCheckerboard)
+                    {
+                        // trace half of the pixels, then reconstruct the full image
+                        int parity = (checkerFrame++) & 1;
+                        shader.setBool("checkerboard", true);
+                        shader.setInt("checkerParity", parity);
+                        RenderTarget &checker = framebuffers.Acquire(COLOR_TARGET, renderWidth / 2, renderHeight);
+                        checker.Bind();
+                        renderQuad();
+
+                        checkerboardShader.use();
+                        glActiveTexture(GL_TEXTURE0);
+                        glBindTexture(GL_TEXTURE_2D, checker.Texture(0));
+                        glActiveTexture(GL_TEXTURE2);
+                        glBindTexture(GL_TEXTURE_2D, image[previous].Texture(0));
+                        checkerboardShader.setInt("traced", 0);
+                        checkerboardShader.setInt("history", 2);
+                        checkerboardShader.setInt("checkerParity", parity);
+                        checkerboardShader.setBool("historyValid", !reset);
+                        image[current].Bind();
+                        renderQuad();
+                        framebuffers.Release(checker);
+                    }
+                    else
+                    {
+                        image[current].Bind();
+                        renderQuad();
+                    }
+                    dynres.EndPass();
+                    glBindFramebuffer(GL_FRAMEBUFFER, ScreenFramebuffer());
+                    glViewport(0, 0, display_w, display_h);
+                }
+
+                // upsample to the window (bilinear)
+                presentShader.use();
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, image[current].Texture(0));
+                presentShader.setInt("image", 0);
+                renderQuad();
+            }
+        }
+        dynres.Update(dynamicResolution);
 
         if (gui)
             ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        glfwSwapBuffers(window);
+        framebuffers.EndFrame();
+        PresentFrame();
     }
+    image[0].Release();
+    image[1].Release();
+    framebuffers.Clear();
+    dynres.Release();
+    glDeleteTextures(1, &sceneTexture);
+    glDeleteBuffers(1, &sceneBuffer);
+    glDeleteTextures(1, &bvhTexture);
+    glDeleteBuffers(1, &bvhBuffer);
     glfwTerminate();
     return 0;
 }
 
+// build the BVH, pack the scene in its leaf order and (re)allocate the texture buffer storage with both
+// ---------------------------------------------------------------------------------------------
+void uploadScene(unsigned int sceneBuffer, unsigned int bvhBuffer, const RaytracingScene &scene, BVH &bvh)
+{
+    bvh.Build(scene);
+    std::vector<glm::vec4> data = scene.Pack(bvh.primitiveOrder);
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    if ((GLint)data.size() > maxTexels || (GLint)(bvh.nodes.size() * 2) > maxTexels)
+        std::cout << "ERROR::RAYTRACING : scene needs " << data.size() << " texels, the texture buffer holds at most " << maxTexels << std::endl;
+
+    glBindBuffer(GL_TEXTURE_BUFFER, sceneBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, data.size() * sizeof(glm::vec4), data.empty() ? nullptr : data.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, bvhBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, bvh.GetDataSize(), bvh.GetData(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// scene editor, returns true if the scene was modified
+// ---------------------------------------------------------------------------------------------
+bool sceneGUI(RaytracingScene &scene)
+{
+    bool changed = false;
+    if (!ImGui::CollapsingHeader("scene"))
+        return false;
+
+    ImGui::Text("%d primitives", (int)scene.primitives.size());
+    if (ImGui::Button("add sphere"))
+    {
+        scene.primitives.push_back(RaytracingPrimitive::Sphere(glm::vec3(0.0f, 1.0f, 0.0f), 0.5f, glm::vec3(1.0f, 0.0f, 0.0f)));
+        changed = true;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("add torus"))
+    {
+        scene.primitives.push_back(RaytracingPrimitive::Torus(glm::vec3(0.0f, 1.0f, 0.0f), 0.7f, 0.2f, glm::vec3(0.0f, 1.0f, 0.0f)));
+        changed = true;
+    }
+
+    for (int i = 0; i < (int)scene.primitives.size(); i++)
+    {
+        RaytracingPrimitive &p = scene.primitives[i];
+        ImGui::PushID(i);
+        if (ImGui::TreeNode("primitive", "%s %d", p.type == PRIM_TORUS ? "torus" : "sphere", i))
+        {
+            changed |= ImGui::DragFloat3("position", &p.position.x, 0.05f);
+            changed |= ImGui::DragFloat3("rotation", &p.rotation.x, 1.0f);
+            if (p.type == PRIM_TORUS)
+                changed |= ImGui::DragFloat2("radii", &p.size.x, 0.01f, 0.01f, 10.0f);
+            else
+                changed |= ImGui::DragFloat("radius", &p.size.x, 0.01f, 0.01f, 10.0f);
+            changed |= ImGui::ColorEdit3("color", &p.color.x);
+            if (ImGui::Button("remove"))
+            {
+                scene.primitives.erase(scene.primitives.begin() + i);
+                changed = true;
+            }
+            ImGui::TreePop();
+        }
+        ImGui::PopID();
+    }
+    return changed;
+}
+
 void processInput(GLFWwindow *window)
 {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
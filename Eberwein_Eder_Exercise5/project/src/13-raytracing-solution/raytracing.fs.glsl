@@ -11,11 +11,72 @@ out vec4 fragColor;
 uniform vec3 lightPosition;
 uniform int maxDepth;
 uniform vec2 viewportSize;
+uniform bool analyticTorus; // closed-form quartic instead of sphere tracing
+
+// Progressive accumulation: every frame adds one sample (jittered primary ray, random point on the
+// light) to the running average in previousFrame, which raytracing.cpp resets to frameIndex = 0
+// whenever the camera, the light or the scene changes.
+uniform bool accumulate;
+uniform int frameIndex;
+uniform sampler2D previousFrame;
+uniform float lightSize; // radius of the spherical light, only sampled while accumulating
+
+// Checkerboard rendering: the target is half as wide as the image and every fragment traces one of the
+// two image pixels it covers, alternating per row and frame (reconstructed in checkerboard.fs.glsl).
+uniform bool checkerboard;
+uniform int checkerParity;
+
+// Scene primitives, uploaded by raytracing.cpp (see include/util/rtscene.h).
+// PRIMITIVE_TEXELS RGBA32F texels per primitive:
+//   0:   world space bounding sphere (center, radius)
+//   1-3: rows of the world-to-object transform (rotation in xyz, translation in w)
+//   4:   type, size.x, size.y (sphere: radius, torus: R and r)
+//   5:   color
+uniform samplerBuffer primitives;
+uniform int numPrimitives;
+
+// BVH over the primitives (see include/util/bvh.h), two RGBA32F texels per node:
+//   0: box min, escape link (int bits)
+//   1: box max, leaf info (int bits): (first primitive << 3) | count, 0 for interior nodes
+uniform samplerBuffer bvhNodes;
+uniform int numBvhNodes;
+uniform bool useBVH;
 
 #define INFINITY 100000.0
 #define EPSILON 1e-5
 #define RAY_OFFSET 0.0001
 
+#define PI 3.14159265359
+#define PRIMITIVE_TEXELS 6
+#define PRIM_SPHERE 0
+#define PRIM_TORUS 1
+
+// ------------------------------------------------------------------------
+// RANDOM NUMBERS
+// ------------------------------------------------------------------------
+// PCG hash, seeded per pixel and frame in main().
+uint rngState;
+
+uint pcgHash(uint v) {
+    uint state = v * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// uniform in [0, 1)
+float random() {
+    rngState = pcgHash(rngState);
+    return float(rngState >> 8u) / 16777216.0;
+}
+
+// uniform point inside the unit sphere
+vec3 randomInUnitSphere() {
+    float z = 2.0 * random() - 1.0;
+    float phi = 2.0 * PI * random();
+    float r = sqrt(max(1.0 - z * z, 0.0));
+    return vec3(r * cos(phi), r * sin(phi), z) * pow(random(), 1.0 / 3.0);
+}
+
 // ------------------------------------------------------------------------
 // GRID FLOOR
 // ------------------------------------------------------------------------
@@ -42,6 +103,25 @@ float rayGridFloorIntersection(vec3 ro, vec3 rd, out vec3 floorColor) {
     return t;
 }
 
+// ------------------------------------------------------------------------
+// BOUNDING VOLUMES
+// ------------------------------------------------------------------------
+// Ray/sphere test used as broad phase. Returns false if the sphere is missed or
+// lies completely outside [0, tMax], otherwise the (clamped) entry and exit distances.
+bool intersectBoundingSphere(vec3 ro, vec3 rd, vec3 center, float radius, float tMax,
+                             out float tEnter, out float tExit) {
+    vec3 oc = ro - center;
+    float b = dot(oc, rd);
+    float h = b * b - dot(oc, oc) + radius * radius;
+    tEnter = INFINITY;
+    tExit = -INFINITY;
+    if (h < 0.0) return false;
+    h = sqrt(h);
+    tEnter = max(-b - h, 0.0);
+    tExit = min(-b + h, tMax);
+    return tEnter <= tExit && tExit >= EPSILON;
+}
+
 // ------------------------------------------------------------------------
 // TORUS SDF FUNCTIONS & SPHERE TRACING INTERSECTION
 // ------------------------------------------------------------------------
@@ -58,10 +138,11 @@ float sdTorus(vec3 p, vec2 t) {
 // ro: ray origin, rd: normalized ray direction.
 // torusCenter: world-space center of the torus.
 // R: major radius, r: minor radius.
-float intersectTorus(vec3 ro, vec3 rd, vec3 torusCenter, float R, float r) {
+// tStart, tEnd: the part of the ray inside the bounding sphere.
+float intersectTorus(vec3 ro, vec3 rd, vec3 torusCenter, float R, float r, float tStart, float tEnd) {
     const int MAX_STEPS = 128;
-    const float tMax = 100.0;
-    float t = 0.0;
+    float tMax = min(tEnd, 100.0);
+    float t = tStart;
     for (int i = 0; i < MAX_STEPS; i++) {
         vec3 pos = ro + rd * t - torusCenter;
         float d = sdTorus(pos, vec2(R, r));
@@ -84,24 +165,237 @@ vec3 getTorusNormal(vec3 pos, vec3 torusCenter, float R, float r) {
     return normalize(grad);
 }
 
-// Add a torus to the scene. If the torus is hit closer than any previous hit,
+// ------------------------------------------------------------------------
+// ANALYTIC TORUS INTERSECTION
+// ------------------------------------------------------------------------
+float cbrt(float x) {
+    return sign(x) * pow(abs(x), 1.0 / 3.0);
+}
+
+// Largest real root of m^3 + a*m^2 + b*m + c = 0.
+float solveCubicLargest(float a, float b, float c) {
+    float p = b - a * a / 3.0;
+    float q = 2.0 * a * a * a / 27.0 - a * b / 3.0 + c;
+    float disc = q * q / 4.0 + p * p * p / 27.0;
+    float z;
+    if (disc > 0.0) {
+        float s = sqrt(disc);
+        z = cbrt(-q / 2.0 + s) + cbrt(-q / 2.0 - s);
+    } else {
+        // three real roots, the k = 0 branch of the trigonometric solution is the largest one
+        float rho = sqrt(max(-p / 3.0, 0.0));
+        float cosPhi = rho > 0.0 ? clamp(-q / (2.0 * rho * rho * rho), -1.0, 1.0) : 0.0;
+        z = 2.0 * rho * cos(acos(cosPhi) / 3.0);
+    }
+    return z - a / 3.0;
+}
+
+// Real roots of y^2 + b*y + c = 0 appended to roots (unused slots stay at INFINITY).
+void solveQuadratic(float b, float c, float shift, inout vec4 roots, inout int n) {
+    float h = b * b / 4.0 - c;
+    if (h < 0.0) return;
+    h = sqrt(h);
+    roots[n++] = -b / 2.0 - h - shift;
+    roots[n++] = -b / 2.0 + h - shift;
+}
+
+// Real roots of the monic quartic x^4 + b*x^3 + c*x^2 + d*x + e = 0 (Ferrari's method).
+int solveQuartic(float b, float c, float d, float e, out vec4 roots) {
+    roots = vec4(INFINITY);
+    int n = 0;
+    // depressed quartic y^4 + p*y^2 + q*y + r = 0 with x = y - b/4
+    float shift = b / 4.0;
+    float b2 = b * b;
+    float p = c - 3.0 * b2 / 8.0;
+    float q = d - b * c / 2.0 + b2 * b / 8.0;
+    float r = e - b * d / 4.0 + b2 * c / 16.0 - 3.0 * b2 * b2 / 256.0;
+
+    // resolvent cubic m^3 + p*m^2 + (p^2/4 - r)*m - q^2/8 = 0 always has a root m >= 0
+    float m = max(solveCubicLargest(p, p * p / 4.0 - r, -q * q / 8.0), 0.0);
+    if (m < 1e-10) {
+        // biquadratic: y^4 + p*y^2 + r = 0
+        float h = p * p / 4.0 - r;
+        if (h < 0.0) return 0;
+        h = sqrt(h);
+        float y2 = -p / 2.0 - h;
+        if (y2 >= 0.0) { roots[n++] = -sqrt(y2) - shift; roots[n++] = sqrt(y2) - shift; }
+        y2 = -p / 2.0 + h;
+        if (y2 >= 0.0) { roots[n++] = -sqrt(y2) - shift; roots[n++] = sqrt(y2) - shift; }
+        return n;
+    }
+    float s = sqrt(2.0 * m);
+    solveQuadratic(-s, p / 2.0 + m + q / (2.0 * s), shift, roots, n);
+    solveQuadratic(s, p / 2.0 + m - q / (2.0 * s), shift, roots, n);
+    return n;
+}
+
+// Closed-form ray/torus intersection: solves the quartic
+//   (|p|^2 + R^2 - r^2)^2 = 4 R^2 (p.x^2 + p.z^2),  p = ro + t * rd
+// ro is first moved to tStart (the entry into the bounding sphere) to keep the
+// coefficients well conditioned in single precision, each root is then polished
+// with two Newton steps.
+float intersectTorusAnalytic(vec3 ro, vec3 rd, vec3 torusCenter, float R, float r, float tStart) {
+    float t0 = tStart;
+    vec3 o = ro - torusCenter + t0 * rd;
+
+    float R2 = R * R;
+    float k = dot(o, o) + R2 - r * r;
+    float a = dot(o, rd);
+    float c3 = 4.0 * a;
+    float c2 = 4.0 * a * a + 2.0 * k - 4.0 * R2 * dot(rd.xz, rd.xz);
+    float c1 = 4.0 * a * k - 8.0 * R2 * dot(o.xz, rd.xz);
+    float c0 = k * k - 4.0 * R2 * dot(o.xz, o.xz);
+
+    vec4 roots;
+    int n = solveQuartic(c3, c2, c1, c0, roots);
+    float tHit = INFINITY;
+    for (int i = 0; i < n; i++) {
+        float t = roots[i];
+        for (int j = 0; j < 2; j++) {
+            float f = (((t + c3) * t + c2) * t + c1) * t + c0;
+            float df = ((4.0 * t + 3.0 * c3) * t + 2.0 * c2) * t + c1;
+            if (df != 0.0) t -= f / df;
+        }
+        if (t0 + t > EPSILON) tHit = min(tHit, t0 + t);
+    }
+    return tHit;
+}
+
+// Exact torus normal: the gradient of sdTorus, i.e. the direction from the
+// closest point on the ring to pos.
+vec3 getTorusNormalAnalytic(vec3 pos, vec3 torusCenter, float R) {
+    vec3 p = pos - torusCenter;
+    vec3 ring = normalize(vec3(p.x, 0.0, p.z)) * R;
+    return normalize(p - ring);
+}
+
+// ------------------------------------------------------------------------
+// SPHERE
+// ------------------------------------------------------------------------
+float intersectSphere(vec3 ro, vec3 rd, vec3 center, float radius) {
+    vec3 oc = ro - center;
+    float b = dot(oc, rd);
+    float h = b * b - dot(oc, oc) + radius * radius;
+    if (h < 0.0) return INFINITY;
+    h = sqrt(h);
+    float t = -b - h;
+    if (t < EPSILON) t = -b + h;
+    return t < EPSILON ? INFINITY : t;
+}
+
+// ------------------------------------------------------------------------
+// PRIMITIVE BUFFER
+// ------------------------------------------------------------------------
+vec4 fetchPrimitive(int index, int texel) {
+    return texelFetch(primitives, index * PRIMITIVE_TEXELS + texel);
+}
+
+vec3 toObjectSpace(int index, vec4 v) {
+    return vec3(dot(fetchPrimitive(index, 1), v), dot(fetchPrimitive(index, 2), v), dot(fetchPrimitive(index, 3), v));
+}
+
+// Nearest hit of a primitive closer than tMax. Rays missing the bounding sphere
+// never reach the actual intersection test, and the torus march only runs across
+// the part of the ray inside the sphere. The ray is moved into object space; the
+// transform is rigid, so t is the same in both spaces.
+float intersectPrimitive(int index, vec3 ro, vec3 rd, float tMax) {
+    vec4 bounds = fetchPrimitive(index, 0);
+    float tEnter, tExit;
+    if (!intersectBoundingSphere(ro, rd, bounds.xyz, bounds.w, tMax, tEnter, tExit))
+        return INFINITY;
+
+    vec3 roObj = toObjectSpace(index, vec4(ro, 1.0));
+    vec3 rdObj = toObjectSpace(index, vec4(rd, 0.0));
+    vec4 shape = fetchPrimitive(index, 4);
+    if (int(shape.x) == PRIM_TORUS)
+        return analyticTorus ? intersectTorusAnalytic(roObj, rdObj, vec3(0.0), shape.y, shape.z, tEnter)
+                             : intersectTorus(roObj, rdObj, vec3(0.0), shape.y, shape.z, tEnter, tExit + EPSILON);
+    return intersectSphere(roObj, rdObj, vec3(0.0), shape.y);
+}
+
+// World space normal of a primitive at the world space position pos.
+vec3 getPrimitiveNormal(int index, vec3 pos) {
+    vec3 p = toObjectSpace(index, vec4(pos, 1.0));
+    vec4 shape = fetchPrimitive(index, 4);
+    vec3 n;
+    if (int(shape.x) == PRIM_TORUS)
+        n = analyticTorus ? getTorusNormalAnalytic(p, vec3(0.0), shape.y)
+                          : getTorusNormal(p, vec3(0.0), shape.y, shape.z);
+    else
+        n = normalize(p);
+    // the world-to-object rows are the object-to-world columns
+    return fetchPrimitive(index, 1).xyz * n.x + fetchPrimitive(index, 2).xyz * n.y + fetchPrimitive(index, 3).xyz * n.z;
+}
+
+// Add a primitive to the scene. If it is hit closer than any previous hit,
 // update the hit distance, color, and normal.
-void addTorus(vec3 ro, vec3 rd, vec3 torusCenter, float R, float r, vec3 color,
-              inout float hitDist, inout vec3 hitColor, inout vec3 hitNormal) {
-    float t = intersectTorus(ro, rd, torusCenter, R, r);
+void addPrimitive(int index, vec3 ro, vec3 rd, inout float hitDist, inout vec3 hitColor, inout vec3 hitNormal) {
+    float t = intersectPrimitive(index, ro, rd, hitDist);
     if(t < hitDist) {
-        vec3 pos = ro + rd * t;
-        hitNormal = getTorusNormal(pos, torusCenter, R, r);
+        hitNormal = getPrimitiveNormal(index, ro + rd * t);
         hitDist = t;
-        hitColor = color;
+        hitColor = fetchPrimitive(index, 5).rgb;
     }
 }
 
+// ------------------------------------------------------------------------
+// BVH TRAVERSAL
+// ------------------------------------------------------------------------
+// Slab test against a node box, true if it is entered before tMax.
+bool hitBox(vec3 ro, vec3 invRd, vec3 boxMin, vec3 boxMax, float tMax) {
+    vec3 t0 = (boxMin - ro) * invRd;
+    vec3 t1 = (boxMax - ro) * invRd;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar = max(t0, t1);
+    float tEnter = max(max(tNear.x, tNear.y), max(tNear.z, 0.0));
+    float tExit = min(min(tFar.x, tFar.y), min(tFar.z, tMax));
+    return tEnter <= tExit;
+}
+
+// Stackless traversal: the nodes are stored in depth-first order, so a hit
+// interior node continues with its left child (node + 1) and a missed node or
+// a finished leaf jumps to its escape link. Returns the closest hit closer than
+// tMax (with anyHit the first one found) and its primitive in hitIndex.
+float intersectBVH(vec3 ro, vec3 rd, float tMax, bool anyHit, out int hitIndex) {
+    hitIndex = -1;
+    // 1 / rd without infinities
+    vec3 invRd = 1.0 / vec3(abs(rd.x) > 1e-8 ? rd.x : 1e-8,
+                            abs(rd.y) > 1e-8 ? rd.y : 1e-8,
+                            abs(rd.z) > 1e-8 ? rd.z : 1e-8);
+    int node = 0;
+    while (node < numBvhNodes) {
+        vec4 nodeMin = texelFetch(bvhNodes, 2 * node);
+        vec4 nodeMax = texelFetch(bvhNodes, 2 * node + 1);
+        int miss = floatBitsToInt(nodeMin.w);
+        if (!hitBox(ro, invRd, nodeMin.xyz, nodeMax.xyz, tMax)) {
+            node = miss;
+            continue;
+        }
+        int info = floatBitsToInt(nodeMax.w);
+        if (info == 0) {
+            node++;
+            continue;
+        }
+        int first = info >> 3;
+        int last = first + (info & 7);
+        for (int i = first; i < last; i++) {
+            float t = intersectPrimitive(i, ro, rd, tMax);
+            if (t < tMax) {
+                tMax = t;
+                hitIndex = i;
+                if (anyHit) return t;
+            }
+        }
+        node = miss;
+    }
+    return hitIndex >= 0 ? tMax : INFINITY;
+}
+
 // ------------------------------------------------------------------------
 // SCENE DEFINITION
 // ------------------------------------------------------------------------
-// The scene consists of a grid floor (plane y = 0) and three blue toruses
-// stacked on top of each other.
+// The scene consists of a grid floor (plane y = 0) and the primitives from
+// the primitive buffer.
 float rayTraceScene(vec3 ro, vec3 rd, out vec3 hitNormal, out vec3 hitColor) {
     float hitDist = INFINITY;
     hitNormal = vec3(0.0);
@@ -115,15 +409,38 @@ float rayTraceScene(vec3 ro, vec3 rd, out vec3 hitNormal, out vec3 hitColor) {
         hitNormal = vec3(0.0, 1.0, 0.0);
     }
 
-    // Three blue toruses stacked vertically.
-    // Each torus has major radius 0.7 and minor radius 0.2.
-    addTorus(ro, rd, vec3(2.0, 0.5, 2.0), 0.7, 0.2, vec3(0.0, 0.0, 1.0), hitDist, hitColor, hitNormal);
-    addTorus(ro, rd, vec3(2.0, 1.5, 2.0), 0.7, 0.2, vec3(0.0, 0.0, 1.0), hitDist, hitColor, hitNormal);
-    addTorus(ro, rd, vec3(2.0, 2.5, 2.0), 0.7, 0.2, vec3(0.0, 0.0, 1.0), hitDist, hitColor, hitNormal);
+    if (useBVH) {
+        int hitIndex;
+        float t = intersectBVH(ro, rd, hitDist, false, hitIndex);
+        if (hitIndex >= 0) {
+            hitNormal = getPrimitiveNormal(hitIndex, ro + rd * t);
+            hitDist = t;
+            hitColor = fetchPrimitive(hitIndex, 5).rgb;
+        }
+    } else {
+        for (int i = 0; i < numPrimitives; i++)
+            addPrimitive(i, ro, rd, hitDist, hitColor, hitNormal);
+    }
 
     return hitDist;
 }
 
+// Any-hit query for shadow rays: true as soon as something is hit closer than
+// maxDist. No normal or color is needed and the search stops at the first occluder.
+bool rayTraceShadow(vec3 ro, vec3 rd, float maxDist) {
+    vec3 floorColor;
+    if (rayGridFloorIntersection(ro, rd, floorColor) < maxDist)
+        return true;
+    if (useBVH) {
+        int hitIndex;
+        return intersectBVH(ro, rd, maxDist, true, hitIndex) < maxDist;
+    }
+    for (int i = 0; i < numPrimitives; i++)
+        if (intersectPrimitive(i, ro, rd, maxDist) < maxDist)
+            return true;
+    return false;
+}
+
 // ------------------------------------------------------------------------
 // LIGHTING FUNCTIONS
 // ------------------------------------------------------------------------
@@ -137,15 +454,17 @@ float calcFresnel(vec3 normal, vec3 inRay) {
 // Basic Blinn–Phong lighting.
 vec3 calcLighting(vec3 hitPoint, vec3 normal, vec3 inRay, vec3 color) {
     vec3 ambient = vec3(0.1);
-    vec3 lightVec = lightPosition - hitPoint;
+    // soft shadows: one random point of the light per sample, the accumulation averages them
+    vec3 lightSample = lightPosition;
+    if (accumulate)
+        lightSample += lightSize * randomInUnitSphere();
+    vec3 lightVec = lightSample - hitPoint;
     vec3 lightDir = normalize(lightVec);
     float lightDist = length(lightVec);
     
     // Simple shadow: if something is hit between the hit point and the light,
     // only ambient light is added.
-    vec3 shadowNormal, shadowColor;
-    float shadowT = rayTraceScene(hitPoint + lightDir * RAY_OFFSET, lightDir, shadowNormal, shadowColor);
-    if(shadowT < lightDist)
+    if(rayTraceShadow(hitPoint + lightDir * RAY_OFFSET, lightDir, lightDist))
         return ambient * color;
     else {
         float diff = max(dot(normal, lightDir), 0.0);
@@ -161,8 +480,15 @@ vec3 calcLighting(vec3 hitPoint, vec3 normal, vec3 inRay, vec3 color) {
 // ------------------------------------------------------------------------
 void main() {
     fragColor = vec4(0.0);
+    rngState = pcgHash(uint(gl_FragCoord.x) + pcgHash(uint(gl_FragCoord.y) + pcgHash(uint(frameIndex))));
     vec3 ro = rayOrigin;
-    vec3 rd = normalize(rayDir);
+    vec3 rd = rayDir;
+    if (checkerboard) {
+        // rayDir is affine in screen space, one fragment step covers two image pixels
+        float imageX = float((int(gl_FragCoord.y) + checkerParity) & 1);
+        rd += dFdx(rayDir) * (imageX - 0.5) * 0.5;
+    }
+    rd = normalize(rd);
     
     vec3 hitColor;
     vec3 hitNormal;
@@ -189,6 +515,11 @@ void main() {
     
     if(totalWeight > 0.0)
         accumColor /= totalWeight;
-        
+
+    // running average over all samples since the last reset
+    if (accumulate && frameIndex > 0) {
+        vec3 previous = texelFetch(previousFrame, ivec2(gl_FragCoord.xy), 0).rgb;
+        accumColor = mix(previous, accumColor, 1.0 / float(frameIndex + 1));
+    }
     fragColor = vec4(accumColor, 1.0);
 }
@@ -7,6 +7,7 @@ uniform mat4 projection;
 uniform mat4 view;
 uniform vec3 camPos;
 uniform vec2 viewportSize;
+uniform vec2 jitter; // sub-pixel offset of the primary rays in pixels (progressive accumulation)
 
 out vec3 upOffset;
 out vec3 rightOffset;
@@ -16,7 +17,7 @@ out vec3 rayDir;
 void main() {
     rayOrigin = camPos;
     mat4 invView = inverse(view);
-    vec4 worldPos = inverse(projection * view) * vec4(a_position, 1.0);
+    vec4 worldPos = inverse(projection * view) * vec4(a_position.xy + jitter * 2.0 / viewportSize, a_position.z, 1.0);
     rayDir = (worldPos.xyz / worldPos.w) - rayOrigin;
     upOffset = normalize(invView[1].xyz) * (1.0 / viewportSize.y);
     rightOffset = normalize(invView[0].xyz) * (1.0 / viewportSize.x);
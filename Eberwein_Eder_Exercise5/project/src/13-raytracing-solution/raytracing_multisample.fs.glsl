@@ -1,7 +1,13 @@
+#version 330 core
 /**
  * A raytracer with multisampling (2×2 grid) for the new scene.
+ *
+ * Adaptive mode (aaPass 1 and 2): the first pass shoots one ray per pixel and writes the color and the
+ * hit ID/distance of the primary ray, the second pass shoots the 2×2 grid only for pixels that differ
+ * from a neighbor in any of them (silhouettes, floor cells, shadow borders) and copies the rest.
  */
-precision mediump float;
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec4 hitInfo; // first adaptive pass: hit ID, hit distance
 
 in vec3 upOffset;
 in vec3 rightOffset;
@@ -12,6 +18,23 @@ uniform vec3 lightPosition;
 uniform int maxDepth;
 uniform vec2 viewportSize;
 
+#define AA_GRID 0         // 2×2 grid for every pixel
+#define AA_FIRST_PASS 1   // one ray per pixel, writes hitInfo
+#define AA_REFINE_PASS 2  // 2×2 grid for edge pixels of the first pass
+uniform int aaPass;
+uniform sampler2D firstPassColor;
+uniform sampler2D firstPassHit;
+uniform bool showEdges; // tint the refined pixels red
+
+// edge detection thresholds of the refine pass
+#define EDGE_DEPTH 0.05    // relative difference of the hit distance
+#define EDGE_CONTRAST 0.05 // difference of the luminance
+
+// hit IDs
+#define ID_NONE 0
+#define ID_FLOOR 1
+#define ID_CYLINDER 2
+
 #define INFINITY 100000.0
 #define EPSILON 1e-5
 #define RAY_OFFSET 0.0001
@@ -36,16 +59,35 @@ float rayHoneycombFloorIntersection(vec3 ro, vec3 rd, out vec3 floorColor) {
     return t;
 }
 
-void addHoneycombFloor(vec3 ro, vec3 rd, inout float hitDist, inout vec3 hitColor, inout vec3 hitNormal) {
+void addHoneycombFloor(vec3 ro, vec3 rd, inout float hitDist, inout vec3 hitColor, inout vec3 hitNormal, inout int hitId) {
     vec3 floorColor;
     float t = rayHoneycombFloorIntersection(ro, rd, floorColor);
     if(t < hitDist) {
         hitDist = t;
         hitColor = floorColor;
         hitNormal = vec3(0.0, 1.0, 0.0);
+        hitId = ID_FLOOR;
     }
 }
 
+// Bounding volumes:
+// Ray/sphere test used as broad phase. Returns false if the sphere is missed or
+// lies completely outside [0, tMax].
+bool intersectBoundingSphere(vec3 ro, vec3 rd, vec3 center, float radius, float tMax) {
+    vec3 oc = ro - center;
+    float b = dot(oc, rd);
+    float h = b * b - dot(oc, oc) + radius * radius;
+    if (h < 0.0) return false;
+    h = sqrt(h);
+    return -b - h <= tMax && -b + h >= EPSILON;
+}
+
+// Sphere around a capped cylinder standing on baseCenter.
+bool hitCylinderBounds(vec3 ro, vec3 rd, vec3 baseCenter, float radius, float height, float tMax) {
+    vec3 center = baseCenter + vec3(0.0, 0.5 * height, 0.0);
+    return intersectBoundingSphere(ro, rd, center, length(vec2(radius, 0.5 * height)), tMax);
+}
+
 // Cylinder functions:
 float intersectCylinder(vec3 ro, vec3 rd, vec3 baseCenter, float radius, float height, out int hitType) {
     vec3 oc = ro - baseCenter;
@@ -96,8 +138,9 @@ float intersectCylinder(vec3 ro, vec3 rd, vec3 baseCenter, float radius, float h
     return tCylinder;
 }
 
-void addCylinder(vec3 ro, vec3 rd, vec3 baseCenter, float radius, float height, vec3 color,
-                 inout float hitDist, inout vec3 hitColor, inout vec3 hitNormal) {
+void addCylinder(vec3 ro, vec3 rd, vec3 baseCenter, float radius, float height, vec3 color, int id,
+                 inout float hitDist, inout vec3 hitColor, inout vec3 hitNormal, inout int hitId) {
+    if(!hitCylinderBounds(ro, rd, baseCenter, radius, height, hitDist)) return;
     int hitType;
     float t = intersectCylinder(ro, rd, baseCenter, radius, height, hitType);
     if(t < hitDist) {
@@ -113,17 +156,33 @@ void addCylinder(vec3 ro, vec3 rd, vec3 baseCenter, float radius, float height,
         }
         hitDist = t;
         hitColor = color;
+        hitId = id;
     }
 }
 
-float rayTraceScene(vec3 ro, vec3 rd, out vec3 hitNormal, out vec3 hitColor) {
+#define CYLINDER_BASE vec3(2.0, 0.0, 2.0)
+#define CYLINDER_RADIUS 0.5
+#define CYLINDER_HEIGHT 3.0
+
+float rayTraceScene(vec3 ro, vec3 rd, out vec3 hitNormal, out vec3 hitColor, out int hitId) {
     float hitDist = INFINITY;
     hitNormal = vec3(0.0);
-    addHoneycombFloor(ro, rd, hitDist, hitColor, hitNormal);
-    addCylinder(ro, rd, vec3(2.0, 0.0, 2.0), 0.5, 3.0, vec3(1.0, 0.0, 0.0), hitDist, hitColor, hitNormal);
+    hitId = ID_NONE;
+    addHoneycombFloor(ro, rd, hitDist, hitColor, hitNormal, hitId);
+    addCylinder(ro, rd, CYLINDER_BASE, CYLINDER_RADIUS, CYLINDER_HEIGHT, vec3(1.0, 0.0, 0.0), ID_CYLINDER,
+                hitDist, hitColor, hitNormal, hitId);
     return hitDist;
 }
 
+// Any-hit query for shadow rays: stops at the first occluder closer than maxDist.
+bool rayTraceShadow(vec3 ro, vec3 rd, float maxDist) {
+    vec3 floorColor;
+    if(rayHoneycombFloorIntersection(ro, rd, floorColor) < maxDist) return true;
+    if(!hitCylinderBounds(ro, rd, CYLINDER_BASE, CYLINDER_RADIUS, CYLINDER_HEIGHT, maxDist)) return false;
+    int hitType;
+    return intersectCylinder(ro, rd, CYLINDER_BASE, CYLINDER_RADIUS, CYLINDER_HEIGHT, hitType) < maxDist;
+}
+
 float calcFresnel(vec3 normal, vec3 inRay) {
     float bias = 0.0;
     float cosTheta = clamp(dot(normal, -inRay), 0.0, 1.0);
@@ -135,9 +194,7 @@ vec3 calcLighting(vec3 hitPoint, vec3 normal, vec3 inRay, vec3 color) {
     vec3 lightVec = lightPosition - hitPoint;
     vec3 lightDir = normalize(lightVec);
     float lightDist = length(lightVec);
-    vec3 shadowNormal, shadowColor;
-    float shadowT = rayTraceScene(hitPoint + lightDir * RAY_OFFSET, lightDir, shadowNormal, shadowColor);
-    if(shadowT < lightDist) {
+    if(rayTraceShadow(hitPoint + lightDir * RAY_OFFSET, lightDir, lightDist)) {
         return ambient * color;
     } else {
         float diff = max(dot(normal, lightDir), 0.0);
@@ -148,13 +205,21 @@ vec3 calcLighting(vec3 hitPoint, vec3 normal, vec3 inRay, vec3 color) {
     }
 }
 
-vec3 shootRayIntoScene(vec3 ro, vec3 rd) {
+// primaryId and primaryDist describe the first hit (ID_NONE and INFINITY for a miss)
+vec3 shootRayIntoScene(vec3 ro, vec3 rd, out int primaryId, out float primaryDist) {
     vec3 accumColor = vec3(0.0);
     vec3 hitColor;
     vec3 hitNormal;
+    int hitId;
     float totalWeight = 0.0;
+    primaryId = ID_NONE;
+    primaryDist = INFINITY;
     for(int i = 0; i < maxDepth; i++) {
-        float t = rayTraceScene(ro, rd, hitNormal, hitColor);
+        float t = rayTraceScene(ro, rd, hitNormal, hitColor, hitId);
+        if(i == 0) {
+            primaryId = hitId;
+            primaryDist = t;
+        }
         if(t >= INFINITY) break;
         vec3 hitPoint = ro + t * rd;
         float fresnel = calcFresnel(hitNormal, rd);
@@ -170,9 +235,13 @@ vec3 shootRayIntoScene(vec3 ro, vec3 rd) {
     return accumColor;
 }
 
-void main() {
-    vec3 ro = rayOrigin;
-    vec3 rd = normalize(rayDir);
+vec3 shootRayIntoScene(vec3 ro, vec3 rd) {
+    int primaryId;
+    float primaryDist;
+    return shootRayIntoScene(ro, rd, primaryId, primaryDist);
+}
+
+vec3 shootGrid(vec3 ro, vec3 rd) {
     vec3 accumColor = vec3(0.0);
     float samples = 0.0;
     for(float x = -1.0; x <= 1.0; x += 2.0) {
@@ -182,5 +251,49 @@ void main() {
             samples += 1.0;
         }
     }
-    fragColor = vec4(accumColor / samples, 1.0);
+    return accumColor / samples;
+}
+
+float luminance(vec3 color) {
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+// true if the first pass pixel with hit and luma differs from its neighbor q in hit ID, distance or brightness
+bool isEdge(ivec2 q, vec2 hit, float luma) {
+    q = clamp(q, ivec2(0), textureSize(firstPassHit, 0) - 1);
+    vec2 neighborHit = texelFetch(firstPassHit, q, 0).xy;
+    if(neighborHit.x != hit.x) return true;
+    if(hit.x != float(ID_NONE) && abs(neighborHit.y - hit.y) > EDGE_DEPTH * hit.y) return true;
+    return abs(luminance(texelFetch(firstPassColor, q, 0).rgb) - luma) > EDGE_CONTRAST;
+}
+
+void main() {
+    vec3 ro = rayOrigin;
+    vec3 rd = normalize(rayDir);
+    hitInfo = vec4(0.0);
+
+    if(aaPass == AA_FIRST_PASS) {
+        int primaryId;
+        float primaryDist;
+        fragColor = vec4(shootRayIntoScene(ro, rd, primaryId, primaryDist), 1.0);
+        hitInfo = vec4(float(primaryId), primaryDist, 0.0, 0.0);
+        return;
+    }
+
+    if(aaPass == AA_REFINE_PASS) {
+        ivec2 p = ivec2(gl_FragCoord.xy);
+        vec3 color = texelFetch(firstPassColor, p, 0).rgb;
+        vec2 hit = texelFetch(firstPassHit, p, 0).xy;
+        float luma = luminance(color);
+        if(!isEdge(p + ivec2(-1, 0), hit, luma) && !isEdge(p + ivec2(1, 0), hit, luma) &&
+           !isEdge(p + ivec2(0, -1), hit, luma) && !isEdge(p + ivec2(0, 1), hit, luma)) {
+            fragColor = vec4(color, 1.0);
+            return;
+        }
+        vec3 refined = shootGrid(ro, rd);
+        fragColor = vec4(showEdges ? mix(refined, vec3(1.0, 0.0, 0.0), 0.5) : refined, 1.0);
+        return;
+    }
+
+    fragColor = vec4(shootGrid(ro, rd), 1.0);
 }